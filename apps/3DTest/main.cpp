@@ -1,6 +1,6 @@
 #include <iostream>
 #include <RSlic3H.h>
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 
 #include "parser.h"
 #include "exporter.h"
@@ -27,6 +27,7 @@ auto measureTimeV(std::function<T()> function) ->  std::chrono::duration<double>
 }
 
 MovieCacheP loadFiles(MainSetting *s) {
+	if (s->memory > 0) return std::make_shared<DiskMovieCache>(s->filenames, static_cast<size_t>(s->memory) << 20);
 	return std::make_shared<SimpleMovieCache>(s->filenames);
 }
 
@@ -44,7 +45,7 @@ int main(int argc, char **argv) {
 	Slic3P slic;
 	if (settings->threadcount <=0) settings->threadcount=std::thread::hardware_concurrency();
 	ThreadPoolP pool = std::make_shared<ThreadPool>(settings->threadcount);
-	slic = Slic3::initialize(img, buildGradColor, s, settings->stiffness, pool);
+	slic = Slic3::initialize(img, s, settings->stiffness, pool);
 
 	if (slic.get() == nullptr) {
 		cout << "[ERROR] Not able to perform the algorithm. May you should play with the parameters." << endl;
@@ -63,6 +64,10 @@ int main(int argc, char **argv) {
 			exit(EXIT_FAILURE);
 			}
 			//showFirst(slic);
+			if (slic->getResidual().changed <= settings->threshold) {
+			std::cout << " - Converged";
+			break;
+			}
 			}
 			});
 	cout<<" - Needed "<<res.count()<<" Seconds";
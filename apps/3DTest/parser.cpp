@@ -21,12 +21,14 @@ ostream &operator<<(ostream &str, const vector<string> &list) {
 void printHelp(char *name) {
 	MainSetting *tmp = new MainSetting;
 	cout << "Program to create Supervoxel from images" << endl;
-	cout << name << " [-c ...] [-m ...] [-i ...] [-h] [-0] [-t ...] filename1 filename2 ... filename n [-o ...] " << endl;
+	cout << name << " [-c ...] [-m ...] [-i ...] [-e ...] [-h] [-0] [-t ...] [-r ...] filename1 filename2 ... filename n [-o ...] " << endl;
 	cout << "-c a: Set the number of Supervoxels to a (a is a number, default " << tmp->count << ")" << endl;
 	cout << "-m a: Set stiffness to a (a is a number, default " << tmp->stiffness << ")" << endl;
 	cout << "-i a: Set iteration count to a (a is a number, default " << tmp->iterations << ")" << endl;
+	cout << "-e a: Stop iterating if at most the fraction a of the voxels changes its cluster (default " << tmp->threshold << ", stops only if nothing changes)" << endl;
 	cout << "-o a: Set the output ply file to a. If not set, there will be no export." << endl;
 	cout << "-t a: Set the number of thread to be used. -1 does automatically detecting. (a is a number, default " << tmp->threadcount << ")" << endl;
+	cout << "-r a: Keep at most a MB of images in memory, they are loaded from disk when needed (a is a number, default " << tmp->memory << " = load all at once)" << endl;
 	cout << "-0: Use Slico algorithms. -m will be ignored (default "<< (tmp->slico?"true":"false")<<")" << endl;
 	cout << "-h: Print this help" << endl;
 	cout << "filenames: Set the filename of the image to convert (filename is a list the path, required)" << endl;
@@ -50,6 +52,9 @@ MainSetting *parseSetting(int argc, char **argv) {
 		} else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
 			res->iterations = atoi(argv[i + 1]);
 			i++;
+		} else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			res->threshold = atof(argv[i + 1]);
+			i++;
 		} else if (strcmp(argv[i], "-h") == 0) {
 			delete res;
 			printHelp(argv[0]);
@@ -60,6 +65,9 @@ MainSetting *parseSetting(int argc, char **argv) {
 		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
 			res->threadcount = atoi(argv[i + 1]);
 			i++;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			res->memory = atoi(argv[i + 1]);
+			i++;
 		} else if (strcmp(argv[i], "-0") == 0) {
 			res->slico = true;
 		}else {
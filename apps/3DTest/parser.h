@@ -11,18 +11,21 @@ std::ostream &operator<<(std::ostream &str, const std::vector<std::string> &list
 
 struct MainSetting {
 	MainSetting() : count(32400), stiffness(40),
-	threadcount(-1), iterations(10), slico(false) {}
+	threadcount(-1), iterations(10), threshold(0), slico(false), memory(0) {}
 
 	std::vector<std::string> filenames;
 	std::string outputfile;
 	int count;
 	int stiffness;
 	int iterations;
+	double threshold;
 	bool slico;
 	int threadcount;
+	int memory; // MB of images in memory, 0 = all
 
 	void print() {
 		std::cout << "[] Iterations " << iterations << std::endl;
+		std::cout << "[] Threshold " << threshold << std::endl;
 		std::cout << "[] Count " << count << std::endl;
 		std::cout << "[] stiffness " << stiffness << std::endl;
 		std::cout << "[] filenames " << filenames << std::endl;
@@ -0,0 +1,372 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <numeric>
+#include <algorithm>
+#include <string>
+#include <RSlic2H.h>
+#include <RSlic3H.h>
+#include <ThreadPool.h>
+#include <priv/Simd_p.h>
+
+using namespace std;
+
+struct BenchSize {
+	const char *name;
+	int w, h, d;
+};
+
+static const BenchSize pixelSizes[] = {{"VGA", 640, 480, 1}, {"HD", 1920, 1080, 1}, {"4K", 3840, 2160, 1}, {"8K", 7680, 4320, 1}};
+static const BenchSize voxelSizes[] = {{"S", 320, 180, 30}, {"M", 640, 360, 60}, {"L", 1280, 720, 60}};
+
+static const int seed = 42;
+
+struct BenchSetting {
+	BenchSetting() : counts{1000, 10000}, pixelSizes{"VGA", "HD", "4K"}, voxelSizes{"S", "M"},
+	                 stiffness(40), iterations(5), repetitions(3) {
+	}
+
+	vector<int> counts;
+	vector<int> threads;
+	vector<string> pixelSizes;
+	vector<string> voxelSizes;
+	int stiffness;
+	int iterations;
+	int repetitions;
+	string json; // file for the results, "-" = stdout
+};
+
+// Time of a kernel over all repetitions (ms)
+struct Timing {
+	double min, median, mean;
+};
+
+struct BenchResult {
+	string group; // pixel or voxel
+	BenchSize size;
+	int threads;
+	int count; // requested superpixel
+	int clusters; // the ones that were initialized
+	string kernel;
+	Timing time;
+};
+
+// Synthetic Lab picture: colored blocks with some noise (always the same for the same size)
+Mat syntheticImage(int w, int h) {
+	Mat res(h, w, CV_8UC3);
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> color(0, 255);
+	std::uniform_int_distribution<int> noise(-8, 8);
+	const int block = 64;
+	int bw = (w + block - 1) / block;
+	int bh = (h + block - 1) / block;
+	vector<Vec3b> blockColor(bw * bh);
+	for (auto &c: blockColor) c = Vec3b(color(gen), color(gen), color(gen));
+	for (int y = 0; y < h; y++) {
+		Vec3b *row = res.ptr<Vec3b>(y);
+		for (int x = 0; x < w; x++) {
+			const Vec3b &c = blockColor[(y / block) * bw + x / block];
+			for (int i = 0; i < 3; i++)
+				row[x][i] = saturate_cast<uint8_t>(c[i] + noise(gen));
+		}
+	}
+	return res;
+}
+
+// Synthetic movie: the picture moves one pixel to the left per frame
+RSlic::Voxel::MovieCacheP syntheticMovie(int w, int h, int d) {
+	Mat img = syntheticImage(w + d, h);
+	vector<Mat> frames;
+	for (int t = 0; t < d; t++) frames.push_back(img(Rect(t, 0, w, h)).clone());
+	return std::make_shared<RSlic::Voxel::SimpleMovieCache>(std::move(frames));
+}
+
+// Calls function repetitions times
+template<typename T>
+Timing measure(int repetitions, T function) {
+	vector<double> ms;
+	for (int i = 0; i < repetitions; i++) {
+		auto start = std::chrono::steady_clock::now();
+		function();
+		auto end = std::chrono::steady_clock::now();
+		ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	std::sort(ms.begin(), ms.end());
+	Timing res;
+	res.min = ms.front();
+	res.median = ms.size() % 2 == 1 ? ms[ms.size() / 2] : (ms[ms.size() / 2 - 1] + ms[ms.size() / 2]) / 2;
+	res.mean = std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+	return res;
+}
+
+// Collects the results of one size, thread count and cluster count
+class Recorder {
+public:
+	Recorder(vector<BenchResult> &results, ostream &log, const char *group, const BenchSize &size, int threads, int count) :
+			results(results), log(log), group(group), size(size), threads(threads), count(count), clusters(0) {
+	}
+
+	void setClusters(int c) {
+		clusters = c;
+		log << group << " " << size.name << " (" << size.w << "x" << size.h;
+		if (size.d > 1) log << "x" << size.d;
+		log << ", " << threads << " threads, " << clusters << " clusters)" << endl;
+	}
+
+	void add(const char *kernel, const Timing &time) {
+		log << "  " << kernel << ": ";
+		for (size_t i = strlen(kernel); i < 22; i++) log << ' ';
+		log << time.median << " ms (min " << time.min << ")" << endl;
+		results.push_back(BenchResult{group, size, threads, count, clusters, kernel, time});
+	}
+
+private:
+	vector<BenchResult> &results;
+	ostream &log;
+	string group;
+	BenchSize size;
+	int threads;
+	int count;
+	int clusters;
+};
+
+void benchPixel(const BenchSize &size, const Mat &img, int count, const BenchSetting &settings, ThreadPoolP pool, Recorder &rec) {
+	const int reps = settings.repetitions;
+	Mat grad;
+	Timing gradTime = measure(reps, [&]() { grad = RSlic::Pixel::buildGrad(img); });
+	int step = sqrt(size.w * size.h * 1.0 / count);
+	RSlic::Pixel::Slic2P init;
+	Timing initTime = measure(reps, [&]() { init = RSlic::Pixel::Slic2::initialize(img, grad, step, settings.stiffness, pool); });
+	if (init.get() == nullptr) {
+		cerr << "pixel " << size.name << ": initializing failed with " << count << " superpixel" << endl;
+		return;
+	}
+	rec.setClusters(init->getClusters().clusterCount());
+	rec.add("buildGrad", gradTime);
+	rec.add("initialize", initTime);
+
+	RSlic::Pixel::distanceColor f;
+	RSlic::Pixel::Slic2P slic;
+	// every repetition starts with the initialized clusters, so all of them do the same work
+	Timing iterTime = measure(reps, [&]() {
+		slic = init;
+		for (int i = 0; i < settings.iterations; i++)
+			slic = slic->iterate<RSlic::Pixel::distanceColor>(f);
+	});
+	iterTime.min /= settings.iterations;
+	iterTime.median /= settings.iterations;
+	iterTime.mean /= settings.iterations;
+	rec.add("iterate", iterTime);
+	rec.add("iterateZero", measure(reps, [&]() { slic->iterateZero<RSlic::Pixel::distanceColor>(f); }));
+	// the same picture as 16 bit (distanceT), one iteration from the initialized clusters
+	Mat img16;
+	img.convertTo(img16, CV_16UC3, 257);
+	RSlic::Pixel::distanceT<cv::Vec3w> f16(RSlic::Pixel::colorRange(img16));
+	auto init16 = RSlic::Pixel::Slic2::initialize(img16, grad, step, settings.stiffness, pool);
+	rec.add("iterate16", measure(reps, [&]() { init16->iterate<RSlic::Pixel::distanceT<cv::Vec3w>>(f16); }));
+	rec.add("computeFeatures", measure(reps, [&]() { RSlic::Pixel::computeFeatures(img, slic->getClusters(), pool); }));
+	// warm start from the iterated clusters, as for the next frame of a video
+	rec.add("nextFrame", measure(reps, [&]() { RSlic::Pixel::nextFrame(img, *slic); }));
+	RSlic::Pixel::Slic2P fin;
+	rec.add("finalize", measure(reps, [&]() { fin = slic->finalize<RSlic::Pixel::distanceColor>(f); }));
+	const RSlic::Pixel::ClusterSet &clusters = fin->getClusters();
+	// A new RSlic::Pixel::ClusterSet, so the centers and the adjacency graph have to be computed again
+	rec.add("refindCenters", measure(reps, [&]() { RSlic::Pixel::ClusterSet(clusters.getClusterLabel(), clusters.clusterCount()).getCenters(); }));
+	rec.add("adjacencyGraph", measure(reps, [&]() { RSlic::Pixel::ClusterSet(clusters.getClusterLabel(), clusters.clusterCount()).adjacencyGraph(); }));
+	rec.add("adjacentMatrix", measure(reps, [&]() { RSlic::Pixel::ClusterSet(clusters.getClusterLabel(), clusters.clusterCount()).adjacentMatrix(); }));
+	rec.add("computeStats", measure(reps, [&]() { RSlic::Pixel::computeStats(img, clusters, pool, true); }));
+	rec.add("pixelIndex", measure(reps, [&]() { RSlic::Pixel::ClusterSet(clusters.getClusterLabel(), clusters.clusterCount()).pixelIndex(); }));
+	rec.add("maskOfCluster", measure(reps, [&]() { clusters.maskOfCluster(0); }));
+	rec.add("croppedMasks", measure(reps, [&]() {
+		Rect box;
+		for (int k = 0; k < clusters.clusterCount(); k++) clusters.maskOfCluster(k, box);
+	}));
+	rec.add("drawCluster", measure(reps, [&]() { RSlic::Pixel::drawCluster(img, clusters); }));
+	rec.add("contourCluster", measure(reps, [&]() { RSlic::Pixel::contourCluster(img, clusters, Vec3b(0, 0, 0)); }));
+}
+
+void benchVoxel(const BenchSize &size, const RSlic::Voxel::MovieCacheP &movie, int count, const BenchSetting &settings, ThreadPoolP pool, Recorder &rec) {
+	const int reps = settings.repetitions;
+	int step = pow(size.w * size.h * size.d * 1.0 / count, 1.0 / 3);
+	RSlic::Voxel::Slic3P init;
+	Timing initGradFunc = measure(reps, [&]() {
+		RSlic::Voxel::Slic3::initialize(movie, RSlic::Voxel::buildGradColor, step, settings.stiffness, pool);
+	});
+	Timing initTime = measure(reps, [&]() { init = RSlic::Voxel::Slic3::initialize(movie, step, settings.stiffness, pool); });
+	if (init.get() == nullptr) {
+		cerr << "voxel " << size.name << ": initializing failed with " << count << " supervoxel" << endl;
+		return;
+	}
+	rec.setClusters(init->getClusters().clusterCount());
+	rec.add("initialize", initTime);
+	rec.add("initialize (GradFunc)", initGradFunc);
+
+	RSlic::Voxel::distanceColor f;
+	RSlic::Voxel::Slic3P slic;
+	Timing iterTime = measure(reps, [&]() {
+		slic = init;
+		for (int i = 0; i < settings.iterations; i++)
+			slic = slic->iterate<RSlic::Voxel::distanceColor>(f);
+	});
+	iterTime.min /= settings.iterations;
+	iterTime.median /= settings.iterations;
+	iterTime.mean /= settings.iterations;
+	rec.add("iterate", iterTime);
+	rec.add("iterateZero", measure(reps, [&]() { slic->iterateZero<RSlic::Voxel::distanceColor>(f); }));
+	RSlic::Voxel::Slic3P fin;
+	rec.add("finalize", measure(reps, [&]() { fin = slic->finalize<RSlic::Voxel::distanceColor>(f); }));
+	const RSlic::Voxel::ClusterSet3 &clusters = fin->getClusters();
+	rec.add("refindCenters", measure(reps, [&]() { RSlic::Voxel::ClusterSet3(clusters.getClusterLabel(), clusters.clusterCount()).getCenters(); }));
+	rec.add("adjacencyGraph", measure(reps, [&]() { RSlic::Voxel::ClusterSet3(clusters.getClusterLabel(), clusters.clusterCount()).adjacencyGraph(); }));
+	rec.add("adjacentMatrix", measure(reps, [&]() { RSlic::Voxel::ClusterSet3(clusters.getClusterLabel(), clusters.clusterCount()).adjacentMatrix(); }));
+	rec.add("computeStats", measure(reps, [&]() { RSlic::Voxel::computeStats(movie, clusters, pool, true); }));
+	rec.add("voxelIndex", measure(reps, [&]() { RSlic::Voxel::ClusterSet3(clusters.getClusterLabel(), clusters.clusterCount()).voxelIndex(); }));
+	rec.add("maskOfCluster", measure(reps, [&]() { clusters.maskOfCluster(0); }));
+	rec.add("croppedMasks", measure(reps, [&]() {
+		Vec3i origin;
+		for (int k = 0; k < clusters.clusterCount(); k++) clusters.maskOfCluster(k, origin);
+	}));
+}
+
+void writeJson(ostream &out, const BenchSetting &settings, const vector<BenchResult> &results) {
+	out << "{" << endl;
+	out << "  \"meta\": {" << endl;
+	out << "    \"distanceType\": \"" << (sizeof(RSlic::priv::DistanceType) == sizeof(float) ? "float" : "double") << "\"," << endl;
+	out << "    \"labelBits\": " << sizeof(RSlic::Pixel::ClusterInt) * 8 << "," << endl;
+	out << "    \"distanceKernel\": \"" << RSlic::priv::simd::instructionSet() << "\"," << endl;
+	out << "    \"hardwareThreads\": " << std::thread::hardware_concurrency() << "," << endl;
+	out << "    \"stiffness\": " << settings.stiffness << "," << endl;
+	out << "    \"iterations\": " << settings.iterations << "," << endl;
+	out << "    \"repetitions\": " << settings.repetitions << "," << endl;
+	out << "    \"seed\": " << seed << endl;
+	out << "  }," << endl;
+	out << "  \"results\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult &r = results[i];
+		out << (i == 0 ? "" : ",") << endl;
+		out << "    {\"group\": \"" << r.group << "\", \"size\": \"" << r.size.name << "\", \"width\": " << r.size.w
+			<< ", \"height\": " << r.size.h << ", \"depth\": " << r.size.d << ", \"threads\": " << r.threads
+			<< ", \"count\": " << r.count << ", \"clusters\": " << r.clusters << ", \"kernel\": \"" << r.kernel
+			<< "\", \"min_ms\": " << r.time.min << ", \"median_ms\": " << r.time.median << ", \"mean_ms\": " << r.time.mean << "}";
+	}
+	out << endl << "  ]" << endl << "}" << endl;
+}
+
+vector<int> parseNumbers(const char *arg) {
+	vector<int> res;
+	char *end;
+	while (*arg != '\0') {
+		long v = strtol(arg, &end, 10);
+		if (end == arg) break;
+		if (v > 0) res.push_back(static_cast<int>(v));
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return res;
+}
+
+vector<string> parseNames(const char *arg) {
+	vector<string> res;
+	string s(arg);
+	size_t start = 0;
+	while (start <= s.size()) {
+		size_t comma = s.find(',', start);
+		if (comma == string::npos) comma = s.size();
+		if (comma > start) res.push_back(s.substr(start, comma - start));
+		start = comma + 1;
+	}
+	return res;
+}
+
+template<size_t N>
+const BenchSize *findSize(const BenchSize (&table)[N], const string &name) {
+	for (const BenchSize &size: table) {
+		if (name == size.name) return &size;
+	}
+	cerr << "Unknown size " << name << endl;
+	return nullptr;
+}
+
+void printHelp(const char *name) {
+	BenchSetting tmp;
+	cout << "Usage: " << name << " [options]" << endl;
+	cout << "Lists are comma separated, e.g. -c 1000,10000" << endl;
+	cout << "-c l: Amounts of superpixel/supervoxel (default 1000,10000)" << endl;
+	cout << "-t l: Thread counts (default: 1 and the number of cores)" << endl;
+	cout << "-p l: Picture sizes out of VGA, HD, 4K, 8K (default VGA,HD,4K, none: only voxel)" << endl;
+	cout << "-v l: Movie sizes out of S (320x180x30), M (640x360x60), L (1280x720x60) (default S,M, none: only pixel)" << endl;
+	cout << "-m a: Set the stiffness to a (default " << tmp.stiffness << ")" << endl;
+	cout << "-i a: Set iteration count to a (default " << tmp.iterations << ")" << endl;
+	cout << "-r a: Repeat every measurement a times (default " << tmp.repetitions << ")" << endl;
+	cout << "-j f: Write the results as JSON to the file f (- = stdout, the log goes to stderr then)" << endl;
+	cout << "-h: Show this help" << endl;
+}
+
+int main(int argc, char **argv) {
+	BenchSetting settings;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			printHelp(argv[0]);
+			return 0;
+		}
+		if (i + 1 >= argc) break;
+		if (strcmp(argv[i], "-c") == 0) settings.counts = parseNumbers(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0) settings.threads = parseNumbers(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0) settings.pixelSizes = parseNames(argv[++i]);
+		else if (strcmp(argv[i], "-v") == 0) settings.voxelSizes = parseNames(argv[++i]);
+		else if (strcmp(argv[i], "-m") == 0) settings.stiffness = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-i") == 0) settings.iterations = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-r") == 0) settings.repetitions = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-j") == 0) settings.json = argv[++i];
+	}
+	if (settings.threads.empty()) {
+		settings.threads.push_back(1);
+		int cores = std::thread::hardware_concurrency();
+		if (cores > 1) settings.threads.push_back(cores);
+	}
+	ostream &log = settings.json == "-" ? cerr : cout;
+
+	log << "Distance type: " << (sizeof(RSlic::priv::DistanceType) == sizeof(float) ? "float" : "double")
+		<< ", label type: int" << sizeof(RSlic::Pixel::ClusterInt) * 8 << "_t, distance kernel: " << RSlic::priv::simd::instructionSet() << endl;
+	vector<BenchResult> results;
+	for (const string &name: settings.pixelSizes) {
+		if (name == "none") continue;
+		const BenchSize *size = findSize(pixelSizes, name);
+		if (size == nullptr) return 1;
+		Mat img = syntheticImage(size->w, size->h);
+		for (int threads: settings.threads) {
+			ThreadPoolP pool = std::make_shared<ThreadPool>(threads);
+			for (int count: settings.counts) {
+				Recorder rec(results, log, "pixel", *size, threads, count);
+				benchPixel(*size, img, count, settings, pool, rec);
+			}
+		}
+	}
+	for (const string &name: settings.voxelSizes) {
+		if (name == "none") continue;
+		const BenchSize *size = findSize(voxelSizes, name);
+		if (size == nullptr) return 1;
+		RSlic::Voxel::MovieCacheP movie = syntheticMovie(size->w, size->h, size->d);
+		for (int threads: settings.threads) {
+			ThreadPoolP pool = std::make_shared<ThreadPool>(threads);
+			for (int count: settings.counts) {
+				Recorder rec(results, log, "voxel", *size, threads, count);
+				benchVoxel(*size, movie, count, settings, pool, rec);
+			}
+		}
+	}
+
+	if (settings.json == "-") {
+		writeJson(cout, settings, results);
+	} else if (!settings.json.empty()) {
+		std::ofstream file(settings.json);
+		if (!file) {
+			cerr << "Could not write " << settings.json << endl;
+			return 1;
+		}
+		writeJson(file, settings, results);
+	}
+	return 0;
+}
@@ -1,11 +1,12 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <iostream>
 #include <RSlic2H.h>
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 
 using namespace RSlic;
 
-inline void showImg(const ClusterSet &cl, const cv::Mat &img, const string &name, bool white) {
+template<typename Label>
+inline void showImg(const ClusterSetT<Label> &cl, const cv::Mat &img, const string &name, bool white) {
 	int gray = white ? 255 : 0;
 	Vec3b color = white ? Vec3b(255, 255, 255) : Vec3b(0, 0, 0);
 	switch (img.type()) {
@@ -21,7 +22,8 @@ inline void showImg(const ClusterSet &cl, const cv::Mat &img, const string &name
 	}
 }
 
-inline void showClusters(const ClusterSet &cl, const cv::Mat &img, const std::string &name) {
+template<typename Label>
+inline void showClusters(const ClusterSetT<Label> &cl, const cv::Mat &img, const std::string &name) {
 	//cv::Mat res;
 	showImg(cl, img, name, false);
 	char key = -1;
@@ -43,17 +45,19 @@ bool file_exist(const char *filename) {
 }
 
 struct MainSetting {
-	MainSetting() : count(400), stiffness(40), iterations(10), slico(false), threadcount(-1) {
+	MainSetting() : count(400), stiffness(40), iterations(10), threshold(0), slico(false), check(false), threadcount(-1) {
 	}
 
 	string filename;
 	int count;
 	int stiffness;
 	int iterations;
+	double threshold;
 	bool slico;
+	bool check;
 	int threadcount;
 
-	int guessthreadcount() {
+	int guessthreadcount() const {
 		if (threadcount <= 0)
 			return std::thread::hardware_concurrency();
 		return threadcount;
@@ -61,10 +65,12 @@ struct MainSetting {
 
 	void print() {
 		std::cout << "[] Iterations " << iterations << endl;
+		std::cout << "[] Threshold " << threshold << endl;
 		std::cout << "[] Count " << count << endl;
 		std::cout << "[] stiffness " << stiffness << endl;
 		std::cout << "[] filename " << filename << endl;
 		std::cout << "[] slico " << slico << endl;
+		std::cout << "[] check " << check << endl;
 		std::cout << "[] threadcount " << threadcount << endl;
 	}
 };
@@ -72,11 +78,13 @@ struct MainSetting {
 void printHelp(char *name) {
 	MainSetting *tmp = new MainSetting;
 	cout << "Create Superpixel from an image" << endl;
-	cout << name << " [-c ...] [-m ...] [-i ...] [-o] [-h] [-t ...] filename " << endl;
+	cout << name << " [-c ...] [-m ...] [-i ...] [-e ...] [-o] [-d] [-h] [-t ...] filename " << endl;
 	cout << "-c a: Set the number of superpixel to a (a is a number, default " << tmp->count << ")" << endl;
 	cout << "-m a: Set stiffness to a (a is a number, default " << tmp->stiffness << ")" << endl;
 	cout << "-i a: Set iteration count to a (a is a number, default " << tmp->iterations << ")" << endl;
+	cout << "-e a: Stop iterating if at most the fraction a of the pixel changes its cluster (default " << tmp->threshold << ", stops only if nothing changes)" << endl;
 	cout << "-0: Use Slico (zero-parameter variant of Slic, default " << tmp->slico << ", -m will be ignored)" << endl;
+	cout << "-d: Check that float and double copies of the image get the same superpixel and mean colors with 1 and with -t threads (plain and active iterations), no window" << endl;
 	cout << "-t a: Set the number of thread to be used to a (a is a number, default " << tmp->threadcount << ")" << endl;
 	cout << "-h: Print this help" << endl;
 	cout << "filename: Set the filename of the image to convert (filename is the path)" << endl;
@@ -100,8 +108,16 @@ MainSetting *parseSetting(int argc, char **argv) {
 		} else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
 			res->iterations = atoi(argv[i + 1]);
 			i++;
+		} else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			res->threshold = atof(argv[i + 1]);
+			i++;
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			res->threadcount = atoi(argv[i + 1]);
+			i++;
 		} else if (strcmp(argv[i], "-0") == 0) {
 			res->slico = true;
+		} else if (strcmp(argv[i], "-d") == 0) {
+			res->check = true;
 		} else if (strcmp(argv[i], "-h") == 0) {
 			delete res;
 			printHelp(argv[0]);
@@ -122,6 +138,130 @@ MainSetting *parseSetting(int argc, char **argv) {
 	return res;
 }
 
+// Iterates and shows the result. Label is selected by withClusterInt.
+template<typename Label>
+struct Run {
+	int operator()(const MainSetting *settings, const Mat &img, const Mat &grad) {
+		auto s = sqrt(img.cols * img.rows / settings->count);
+
+		Slic2TP<Label> slic;
+		ThreadPoolP pool = std::make_shared<ThreadPool>(settings->guessthreadcount());
+		Mat img_lab;
+
+		switch (img.type()) {
+			case CV_8UC3:
+				cvtColor(img, img_lab, cv::COLOR_BGR2Lab); // See paper
+				slic = Slic2T<Label>::initialize(img_lab, grad,  s, settings->stiffness, pool);
+				break;
+			case CV_8UC1:
+				slic = Slic2T<Label>::initialize(img, grad,  s, settings->stiffness, pool);
+				break;
+			default:
+				cout << "This image type is not currently supported " << endl;
+				return -1;
+		}
+		if (slic.get() == nullptr) {
+			cout << "[Error] Initializing failed" << endl;
+			return -1;
+		}
+		cv::imshow("orig", img);
+
+#ifdef DEBUG_ME
+		showClusters(slic->getClusters(), img, "res");
+#endif
+		// Iteration
+		std::cout << "* Process: 0 from " << settings->iterations << std::flush;
+		for (int i = 0; i < settings->iterations; i++) {
+			std::cout << '\r' << "* Process: " << i + 1 << " from " << settings->iterations << std::flush;
+			slic = RSlic::Pixel::iteratingHelper(slic,img.type(),settings->slico);
+#ifdef DEBUG_ME
+			showClusters(slic->getClusters(), img, std::string("res_")+std::to_string(i));
+#endif
+			if (slic->getResidual().changed <= settings->threshold) {
+				std::cout << std::endl << "* Converged after " << i + 1 << " iterations" << std::flush;
+				break;
+			}
+		}
+
+		std::cout << std::endl << "* Finalize Clusters..." << std::flush;
+		if (img.type() == CV_8UC1){
+			distanceGray g;
+			slic = slic->template finalize<distanceGray>(g);
+		}else{
+			distanceColor c;
+			slic = slic->template finalize<distanceColor>(c);
+		}
+		std::cout << " Finish" << std::endl << "* Drawing Clusters..." << std::flush;
+		std::cout << " Finish" << std::endl << "Press q to quit" << std::endl << std::flush;
+		showClusters(slic->getClusters(), img, "result");
+		return 0;
+	}
+};
+
+template<typename Label>
+struct CheckRun {
+	Slic2TP<Label> slic;
+	const MainSetting *settings;
+	bool active;
+
+	template<typename F>
+	Slic2TP<Label> operator()(F f) const {
+		if (active) return RSlic::Pixel::iterateUntil(slic, f, 0, settings->iterations, settings->slico);
+		Slic2TP<Label> res = slic;
+		for (int i = 0; i < settings->iterations; i++)
+			res = settings->slico ? res->template iterateZero<F>(f) : res->template iterate<F>(f);
+		return res;
+	}
+};
+
+// Segments float and double copies of the picture with 1 and with n threads, with iterate and with iterateUntil (active).
+// Their sums are not exact, but they must not depend on the threads or the active set,
+// so all labels and the mean colors (bit for bit) have to be the same.
+template<typename Label>
+struct ThreadCheck {
+	int operator()(const MainSetting *settings, const Mat &img) {
+		auto s = sqrt(img.cols * img.rows / settings->count);
+		const int threads = std::max(2, settings->guessthreadcount());
+		int res = 0;
+		for (int depth : {CV_32F, CV_64F}) {
+			Mat img_f;
+			img.convertTo(img_f, CV_MAKETYPE(depth, img.channels()), 1.0 / 255);
+			const Mat grad = buildGrad(img_f);
+			Mat_<Label> reference;
+			vector<vector<double>> referenceMean;
+			for (int t : {1, threads}) {
+				for (bool active : {false, true}) {
+					ThreadPoolP pool = std::make_shared<ThreadPool>(t);
+					Slic2TP<Label> slic = Slic2T<Label>::initialize(img_f, grad, s, settings->stiffness, pool);
+					if (slic.get() != nullptr) slic = withMetric(img_f, CheckRun<Label>{slic, settings, active});
+					if (slic.get() == nullptr) {
+						cout << "[Error] Segmenting " << getType(img_f) << " failed" << endl;
+						return -1;
+					}
+					const Mat_<Label> label = slic->getClusters().getClusterLabel();
+					const vector<vector<double>> mean = computeFeatures(img_f, slic->getClusters(), pool).mean;
+					int differ = 0, meanDiffer = 0;
+					for (int y = 0; y < label.rows && !reference.empty(); y++) {
+						for (int x = 0; x < label.cols; x++) differ += label(y, x) != reference(y, x);
+					}
+					for (size_t k = 0; !referenceMean.empty() && k < mean[0].size(); k++) {
+						bool same = k < referenceMean[0].size();
+						for (size_t c = 0; c < mean.size() && same; c++) same = mean[c][k] == referenceMean[c][k];
+						meanDiffer += !same;
+					}
+					cout << "* " << getType(img_f) << ", " << t << " thread(s), " << (active ? "active" : "plain") << ": "
+							<< differ << " pixel and " << meanDiffer << " mean colors differ" << endl;
+					if (reference.empty()) {
+						reference = label;
+						referenceMean = mean;
+					} else if (differ != 0 || meanDiffer != 0) res = 1;
+				}
+			}
+		}
+		return res;
+	}
+};
+
 int main(int argc, char **argv) {
     MainSetting *settings = parseSetting(argc, argv);
 	if (settings == nullptr) return -1;
@@ -138,49 +278,7 @@ int main(int argc, char **argv) {
 
 	cout << "Image Type: " << getType(img) << ", Gradient: " << getType(grad) << endl;
 	
-	auto s = sqrt(img.cols * img.rows / settings->count);
-	
-	Slic2P slic;
-	ThreadPoolP pool = std::make_shared<ThreadPool>(settings->guessthreadcount());
-	Mat img_lab;
-
-	switch (img.type()) {
-		case CV_8UC3:
-			cvtColor(img, img_lab, cv::COLOR_BGR2Lab); // See paper
-			slic = Slic2::initialize(img_lab, grad,  s, settings->stiffness, pool);
-			break;
-		case CV_8UC1:
-			slic = Slic2::initialize(img, grad,  s, settings->stiffness, pool);
-			break;
-		default:
-			cout << "This image type is not currently supported " << endl;
-			return -1;
-	}
-	cv::imshow("orig", img);
-
-#ifdef DEBUG_ME
-	showClusters(slic->getClusters(), img, "res");
-#endif
-	// Iteration
-	std::cout << "* Process: 0 from " << settings->iterations << std::flush;
-	for (int i = 0; i < settings->iterations; i++) {
-		std::cout << '\r' << "* Process: " << i + 1 << " from " << settings->iterations << std::flush;
-		slic = RSlic::Pixel::iteratingHelper(slic,img.type(),settings->slico);
-#ifdef DEBUG_ME
-		showClusters(slic->getClusters(), img, std::string("res_")+std::to_string(i));
-#endif
-	}
-
-	std::cout << std::endl << "* Finalize Clusters..." << std::flush;
-	if (img.type() == CV_8UC1){
-		distanceGray g;
-		slic = slic->finalize<distanceGray>(g); 
-	}else{
-		distanceColor c;
-		slic = slic->finalize<distanceColor>(c);
-	}
-	std::cout << " Finish" << std::endl << "* Drawing Clusters..." << std::flush;
-	std::cout << " Finish" << std::endl << "Press q to quit" << std::endl << std::flush;
+	int res = settings->check ? withClusterInt<ThreadCheck>(settings->count, settings, img) : withClusterInt<Run>(settings->count, settings, img, grad);
 	delete settings;
-	showClusters(slic->getClusters(), img, "result");
+	return res;
 }
@@ -64,6 +64,10 @@ void WorkerObject::work(cv::Mat m, SlicSetting *settings, QWidget* tabwdg) {
 			iterators.push_back(slic);
 		emit message(tr("Iterating %1 of %2").arg(i + 1).arg(settings->iteration));
 		emit progress((i + 1) * 100 / (settings->iteration + 1));
+		if (slic->getResidual().changed == 0) { // further iterations won't change anything
+			emit message(tr("Converged after %1 iterations").arg(i + 1));
+			break;
+		}
 	}
 	emit message(tr("Finalizing ..."));
 	slic = slic->finalize(RSlic::Pixel::distanceColor());
@@ -96,7 +100,7 @@ MainWindow::MainWindow(QWidget *parent) :
 		connect(tabs, SIGNAL(tabCloseRequested(int)),SLOT(closeTab(int)));
 		setCentralWidget(tabs);
 
-		worker = new WorkerObject(std::make_shared<ThreadPool>(std::thread::hardware_concurrency()));
+		worker = new WorkerObject(ThreadPool::defaultPool());
 		worker->moveToThread(&workerThread);
 		workerThread.start();
 
@@ -5,7 +5,7 @@
 #include <QLabel>
 #include <QSpinBox>
 #include <QGroupBox>
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 #include <opencv2/core/core.hpp>
 #include <QPixmap>
 #include <QImage>
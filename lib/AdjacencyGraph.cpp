@@ -0,0 +1,26 @@
+#include "AdjacencyGraph.h"
+
+#include <algorithm>
+
+using namespace RSlic;
+
+bool AdjacencyGraph::adjacent(int a, int b) const {
+	if (a == b) return true;
+	return std::binary_search(begin(a), end(a), b);
+}
+
+long AdjacencyGraph::boundaryLength(int a, int b) const {
+	const int32_t *pos = std::lower_bound(begin(a), end(a), b);
+	if (pos == end(a) || *pos != b) return 0;
+	return boundary[pos - neighbours.data()];
+}
+
+cv::Mat AdjacencyGraph::denseMatrix() const {
+	const int n = clusterCount();
+	cv::Mat res = cv::Mat::eye(n, n, CV_8UC1);
+	for (int k = 0; k < n; k++) {
+		uint8_t *row = res.ptr<uint8_t>(k);
+		for (const int32_t *it = begin(k); it != end(k); ++it) row[*it] = 1;
+	}
+	return res;
+}
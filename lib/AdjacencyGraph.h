@@ -0,0 +1,80 @@
+#ifndef ADJACENCYGRAPH_H
+#define ADJACENCYGRAPH_H
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace RSlic {
+
+ /**
+ * Region adjacency graph of the clusters (sparse, compressed rows).
+ * The neighbours of cluster k are neighbours[offsets[k]] to neighbours[offsets[k + 1] - 1] (ascending, without k itself),
+ * boundary[i] is the length of the boundary shared with neighbours[i]: how many pairs of pixels (voxels) of the two clusters
+ * are next to each other along x, y (or t). Clusters that only touch diagonally are neighbours with length 0.
+ * Every edge is stored for both clusters.
+ */
+ struct AdjacencyGraph {
+	 std::vector<int> offsets; // clusterCount() + 1 entries
+	 std::vector<int32_t> neighbours;
+	 std::vector<long> boundary;
+
+	 /**
+	 * Returns the amount of clusters
+	 */
+	 int clusterCount() const {
+		 return offsets.empty() ? 0 : static_cast<int>(offsets.size()) - 1;
+	 }
+
+	 /**
+	 * Returns the amount of edges (every one counted once)
+	 */
+	 long edgeCount() const {
+		 return static_cast<long>(neighbours.size()) / 2;
+	 }
+
+	 /**
+	 * Returns how many neighbours cluster k has
+	 */
+	 int degree(int k) const {
+		 return offsets[k + 1] - offsets[k];
+	 }
+
+	 /**
+	 * Returns the first neighbour of cluster k (use with end(k))
+	 */
+	 const int32_t *begin(int k) const {
+		 return neighbours.data() + offsets[k];
+	 }
+
+	 /**
+	 * Returns the position after the last neighbour of cluster k
+	 */
+	 const int32_t *end(int k) const {
+		 return neighbours.data() + offsets[k + 1];
+	 }
+
+	 /**
+	 * Checks if two clusters are neighbours (binary search)
+	 * @param a one cluster
+	 * @param b the other cluster
+	 * @return true if they are neighbours or a == b
+	 */
+	 bool adjacent(int a, int b) const;
+
+	 /**
+	 * Returns the length of the boundary the two clusters share
+	 * @return the length (0 if they are no neighbours)
+	 */
+	 long boundaryLength(int a, int b) const;
+
+	 /**
+	 * Returns the graph as dense adjacent matrix m (type CV_8UC1, clusterCount() * clusterCount() bytes).
+	 * m[a,b] == 1 if a and b are neighbours, it is always m[a,a] == 1.
+	 * @return adjacent matrix
+	 */
+	 cv::Mat denseMatrix() const;
+ };
+}
+
+#endif // ADJACENCYGRAPH_H
@@ -0,0 +1,54 @@
+#ifndef CLUSTERINDEX_H
+#define CLUSTERINDEX_H
+
+#include <cstdint>
+#include <vector>
+
+namespace RSlic {
+
+ /**
+ * The elements (pixels or voxels) of every cluster (compressed rows, built with a counting sort).
+ * The elements of cluster k are elements[offsets[k]] to elements[offsets[k + 1] - 1], ascending in the storage order
+ * of the label Mat: y * width + x for pixels, (y * width + x) * duration + t for voxels.
+ * Elements without a cluster (label -1) are not in the index.
+ * @tparam Index type of an element (int32_t for pixels, int64_t for voxels)
+ */
+ template<typename Index>
+ struct ClusterIndexT {
+	 std::vector<long> offsets; // clusterCount() + 1 entries
+	 std::vector<Index> elements;
+
+	 /**
+	 * Returns the amount of clusters
+	 */
+	 int clusterCount() const {
+		 return offsets.empty() ? 0 : static_cast<int>(offsets.size()) - 1;
+	 }
+
+	 /**
+	 * Returns how many elements cluster k has
+	 */
+	 long size(int k) const {
+		 return offsets[k + 1] - offsets[k];
+	 }
+
+	 /**
+	 * Returns the first element of cluster k (use with end(k))
+	 */
+	 const Index *begin(int k) const {
+		 return elements.data() + offsets[k];
+	 }
+
+	 /**
+	 * Returns the position after the last element of cluster k
+	 */
+	 const Index *end(int k) const {
+		 return elements.data() + offsets[k + 1];
+	 }
+ };
+
+ using PixelIndex = ClusterIndexT<int32_t>;
+ using VoxelIndex = ClusterIndexT<int64_t>;
+}
+
+#endif // CLUSTERINDEX_H
@@ -0,0 +1,45 @@
+#include "ClusterStats.h"
+
+using namespace RSlic;
+
+namespace {
+ const char *const axisNames[] = {"x", "y", "t"};
+}
+
+std::vector<std::string> ClusterStats::featureNames() const {
+	std::vector<std::string> res;
+	res.push_back("area");
+	for (int a = 0; a < dims; a++) res.push_back(std::string("centroid_") + axisNames[a]);
+	for (int a = 0; a < dims; a++) {
+		res.push_back(std::string("min_") + axisNames[a]);
+		res.push_back(std::string("max_") + axisNames[a]);
+	}
+	for (int c = 0; c < channels; c++) res.push_back("mean_" + std::to_string(c));
+	for (int c = 0; c < channels; c++) res.push_back("variance_" + std::to_string(c));
+	if (!covariance.empty()) {
+		for (int a = 0; a < channels; a++) {
+			for (int b = a + 1; b < channels; b++) res.push_back("covariance_" + std::to_string(a) + "_" + std::to_string(b));
+		}
+	}
+	return res;
+}
+
+cv::Mat ClusterStats::featureMatrix() const {
+	const int n = size();
+	const int cols = static_cast<int>(featureNames().size());
+	cv::Mat res(n, cols, CV_64FC1);
+	for (int k = 0; k < n; k++) {
+		double *row = res.ptr<double>(k);
+		int i = 0;
+		row[i++] = area[k];
+		for (int a = 0; a < dims; a++) row[i++] = centroid[a][k];
+		for (int a = 0; a < dims; a++) {
+			row[i++] = minPos[a][k];
+			row[i++] = maxPos[a][k];
+		}
+		for (int c = 0; c < channels; c++) row[i++] = mean[c][k];
+		for (int c = 0; c < channels; c++) row[i++] = variance[c][k];
+		for (size_t p = 0; p < covariance.size(); p++) row[i++] = covariance[p][k];
+	}
+	return res;
+}
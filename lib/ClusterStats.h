@@ -0,0 +1,91 @@
+#ifndef CLUSTERSTATS_H
+#define CLUSTERSTATS_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace RSlic {
+
+ /**
+ * Statistics of every cluster (structure of arrays, index = cluster number), see Pixel::computeStats and Voxel::computeStats.
+ * The axes are 0 = x, 1 = y (and 2 = t for supervoxels).
+ * A cluster without any pixel has the area 0, an empty bounding box (min > max) and 0 for everything else.
+ */
+ struct ClusterStats {
+	 /**
+	 * Number of axes (2 for superpixels, 3 for supervoxels)
+	 */
+	 int dims = 0;
+
+	 /**
+	 * Number of channels of the image (0 if only the geometry was computed)
+	 */
+	 int channels = 0;
+
+	 /**
+	 * Amount of pixels (voxels) of cluster k
+	 */
+	 std::vector<long> area;
+
+	 /**
+	 * minPos[a][k] and maxPos[a][k] are the bounding box of cluster k along axis a (inclusive)
+	 */
+	 std::vector<std::vector<int>> minPos, maxPos;
+
+	 /**
+	 * centroid[a][k] is the mean position of cluster k along axis a
+	 */
+	 std::vector<std::vector<double>> centroid;
+
+	 /**
+	 * mean[c][k] and variance[c][k] of channel c in cluster k
+	 */
+	 std::vector<std::vector<double>> mean, variance;
+
+	 /**
+	 * covariance[pairIndex(a, b, channels)][k] of the channels a and b in cluster k (empty if it was not requested)
+	 */
+	 std::vector<std::vector<double>> covariance;
+
+	 /**
+	 * Returns the amount of clusters
+	 */
+	 int size() const {
+		 return static_cast<int>(area.size());
+	 }
+
+	 /**
+	 * Returns the bounding box of cluster k in the picture (x and y)
+	 */
+	 cv::Rect boundingBox(int k) const {
+		 return cv::Rect(minPos[0][k], minPos[1][k], maxPos[0][k] - minPos[0][k] + 1, maxPos[1][k] - minPos[1][k] + 1);
+	 }
+
+	 /**
+	 * Returns the position of the pair of channels a < b in covariance.
+	 * The pairs are in the order (0, 1), (0, 2), ..., (1, 2), ...
+	 * @param a the first channel
+	 * @param b the second channel (> a)
+	 * @param channels number of channels
+	 * @return the position
+	 */
+	 static int pairIndex(int a, int b, int channels) {
+		 return a * (2 * channels - a - 1) / 2 + (b - a - 1);
+	 }
+
+	 /**
+	 * Returns all statistics as one row per cluster (CV_64FC1), e.g. for a classifier or for exporting.
+	 * The columns are named by featureNames().
+	 * @return clusters x features matrix
+	 */
+	 cv::Mat featureMatrix() const;
+
+	 /**
+	 * Returns the names of the columns of featureMatrix (e.g. "area", "centroid_x", "min_y", "mean_0", "covariance_0_1")
+	 */
+	 std::vector<std::string> featureNames() const;
+ };
+}
+
+#endif // CLUSTERSTATS_H
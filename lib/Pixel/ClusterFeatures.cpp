@@ -0,0 +1,234 @@
+#include "ClusterFeatures.h"
+#include <priv/Parallel_p.h>
+#include <priv/ActiveSet_p.h>
+#include <priv/Stats_p.h>
+
+using namespace RSlic::Pixel;
+
+namespace {
+ //T is the type of a pixel (up to 4 channels) or of one channel (any amount of channels, see PixelType)
+ template<typename T, typename Label>
+ inline void accumulateFeaturesType(const Mat &img, const Mat_<Label> &label, int yBeg, int yEnd, FeatureSums &sums, const vector<Vec2i> *centers, const ClusterFeatures *reference, const RSlic::priv::DirtyCells *dirty) {
+	 using S = typename RSlic::priv::PixelType<T>::channel;
+	 const int channels = RSlic::priv::PixelType<T>::channels > 0 ? RSlic::priv::PixelType<T>::channels : img.channels();
+	 const int w = img.cols;
+	 const bool withVariance = !sums.sqsum.empty();
+	 const bool withMaxColor = centers != nullptr && !sums.maxColor.empty();
+	 // Color of the centers (for Slico without features), read only once
+	 vector<double> centerColor;
+	 if (withMaxColor && reference == nullptr) {
+		 centerColor.assign(centers->size() * channels, 0);
+		 for (size_t k = 0; k < centers->size(); k++) {
+			 const Vec2i &c = (*centers)[k];
+			 bool inside = c[0] >= 0 && c[1] >= 0 && c[0] < img.cols && c[1] < img.rows;
+			 if (!inside) continue;
+			 const S *px = img.ptr<S>(c[1]) + c[0] * channels;
+			 for (int i = 0; i < channels; i++) centerColor[k * channels + i] = px[i];
+		 }
+	 }
+	 for (int y = yBeg; y < yEnd; y++) {
+		 const Label *labelRow = label[y];
+		 const S *imgRow = img.ptr<S>(y);
+		 auto addRun = [&](int xBeg, int xEnd) {
+			 for (int x = xBeg; x < xEnd; x++) {
+				 const Label k = labelRow[x];
+				 if (k < 0) continue;
+				 sums.count[k]++;
+				 sums.x[k] += x;
+				 sums.y[k] += y;
+				 const S *px = imgRow + x * channels;
+				 for (int c = 0; c < channels; c++) {
+					 const double v = px[c];
+					 sums.sum[c][k] += v;
+					 if (withVariance) sums.sqsum[c][k] += v * v;
+				 }
+				 if (withMaxColor) {
+					 // the same as zeroMetrik, against the mean color the metric compared the pixel with (if it uses the features)
+					 double distColor = 0;
+					 if (reference == nullptr) {
+						 for (int c = 0; c < channels; c++) distColor += pow(px[c] - centerColor[k * channels + c], 2);
+					 } else {
+						 for (int c = 0; c < channels; c++) distColor += pow(px[c] - reference->mean[c][k], 2);
+					 }
+					 if (sums.maxColor[k] < distColor) sums.maxColor[k] = distColor;
+				 }
+			 }
+		 };
+		 if (dirty == nullptr) addRun(0, w);
+		 else dirty->forEachRunInRow(y, 0, w, addRun);
+	 }
+ }
+
+ declareCVF_T(accumulateFeaturesType, accumulateFeaturesHelper, return)
+
+ // More than 4 channels: by the depth
+ declareCVF_D(accumulateFeaturesType, accumulateFeaturesChannelsHelper, return)
+
+ template<typename S>
+ inline double centerChannel(const Mat &img, int x, int y, int c) {
+	 bool inside = x >= 0 && y >= 0 && x < img.cols && y < img.rows;
+	 return inside ? img.ptr<S>(y)[x * img.channels() + c] : 0;
+ }
+
+ declareCVF_D(centerChannel, centerChannelHelper, return 0)
+
+ template<typename T, typename Label>
+ inline void accumulateStatsType(const Mat &img, const Mat_<Label> &label, int yBeg, int yEnd, RSlic::priv::StatsSums &sums) {
+	 const int w = label.cols;
+	 double px[4];
+	 int pos[2];
+	 for (int y = yBeg; y < yEnd; y++) {
+		 const Label *labelRow = label[y];
+		 const T *imgRow = img.ptr<T>(y);
+		 pos[1] = y;
+		 for (int x = 0; x < w; x++) {
+			 const Label k = labelRow[x];
+			 if (k < 0) continue;
+			 pos[0] = x;
+			 RSlic::priv::pixelChannels(imgRow[x], px);
+			 sums.add(k, pos, px);
+		 }
+	 }
+ }
+
+ declareCVF_T(accumulateStatsType, accumulateStatsHelper, return)
+
+ //Only the geometry (no picture)
+ template<typename Label>
+ inline void accumulateGeometry(const Mat_<Label> &label, int yBeg, int yEnd, RSlic::priv::StatsSums &sums) {
+	 const int w = label.cols;
+	 int pos[2];
+	 for (int y = yBeg; y < yEnd; y++) {
+		 const Label *labelRow = label[y];
+		 pos[1] = y;
+		 for (int x = 0; x < w; x++) {
+			 if (labelRow[x] < 0) continue;
+			 pos[0] = x;
+			 sums.add(labelRow[x], pos, static_cast<const double *>(nullptr));
+		 }
+	 }
+ }
+}
+
+template<typename Label>
+void RSlic::Pixel::accumulateFeatures(const Mat &img, const Mat_<Label> &label, int yBeg, int yEnd, FeatureSums &sums, const vector<Vec2i> *centers, const ClusterFeatures *reference, const RSlic::priv::DirtyCells *dirty) {
+	if (img.channels() > 4) ::accumulateFeaturesChannelsHelper(img.depth(), img, label, yBeg, yEnd, sums, centers, reference, dirty);
+	else ::accumulateFeaturesHelper(img.type(), img, label, yBeg, yEnd, sums, centers, reference, dirty);
+}
+
+FeatureSums &RSlic::Pixel::FeatureSums::operator+=(const FeatureSums &other) {
+	for (size_t k = 0; k < count.size(); k++) {
+		x[k] += other.x[k];
+		y[k] += other.y[k];
+		count[k] += other.count[k];
+	}
+	for (size_t c = 0; c < sum.size(); c++) {
+		for (size_t k = 0; k < count.size(); k++) sum[c][k] += other.sum[c][k];
+	}
+	for (size_t c = 0; c < sqsum.size() && c < other.sqsum.size(); c++) {
+		for (size_t k = 0; k < count.size(); k++) sqsum[c][k] += other.sqsum[c][k];
+	}
+	return *this;
+}
+
+FeatureSums &RSlic::Pixel::FeatureSums::operator-=(const FeatureSums &other) {
+	for (size_t k = 0; k < count.size(); k++) {
+		x[k] -= other.x[k];
+		y[k] -= other.y[k];
+		count[k] -= other.count[k];
+	}
+	for (size_t c = 0; c < sum.size(); c++) {
+		for (size_t k = 0; k < count.size(); k++) sum[c][k] -= other.sum[c][k];
+	}
+	for (size_t c = 0; c < sqsum.size() && c < other.sqsum.size(); c++) {
+		for (size_t k = 0; k < count.size(); k++) sqsum[c][k] -= other.sqsum[c][k];
+	}
+	return *this;
+}
+
+ClusterFeatures RSlic::Pixel::mergeFeatures(const Mat &img, const vector<FeatureSums> &bands, const vector<Vec2i> *fallback) {
+	ClusterFeatures res;
+	if (bands.empty()) return res;
+	const int n = bands[0].count.size();
+	const int channels = bands[0].sum.size();
+	const bool withVariance = !bands[0].sqsum.empty();
+	res.channels = channels;
+	res.mean.assign(channels, vector<double>(n, 0));
+	if (withVariance) res.variance.assign(channels, vector<double>(n, 0));
+	res.x.assign(n, -1);
+	res.y.assign(n, -1);
+	res.count.assign(n, 0);
+	for (int k = 0; k < n; k++) {
+		uint64_t sx = 0, sy = 0;
+		for (const FeatureSums &band: bands) {
+			res.count[k] += band.count[k];
+			sx += band.x[k];
+			sy += band.y[k];
+		}
+		const int count = res.count[k];
+		if (count == 0) {
+			// No pixel -> keep the old center and use its color
+			if (fallback != nullptr) {
+				res.x[k] = (*fallback)[k][0];
+				res.y[k] = (*fallback)[k][1];
+			}
+			for (int c = 0; c < channels; c++)
+				res.mean[c][k] = ::centerChannelHelper(img.depth(), img, res.x[k], res.y[k], c);
+			continue;
+		}
+		res.x[k] = sx / count;
+		res.y[k] = sy / count;
+		for (int c = 0; c < channels; c++) {
+			double sum = 0, sqsum = 0;
+			for (const FeatureSums &band: bands) {
+				sum += band.sum[c][k];
+				if (withVariance) sqsum += band.sqsum[c][k];
+			}
+			const double mean = sum / count;
+			res.mean[c][k] = mean;
+			if (withVariance) res.variance[c][k] = std::max(0.0, sqsum / count - mean * mean);
+		}
+	}
+	return res;
+}
+
+template<typename Label>
+ClusterFeatures RSlic::Pixel::computeFeatures(const Mat &img, const ClusterSetT<Label> &clusters, std::shared_ptr<ThreadPool> pool, bool withVariance) {
+	const Mat_<Label> label = clusters.getClusterLabel();
+	const int h = img.rows;
+	vector<FeatureSums> bands(RSlic::priv::sumBandCount(pool.get(), h, RSlic::priv::exactDepth(img.depth())), FeatureSums(clusters.clusterCount(), img.channels(), withVariance));
+	RSlic::priv::forEachBand(pool.get(), h, static_cast<int>(bands.size()), [&](int band, int yBeg, int yEnd) {
+		accumulateFeatures(img, label, yBeg, yEnd, bands[band]);
+	});
+	// Only empty clusters (e.g. before the first iteration) need the centers of the ClusterSet
+	bool anyEmpty = false;
+	for (int k = 0; k < clusters.clusterCount() && !anyEmpty; k++) {
+		int count = 0;
+		for (const FeatureSums &band: bands) count += band.count[k];
+		anyEmpty = count == 0;
+	}
+	return mergeFeatures(img, bands, anyEmpty ? &clusters.getCenters() : nullptr);
+}
+
+template<typename Label>
+RSlic::ClusterStats RSlic::Pixel::computeStats(const Mat &img, const ClusterSetT<Label> &clusters, std::shared_ptr<ThreadPool> pool, bool withCovariance) {
+	const Mat_<Label> label = clusters.getClusterLabel();
+	if (!img.empty() && (img.size() != label.size() || img.channels() > 4)) return RSlic::ClusterStats();
+	const int h = label.rows;
+	const int channels = img.empty() ? 0 : img.channels();
+	const bool exact = img.empty() || RSlic::priv::exactDepth(img.depth());
+	vector<RSlic::priv::StatsSums> bands(RSlic::priv::sumBandCount(pool.get(), h, exact), RSlic::priv::StatsSums(clusters.clusterCount(), 2, channels, withCovariance));
+	RSlic::priv::forEachBand(pool.get(), h, static_cast<int>(bands.size()), [&](int band, int yBeg, int yEnd) {
+		if (img.empty()) accumulateGeometry(label, yBeg, yEnd, bands[band]);
+		else ::accumulateStatsHelper(img.type(), img, label, yBeg, yEnd, bands[band]);
+	});
+	for (size_t b = 1; b < bands.size(); b++) bands[0] += bands[b];
+	return bands[0].result();
+}
+
+template void RSlic::Pixel::accumulateFeatures<int16_t>(const Mat &img, const Mat_<int16_t> &label, int yBeg, int yEnd, FeatureSums &sums, const vector<Vec2i> *centers, const ClusterFeatures *reference, const RSlic::priv::DirtyCells *dirty);
+template void RSlic::Pixel::accumulateFeatures<int32_t>(const Mat &img, const Mat_<int32_t> &label, int yBeg, int yEnd, FeatureSums &sums, const vector<Vec2i> *centers, const ClusterFeatures *reference, const RSlic::priv::DirtyCells *dirty);
+template ClusterFeatures RSlic::Pixel::computeFeatures<int16_t>(const Mat &img, const ClusterSetT<int16_t> &clusters, std::shared_ptr<ThreadPool> pool, bool withVariance);
+template ClusterFeatures RSlic::Pixel::computeFeatures<int32_t>(const Mat &img, const ClusterSetT<int32_t> &clusters, std::shared_ptr<ThreadPool> pool, bool withVariance);
+template RSlic::ClusterStats RSlic::Pixel::computeStats<int16_t>(const Mat &img, const ClusterSetT<int16_t> &clusters, std::shared_ptr<ThreadPool> pool, bool withCovariance);
+template RSlic::ClusterStats RSlic::Pixel::computeStats<int32_t>(const Mat &img, const ClusterSetT<int32_t> &clusters, std::shared_ptr<ThreadPool> pool, bool withCovariance);
@@ -0,0 +1,157 @@
+#ifndef CLUSTERFEATURES2_H
+#define CLUSTERFEATURES2_H
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include "ClusterSet.h"
+#include <ClusterStats.h>
+
+class ThreadPool;
+
+namespace RSlic {
+ namespace priv {
+  class DirtyCells;
+ }
+}
+
+namespace RSlic {
+ namespace Pixel {
+
+  /**
+  * Features of every cluster, computed once per iteration (structure of arrays, index = cluster number).
+  * Metrics that take them don't need to read the center pixel for every pixel of the window
+  * and compare against the mean color of the cluster (like the SLIC paper does).
+  */
+  struct ClusterFeatures {
+	  /**
+	  * Number of channels of the image (any amount)
+	  */
+	  int channels = 0;
+
+	  /**
+	  * mean[c][k] is the mean of channel c in cluster k.
+	  * A cluster without any pixel (e.g. before the first iteration) uses the color of its center.
+	  */
+	  vector<vector<double>> mean;
+
+	  /**
+	  * variance[c][k] is the variance of channel c in cluster k.
+	  * Empty if it was not requested.
+	  */
+	  vector<vector<double>> variance;
+
+	  /**
+	  * The central point of cluster k (same as ClusterSet::getCenters)
+	  */
+	  vector<int> x, y;
+
+	  /**
+	  * Returns the central points as used by ClusterSet
+	  */
+	  inline vector<Vec2i> centers() const {
+		  vector<Vec2i> res;
+		  res.reserve(x.size());
+		  for (size_t k = 0; k < x.size(); k++) res.emplace_back(x[k], y[k]);
+		  return res;
+	  }
+
+	  /**
+	  * Amount of pixel in cluster k
+	  */
+	  vector<int> count;
+
+	  /**
+	  * Returns the amount of clusters
+	  */
+	  inline int size() const {
+		  return static_cast<int>(x.size());
+	  }
+  };
+
+  /**
+  * Sums of one band of rows for computing the features (and the new centers) of the clusters.
+  * @see accumulateFeatures
+  * @see mergeFeatures
+  */
+  struct FeatureSums {
+	  FeatureSums(int clusters, int channels, bool withVariance = false, bool withMaxColor = false) :
+			  x(clusters, 0), y(clusters, 0), count(clusters, 0),
+			  sum(channels, vector<double>(clusters, 0)),
+			  sqsum(withVariance ? channels : 0, vector<double>(clusters, 0)),
+			  maxColor(withMaxColor ? clusters : 0, 0) {
+	  }
+
+	  vector<uint64_t> x, y;
+	  vector<int> count;
+	  vector<vector<double>> sum, sqsum;
+	  vector<double> maxColor; // Slico: largest color distance to the center of the cluster (empty if not requested)
+
+	  /**
+	  * Adds the sums of other (not the color maxima).
+	  */
+	  FeatureSums &operator+=(const FeatureSums &other);
+
+	  /**
+	  * Subtracts the sums of other (not the color maxima, they can't be taken back).
+	  * For integer pictures the result is exact, so the sums can be updated instead of recomputed.
+	  * For float pictures it is not (see RSlic::priv::exactDepth), they have to be recomputed.
+	  */
+	  FeatureSums &operator-=(const FeatureSums &other);
+  };
+
+  /**
+  * Adds the pixels of the rows [yBeg, yEnd) to sums (by their label).
+  * @param img the picture
+  * @param label the cluster label of every pixel (-1 = none)
+  * @param yBeg first row
+  * @param yEnd row after the last one
+  * @param sums the sums of this band
+  * @param centers the centers the pixels were assigned to, used for sums.maxColor (may be nullptr)
+  * @param reference the features the pixels were assigned with, if the metric uses them (may be nullptr).
+  * Then sums.maxColor is measured against their mean colors instead of the colors of the center pixels.
+  * @param dirty if not nullptr, only the pixels in its dirty cells are added
+  */
+  template<typename Label>
+  void accumulateFeatures(const Mat &img, const Mat_<Label> &label, int yBeg, int yEnd, FeatureSums &sums, const vector<Vec2i> *centers = nullptr, const ClusterFeatures *reference = nullptr, const RSlic::priv::DirtyCells *dirty = nullptr);
+
+  /**
+  * Merges the sums of all bands (in band order) into the features.
+  * The centers are computed like ClusterSet::getCenters does.
+  * @param img the picture
+  * @param bands the sums of every band
+  * @param fallback centers for clusters without any pixel (may be nullptr if there is none)
+  * @return the features
+  */
+  ClusterFeatures mergeFeatures(const Mat &img, const vector<FeatureSums> &bands, const vector<Vec2i> *fallback);
+
+  /**
+  * Computes the features of all clusters in one pass over the image.
+  * With PARALLEL every band of rows has its own sums, they are merged in band order.
+  * The results are the same for every thread count: integer sums are exact,
+  * float images use a fixed number of bands (RSlic::priv::fixedBandCount).
+  * @param img the picture (any type and amount of channels)
+  * @param clusters the clusters
+  * @param pool threadpool for parallel computing (may be empty)
+  * @param withVariance compute the variance, too
+  * @return the features
+  */
+  template<typename Label>
+  ClusterFeatures computeFeatures(const Mat &img, const ClusterSetT<Label> &clusters, std::shared_ptr<ThreadPool> pool = std::shared_ptr<ThreadPool>(), bool withVariance = false);
+
+  /**
+  * Computes the statistics of all clusters (area, bounding box, centroid, mean and variance of every channel,
+  * optionally the covariance of the channels) in one pass over the picture.
+  * Every band of rows has its own sums, they are merged in band order.
+  * @param img the picture (any depth, but unlike computeFeatures at most 4 channels) or an empty Mat for the geometry only
+  * @param clusters the clusters
+  * @param pool threadpool for parallel computing (may be empty)
+  * @param withCovariance compute the covariance of every pair of channels, too
+  * @return the statistics (empty if img doesn't fit to the clusters or has more than 4 channels)
+  */
+  template<typename Label>
+  RSlic::ClusterStats computeStats(const Mat &img, const ClusterSetT<Label> &clusters, std::shared_ptr<ThreadPool> pool = std::shared_ptr<ThreadPool>(), bool withCovariance = false);
+ }
+}
+#endif // CLUSTERFEATURES2_H
@@ -1,71 +1,83 @@
 #include "ClusterSet.h"
 #include "../priv/Useful.h"
+#include "../priv/Adjacency_p.h"
+#include "../priv/ClusterIndex_p.h"
+#include <ThreadPool.h>
 
 using namespace RSlic::Pixel;
 using RSlic::priv::aSize;
 
-RSlic::Pixel::ClusterSet::ClusterSet(cv::Mat_<ClusterInt> clusters, int clusterCount)
-		: data{clusters, std::vector<Vec2i>(), clusterCount, false} {
+template<typename Label>
+RSlic::Pixel::ClusterSetT<Label>::ClusterSetT(cv::Mat_<Label> clusters, int clusterCount)
+		: data{clusters, std::vector<Vec2i>(), clusterCount, false, false, AdjacencyGraph(), false, PixelIndex()} {
 }
 
-Mat_<ClusterInt> RSlic::Pixel::ClusterSet::getClusterLabel() const {
+template<typename Label>
+Mat_<Label> RSlic::Pixel::ClusterSetT<Label>::getClusterLabel() const {
 	return data.clusterLabel;
 }
 
-const vector<Vec2i> &RSlic::Pixel::ClusterSet::getCenters() const {
+template<typename Label>
+const vector<Vec2i> &RSlic::Pixel::ClusterSetT<Label>::getCenters() const {
 	if (!data.centers_calculated) {
 		refindCenters();
 	}
 	return data.centers;
 }
 
-int RSlic::Pixel::ClusterSet::clusterCount() const noexcept {
+template<typename Label>
+int RSlic::Pixel::ClusterSetT<Label>::clusterCount() const noexcept {
 	return data._clusterCount;
 }
 
-namespace {
- inline void setClusterAdjacent(Mat &m, int p1, int p2) {
-	 m.at<uint8_t>(p1, p2) = 1;
-	 m.at<uint8_t>(p2, p1) = 1;
- }
-}
-
-const cv::Mat RSlic::Pixel::ClusterSet::adjacentMatrix() const {
-	if (!data.adj_calculated) {
+template<typename Label>
+const RSlic::AdjacencyGraph &RSlic::Pixel::ClusterSetT<Label>::adjacencyGraph() const {
+	if (!data.graph_calculated) {
 		refindAdjacent();
 	}
-	return data.adjMatrix;
+	return data.graph;
 }
 
-void RSlic::Pixel::ClusterSet::refindAdjacent() const {
-	std::lock_guard<std::mutex> guard(adjMutex);
-	if (data.adj_calculated) return;
-	int size = clusterCount();
-	Mat res = Mat::eye(size, size, CV_8UC1);
-	auto clusterMat = getClusterLabel();
-	int w = clusterMat.cols;
-	int h = clusterMat.rows;
-	static const int xNeighbour[] = {1, 0, 1};
-	static const int yNeighbour[aSize(xNeighbour)] = {0, 1, 1};
-	for (int x = 0; x < w - 1; x++) {
-		for (int y = 0; y < h - 1; y++) {
-			ClusterInt currentCluster = clusterMat.at<ClusterInt>(y, x);
-			for (int i = 0; i < aSize(xNeighbour); i++) {
-				ClusterInt otherCluster = clusterMat.at<ClusterInt>(y + yNeighbour[i], x + xNeighbour[i]);
-				if (currentCluster != otherCluster) {
-					setClusterAdjacent(res, currentCluster, otherCluster);
-				}
+template<typename Label>
+const cv::Mat RSlic::Pixel::ClusterSetT<Label>::adjacentMatrix() const {
+	return adjacencyGraph().denseMatrix();
+}
+
+template<typename Label>
+void RSlic::Pixel::ClusterSetT<Label>::refindAdjacent() const {
+	std::lock_guard<std::mutex> guard(graphMutex);
+	if (data.graph_calculated) return;
+	const Mat_<Label> &clusterMat = data.clusterLabel;
+	const int w = clusterMat.cols;
+	const int h = clusterMat.rows;
+	// Every row is compared with itself (right neighbour) and the next row (lower left, lower and lower right neighbour)
+	data.graph = RSlic::priv::adjacencyGraph(ThreadPool::defaultPool().get(), h, clusterCount(), [&](int begin, int end, RSlic::priv::EdgeCollector &add) {
+		for (int y = begin; y < end; y++) {
+			const Label *row = clusterMat[y];
+			const Label *nextRow = y + 1 < h ? clusterMat[y + 1] : nullptr;
+			for (int x = 0; x < w; x++) {
+				const Label currentCluster = row[x];
+				if (x + 1 < w && currentCluster != row[x + 1])
+					add(currentCluster, row[x + 1], 1);
+				if (nextRow == nullptr) continue;
+				if (x > 0 && currentCluster != nextRow[x - 1])
+					add(currentCluster, nextRow[x - 1], 0);
+				if (currentCluster != nextRow[x])
+					add(currentCluster, nextRow[x], 1);
+				if (x + 1 < w && currentCluster != nextRow[x + 1])
+					add(currentCluster, nextRow[x + 1], 0);
 			}
 		}
-	}
-	data.adjMatrix = res;
+	});
+	data.graph_calculated = true;
 }
 
 inline tuple<u_long, u_long> operator+(const tuple<u_long, u_long> &a, const tuple<u_long, u_long> &b) {
 	return make_tuple(std::get<0>(a) + std::get<0>(b), std::get<1>(a) + std::get<1>(b));
 }
 
-void RSlic::Pixel::ClusterSet::refindCenters() const {
+template<typename Label>
+void RSlic::Pixel::ClusterSetT<Label>::refindCenters() const {
 	std::lock_guard<std::mutex> guard(centerMutex);
 	if (data.centers_calculated) return;
 
@@ -73,9 +85,10 @@ void RSlic::Pixel::ClusterSet::refindCenters() const {
 	vector<tuple<u_long, u_long>> centerCoord(data._clusterCount, make_tuple(0l, 0l));//Da Werte länger als sizeof(int) sein kann
 
 
-	for (int x = 0; x < data.clusterLabel.cols; x++) {
-		for (int y = 0; y < data.clusterLabel.rows; y++) {
-			ClusterInt idx = data.clusterLabel.at<ClusterInt>(y, x);
+	for (int y = 0; y < data.clusterLabel.rows; y++) {
+		const Label *row = data.clusterLabel[y];
+		for (int x = 0; x < data.clusterLabel.cols; x++) {
+			Label idx = row[x];
 			if (idx < 0) continue;
 			centersCounts[idx]++;
 			centerCoord[idx] = centerCoord[idx] + make_tuple(static_cast<u_long>(x), static_cast<u_long>(y));
@@ -94,16 +107,74 @@ void RSlic::Pixel::ClusterSet::refindCenters() const {
 	data.centers_calculated = true;
 }
 
-Mat RSlic::Pixel::ClusterSet::maskOfCluster(ClusterInt idx) const {
+template<typename Label>
+Mat RSlic::Pixel::ClusterSetT<Label>::maskOfCluster(Label idx) const {
 	int h = data.clusterLabel.rows;
 	int w = data.clusterLabel.cols;
 	cv::Mat res = cv::Mat::zeros(h, w, CV_8U);
-	for (int x = 0; x < w; x++) {
+	if (idx < 0 || idx >= clusterCount()) { // not in the index (e.g. -1 = no cluster)
 		for (int y = 0; y < h; y++) {
-			if (data.clusterLabel.at<ClusterInt>(y, x) == idx)
-				res.at<uint8_t>(y, x) = 1;
+			const Label *row = data.clusterLabel[y];
+			uint8_t *resRow = res.ptr<uint8_t>(y);
+			for (int x = 0; x < w; x++) {
+				if (row[x] == idx)
+					resRow[x] = 1;
+			}
 		}
+		return res;
 	}
+	uint8_t *resData = res.ptr<uint8_t>(0); // continuous, so element y * w + x is pixel x,y
+	const PixelIndex &index = pixelIndex();
+	for (const int32_t *it = index.begin(idx); it != index.end(idx); ++it) resData[*it] = 1;
 	return res;
 }
 
+template<typename Label>
+Mat RSlic::Pixel::ClusterSetT<Label>::maskOfCluster(Label idx, Rect &box) const {
+	box = Rect();
+	if (idx < 0 || idx >= clusterCount()) return Mat();
+	const PixelIndex &index = pixelIndex();
+	if (index.size(idx) == 0) return Mat();
+	const int w = data.clusterLabel.cols;
+	// the pixels are sorted row by row, so only the x range has to be searched
+	int xMin = w, xMax = -1;
+	for (const int32_t *it = index.begin(idx); it != index.end(idx); ++it) {
+		const int x = *it % w;
+		xMin = std::min(xMin, x);
+		xMax = std::max(xMax, x);
+	}
+	const int yMin = *index.begin(idx) / w;
+	const int yMax = *(index.end(idx) - 1) / w;
+	box = Rect(xMin, yMin, xMax - xMin + 1, yMax - yMin + 1);
+	cv::Mat res = cv::Mat::zeros(box.height, box.width, CV_8U);
+	for (const int32_t *it = index.begin(idx); it != index.end(idx); ++it) {
+		res.at<uint8_t>(*it / w - yMin, *it % w - xMin) = 1;
+	}
+	return res;
+}
+
+template<typename Label>
+const RSlic::PixelIndex &RSlic::Pixel::ClusterSetT<Label>::pixelIndex() const {
+	if (!data.index_calculated) {
+		refindIndex();
+	}
+	return data.index;
+}
+
+template<typename Label>
+void RSlic::Pixel::ClusterSetT<Label>::refindIndex() const {
+	std::lock_guard<std::mutex> guard(indexMutex);
+	if (data.index_calculated) return;
+	const Mat_<Label> &clusterMat = data.clusterLabel;
+	const int w = clusterMat.cols;
+	data.index = RSlic::priv::clusterIndex<int32_t>(ThreadPool::defaultPool().get(), clusterMat.rows, clusterCount(), [&](int begin, int end, RSlic::priv::IndexVisitor<int32_t> &visit) {
+		for (int y = begin; y < end; y++) {
+			const Label *row = clusterMat[y];
+			for (int x = 0; x < w; x++) visit(row[x], y * w + x);
+		}
+	});
+	data.index_calculated = true;
+}
+
+template class RSlic::Pixel::ClusterSetT<int16_t>;
+template class RSlic::Pixel::ClusterSetT<int32_t>;
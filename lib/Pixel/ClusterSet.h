@@ -1,38 +1,54 @@
 #ifndef CLUSTERSET2_H
 #define CLUSTERSET2_H
 #include <vector>
+#include <mutex>
+#include <type_traits>
 #include <opencv2/core/core.hpp>
+#include <AdjacencyGraph.h>
+#include <ClusterIndex.h>
+#include "../priv/Useful.h"
 
 using namespace std;
 using namespace cv;
 
 namespace RSlic{
 namespace Pixel{
+/**
+* Default label type. It is able to number 32767 clusters.
+* Use int32_t (e.g. ClusterSet32, Slic2T<int32_t>) for more.
+* @see withClusterInt
+*/
 using ClusterInt = int16_t;
 
+using RSlic::priv::withClusterInt;
+
 /**
 * @brief Representing cluster (also called "Superpixel") with some functionality
+* @tparam Label the type of the cluster label (int16_t or int32_t)
 */
- class ClusterSet {
+ template<typename Label>
+ class ClusterSetT {
  public:
+     static_assert(std::is_signed<Label>::value && std::is_integral<Label>::value, "Label has to be a signed integer");
+
      /**
      * Constructor for an empty ClusterSet
      */
-     ClusterSet() : data{cv::Mat(), std::vector<Vec2i>(), 0, true, false, cv::Mat()} {
+     ClusterSetT() : data{cv::Mat(), std::vector<Vec2i>(), 0, true, false, AdjacencyGraph(), false, PixelIndex()} {
      }
 
-     ClusterSet(const ClusterSet &other) : data(other.data) {
+     ClusterSetT(const ClusterSetT &other) : data(other.data) {
      }
 
-     ClusterSet(ClusterSet &&other) : data(std::move(other.data)) {
+     ClusterSetT(ClusterSetT &&other) : data(std::move(other.data)) {
      }
 
-     RSlic::Pixel::ClusterSet &operator=(ClusterSet &&other) {
+     ClusterSetT &operator=(ClusterSetT &&other) {
          data = std::move(other.data);
          return *this;
      }
 
-     RSlic::Pixel::ClusterSet &operator=(const ClusterSet &other) {
+     ClusterSetT &operator=(const ClusterSetT &other) {
          data = other.data;
          return *this;
      }
@@ -45,9 +61,9 @@ using ClusterInt = int16_t;
      template<typename T, typename= typename std::enable_if<
              std::is_same<vector<Vec2i>, typename std::decay<T>::type>::value
      >::type>
-     ClusterSet(T &&_centers, cv::Mat_<ClusterInt> _clusters)
-             : data{_clusters, std::forward<T>(_centers), 0, true, false, cv::Mat()} {
-         data._clusterCount = _centers.size();
+     ClusterSetT(T &&_centers, cv::Mat_<Label> _clusters)
+             : data{_clusters, std::forward<T>(_centers), 0, true, false, AdjacencyGraph(), false, PixelIndex()} {
+         data._clusterCount = data.centers.size();
      }
 
      /**
@@ -57,20 +73,65 @@ using ClusterInt = int16_t;
      * @param clusterCount the amount of the clusters
      * @see getCenters()
      */
-     ClusterSet(cv::Mat_<ClusterInt> clusters, int clusterCount);
+     ClusterSetT(cv::Mat_<Label> clusters, int clusterCount);
 
      /**
      * Returns a mask of the cluster with the number idx.
+     * Only the pixels of the cluster are visited (see pixelIndex()).
      * @param idx Clusters index
      * @return binary mask.
      */
-     Mat maskOfCluster(ClusterInt idx) const; 
+     Mat maskOfCluster(Label idx) const;
+
+     /**
+     * Returns the mask of the cluster with the number idx cropped to its bounding box.
+     * The costs depend only on the size of the cluster, not on the size of the picture.
+     * @param idx Clusters index
+     * @param box is set to the bounding box of the cluster in the picture (empty if the cluster has no pixel)
+     * @return binary mask of the size of box
+     */
+     Mat maskOfCluster(Label idx, Rect &box) const;
+
+     /**
+     * Returns the pixels of every cluster (compressed rows, element = y * width + x).
+     * This is a lazy-evaluation (one counting sort, computed in parallel).
+     * @return the index
+     */
+     const PixelIndex &pixelIndex() const;
+
+     /**
+     * Calls f(y, x) for every pixel of the cluster with the number idx (row by row).
+     * @param idx Clusters index
+     * @param f the functor
+     */
+     template<typename F>
+     void forEachPixel(Label idx, F f) const {
+         const PixelIndex &index = pixelIndex();
+         const int w = data.clusterLabel.cols;
+         for (const int32_t *it = index.begin(idx); it != index.end(idx); ++it) f(*it / w, *it % w);
+     }
+
+     /**
+     * Returns the values of img at all pixels of the cluster with the number idx (row by row).
+     * @tparam T element type of img (e.g. Vec3b)
+     * @param img picture of the same size as the clusters
+     * @param idx Clusters index
+     * @return the values
+     */
+     template<typename T>
+     vector<T> gather(const Mat &img, Label idx) const {
+         const PixelIndex &index = pixelIndex();
+         vector<T> res;
+         res.reserve(index.size(idx));
+         forEachPixel(idx, [&](int y, int x) { res.push_back(img.at<T>(y, x)); });
+         return res;
+     }
 
      /**
      * Returns a Mat m where where m[x,y]=i means that the point x,y belongs to the cluster with the number i
      * @return Mat with the cluster label
      */
-     Mat_<ClusterInt> getClusterLabel() const;
+     Mat_<Label> getClusterLabel() const;
 
      /**
      * Returns the central points of the clusters.
@@ -92,16 +153,25 @@ using ClusterInt = int16_t;
      * @param x x-coordinate
      * @return cluster index
      */
-     inline ClusterInt at(int y, int x) const {
-         return data.clusterLabel.at<ClusterInt>(y, x);
+     inline Label at(int y, int x) const {
+         return data.clusterLabel.template at<Label>(y, x);
      }
 
+     /**
+     * Returns the region adjacency graph: the neighbours of every cluster (8-neighbourhood)
+     * and the length of the boundaries they share. It only needs memory for the edges.
+     * This is a lazy-evaluation (computed in parallel).
+     * @return the graph
+     */
+     const AdjacencyGraph &adjacencyGraph() const;
+
      /**
      * Returns the adjacent matrix m (type CV_8UC1).
      * If m[x,y] == 1 then the cluster with number x
      * and the cluster with number y are neighbour.
      * It is always m[x,x] == 1 and if m[x,y]==1
      * it means that m[y,x] == 1.
+     * It is built from adjacencyGraph() on every call and needs clusterCount()² bytes, so prefer the graph for many clusters.
      * @return adjacent matrix.
      */
      const cv::Mat adjacentMatrix() const;
@@ -113,18 +183,24 @@ using ClusterInt = int16_t;
          nonspecial& operator=(const nonspecial & other) = default;
          nonspecial& operator=(nonspecial && other) = default;
 
-         Mat_<ClusterInt> clusterLabel;
+         Mat_<Label> clusterLabel;
 
          mutable vector<Vec2i> centers;
          int _clusterCount;
-         mutable bool centers_calculated, adj_calculated;
-         mutable Mat_<uint8_t> adjMatrix;
+         mutable bool centers_calculated, graph_calculated;
+         mutable AdjacencyGraph graph;
+         mutable bool index_calculated;
+         mutable PixelIndex index;
      } data;
-     mutable std::mutex centerMutex, adjMutex;
+     mutable std::mutex centerMutex, graphMutex, indexMutex;
 
      void refindCenters() const; //computes central points -> data.centers
-     void refindAdjacent() const; //computes adjacent matrix -> data.adjMatrix
+     void refindAdjacent() const; //computes adjacency graph -> data.graph
+     void refindIndex() const; //computes pixel index -> data.index
  };
+
+ using ClusterSet = ClusterSetT<ClusterInt>;
+ using ClusterSet32 = ClusterSetT<int32_t>;
 }
 }
 #endif // CLUSTERSET_H
@@ -1,12 +1,14 @@
 #include "RSlic2.h"
 
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 #include <priv/Useful.h>
+#include <priv/Trace_p.h>
 #include <array>
 #include <atomic>
 #include <limits.h>
 
 #include "RSlic2_impl.h"
+#include "RSlic2Util.h"
 
 #ifndef u_long
 #define u_long unsigned long
@@ -18,8 +20,61 @@
 using RSlic::priv::aSize;
 using namespace RSlic;
 
-Slic2P RSlic::Pixel::Slic2::initialize(const Mat &img, const Mat &grad, int step, int stiffness, ThreadPoolP pool) {
-	Slic2::Settings *setting = new Slic2::Settings();
+template<typename Label>
+Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::initialize(const Mat &img, const Mat &grad, int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	return create(img, grad, step, stiffness, nullptr, pool, tracer);
+}
+
+template<typename Label>
+Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::initialize(const Mat &img, const Mat &grad, int step, int stiffness, const vector<Vec2i> &seeds, ThreadPoolP pool, TracerP tracer) {
+	return create(img, grad, step, stiffness, &seeds, pool, tracer);
+}
+
+template<typename Label>
+Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::create(const Mat &img, const Mat &grad, int step, int stiffness, const vector<Vec2i> *seeds, ThreadPoolP pool, TracerP tracer) {
+	Slic2T *res = new Slic2T(newSettings(img, step, stiffness, pool, tracer));
+	{
+		RSlic::priv::TraceScope trace(tracer.get(), "initialize");
+		res->init(grad, seeds);
+		trace.count(0, static_cast<long>(img.total()));
+		trace.allocated(RSlic::priv::matBytes(res->getClusters().getClusterLabel()) + RSlic::priv::matBytes(res->distance));
+	}
+	const int count = res->getClusters().clusterCount();
+	if (count == 0 || count > std::numeric_limits<Label>::max()) {
+		delete res;
+		return Slic2TP<Label>();
+	}
+	return Slic2TP<Label>(res);
+}
+
+template<typename Label>
+Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::initialize(const Mat &img, const Slic2T<Label> &other, int step, bool keepLabels) {
+	if (other.clusters.clusterCount() == 0) return Slic2TP<Label>();
+	ClusterSetT<Label> clusters = other.clusters.getClusterLabel().size() == img.size() ? other.clusters : projectClusters(other.clusters, img.size());
+	if (!keepLabels) clusters = ClusterSetT<Label>(vector<Vec2i>(clusters.getCenters()), Mat_<Label>(img.rows, img.cols, static_cast<Label>(-1)));
+	return initialize(img, other, std::move(clusters), step);
+}
+
+template<typename Label>
+Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::initialize(const Mat &img, const Slic2T<Label> &other, ClusterSetT<Label> clusters, int step, bool keepSlicoMaxima) {
+	const int count = clusters.clusterCount();
+	if (count == 0 || count > std::numeric_limits<Label>::max() || clusters.getClusterLabel().size() != img.size()) return Slic2TP<Label>();
+	RSlic::priv::TraceScope trace(other.setting->tracer.get(), "initialize");
+	if (step <= 0) step = std::max(1, static_cast<int>(std::lround(other.setting->step * img.cols * 1.0 / other.setting->img.cols)));
+	const bool ownLabel = clusters.getClusterLabel().data != other.clusters.getClusterLabel().data;
+	Mat_<RSlic::priv::DistanceType> distance(img.rows, img.cols, std::numeric_limits<RSlic::priv::DistanceType>::infinity());
+	Slic2T *res = new Slic2T(newSettings(img, step, other.setting->stiffness, other.setting->pool, other.setting->tracer), std::move(clusters), distance);
+	if (keepSlicoMaxima) res->max_dist_color = other.max_dist_color;
+	// e.g. other is finalized (renumbered clusters, no maxima) or clusters were added
+	res->max_dist_color.resize(count, 0);
+	trace.count(0, static_cast<long>(img.total()));
+	trace.allocated(RSlic::priv::matBytes(distance) + (ownLabel ? RSlic::priv::matBytes(res->clusters.getClusterLabel()) : 0));
+	return Slic2TP<Label>(res);
+}
+
+template<typename Label>
+typename RSlic::Pixel::Slic2T<Label>::Settings *RSlic::Pixel::Slic2T<Label>::newSettings(const Mat &img, int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	Settings *setting = new Settings();
 	setting->img = img;
 	setting->step = step;
 	setting->stiffness = stiffness;
@@ -28,25 +83,29 @@ Slic2P RSlic::Pixel::Slic2::initialize(const Mat &img, const Mat &grad, int step
 		setting->initThreadPool();
 	else
 		setting->pool = pool;
-
-	Slic2 *res = new Slic2(setting);
-	res->init(grad);
-	if (res->getClusters().clusterCount() == 0)
-		return Slic2P();
-	return Slic2P(res);
+	setting->tracer = tracer;
+	return setting;
 }
 
-ThreadPoolP RSlic::Pixel::Slic2::threadpool() const {
+template<typename Label>
+ThreadPoolP RSlic::Pixel::Slic2T<Label>::threadpool() const {
 	return setting->pool;
 }
 
-RSlic::Pixel::Slic2::Slic2(Slic2::Settings *s, ClusterSet &&c, const Mat &d) : clusters(std::move(c)), distance(d) {
+template<typename Label>
+RSlic::TracerP RSlic::Pixel::Slic2T<Label>::tracer() const {
+	return setting->tracer;
+}
+
+template<typename Label>
+RSlic::Pixel::Slic2T<Label>::Slic2T(Settings *s, ClusterSetT<Label> &&c, const Mat &d) : clusters(std::move(c)), distance(d) {
 	assert(s != nullptr);
 	setting = s;
 	s->__refcount++;
 }
 
-RSlic::Pixel::Slic2::~Slic2() {
+template<typename Label>
+RSlic::Pixel::Slic2T<Label>::~Slic2T() {
 	int count = --setting->__refcount;
 	if (count == 0) {
 		delete setting;
@@ -90,41 +149,62 @@ namespace {
  }
 }
 
-void RSlic::Pixel::Slic2::init(const Mat &grad) {
+template<typename Label>
+void RSlic::Pixel::Slic2T<Label>::init(const Mat &grad, const vector<Vec2i> *seeds) {
 	int s = setting->step;
 	std::vector<Vec2i> centerGrid;
-	centerGrid.reserve(setting->img.cols / s * setting->img.rows / s);
-	// initialise the grid and set the its points to the lowest gradient at once
-	for (int x = s; x < setting->img.cols - s / 2; x += s) {
-		for (int y = s; y < setting->img.rows - s / 2; y += s) {
-			Vec2i p(x, y);
+	if (seeds != nullptr) {
+		centerGrid.reserve(seeds->size());
+		for (const Vec2i &seed: *seeds) {
+			Vec2i p(std::min(std::max(seed[0], 0), setting->img.cols - 1), std::min(std::max(seed[1], 0), setting->img.rows - 1));
 			centerGrid.push_back(find_local_minimum_(grad, p));
 		}
+	} else {
+		centerGrid.reserve(setting->img.cols / s * setting->img.rows / s);
+		// initialise the grid and set the its points to the lowest gradient at once
+		for (int x = s; x < setting->img.cols - s / 2; x += s) {
+			for (int y = s; y < setting->img.rows - s / 2; y += s) {
+				Vec2i p(x, y);
+				centerGrid.push_back(find_local_minimum_(grad, p));
+			}
+		}
 	}
 
 
-	Mat_<ClusterInt> label(setting->img.rows, setting->img.cols, -1);
+	Mat_<Label> label(setting->img.rows, setting->img.cols, -1);
 
-	distance = Mat_<double>(setting->img.rows, setting->img.cols, DINF);
+	distance = Mat_<RSlic::priv::DistanceType>(setting->img.rows, setting->img.cols, std::numeric_limits<RSlic::priv::DistanceType>::infinity());
 
-	clusters = ClusterSet(centerGrid, label);
+	clusters = ClusterSetT<Label>(centerGrid, label);
 
-	max_dist_color = vector<double>(centerGrid.size(), 1); //for slico
+	max_dist_color = vector<double>(centerGrid.size(), 0); //for slico (0 = not known yet)
 }
 
-int RSlic::Pixel::Slic2::getStep() const {
+template<typename Label>
+int RSlic::Pixel::Slic2T<Label>::getStep() const {
 	return setting->step;
 }
 
-int RSlic::Pixel::Slic2::getStiffness() const {
+template<typename Label>
+int RSlic::Pixel::Slic2T<Label>::getStiffness() const {
 	return setting->stiffness;
 }
 
-Mat RSlic::Pixel::Slic2::getImg() const {
+template<typename Label>
+Mat RSlic::Pixel::Slic2T<Label>::getImg() const {
 	return setting->img;
 }
 
 
-const RSlic::Pixel::ClusterSet &RSlic::Pixel::Slic2::getClusters() const {
+template<typename Label>
+const RSlic::Pixel::ClusterSetT<Label> &RSlic::Pixel::Slic2T<Label>::getClusters() const {
 	return clusters;
 }
+
+template<typename Label>
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2T<Label>::getResidual() const {
+	return residual;
+}
+
+template class RSlic::Pixel::Slic2T<int16_t>;
+template class RSlic::Pixel::Slic2T<int32_t>;
@@ -7,8 +7,10 @@
 #include <memory>
 #include <mutex>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <Trace.h>
 
 #include "ClusterSet.h"
+#include "ClusterFeatures.h"
 
 using namespace std;
 using namespace cv;
@@ -23,21 +25,62 @@ using ThreadPoolP=shared_ptr<ThreadPool>;
 namespace RSlic {
  namespace Pixel {
 
+  /**
+  * How much an iteration changed the clusters.
+  */
+  struct Residual {
+	  /**
+	  * Sum of the distances the centers moved (in pixel)
+	  */
+	  double displacement = DINF;
+
+	  /**
+	  * Fraction of the pixels that got another label (0 to 1).
+	  * If it is 0, further iterations won't change anything.
+	  */
+	  double changed = 1;
+  };
+
   using DistanceFunc=function<double(const Vec2i & /*point*/, const Vec2i & /*clusterCenter*/, const Mat &/*img*/, int /*stiffness*/, int /*step*/)>;
 
-  class Slic2;
+  struct AssignmentInputs;
+
+  template<typename Label>
+  class Slic2T;
+
+  template<typename Label>
+  class Slic2EngineT;
+
+  template<typename Label>
+  using Slic2TP=shared_ptr<const Slic2T<Label>>;
+
+  using Slic2 = Slic2T<ClusterInt>;
+
+  using Slic2P = Slic2TP<ClusterInt>;
 
-  using Slic2P=shared_ptr<const Slic2>;
+  using Slic2_32 = Slic2T<int32_t>;
 
-  class Slic2 {
+  using Slic2P32 = Slic2TP<int32_t>;
+
+  /**
+  * The Slic algorithm for pictures.
+  * @tparam Label the type of the cluster label (int16_t or int32_t).
+  * int16_t is able to number 32767 clusters, int32_t a lot more, but needs twice the memory.
+  * @see withClusterInt
+  */
+  template<typename Label>
+  class Slic2T {
   private:
 	  struct Settings;
 
+	  friend class Slic2EngineT<Label>;
+
   public:
+	  using ClusterSetType = ClusterSetT<Label>;
 
-	  Slic2(const Slic2 &other) = delete;
+	  Slic2T(const Slic2T &other) = delete;
 
-	  Slic2(Slic2 &&other) = default;
+	  Slic2T(Slic2T &&other) = default;
 
 	  /**
 	  * initialize the algorithm. It build the gradient and set the needed values
@@ -45,23 +88,70 @@ namespace RSlic {
 	  * @param grad the gradient of the picture. Should be positive.
 	  * @param step how many pixel should belongs (approximately) to a clusters
 	  * @param stiffness the stiffness value
-	  * @param pool ThreadPool for computing parallel.
-	  * @return SharedPointer of the Slic2-Object. (Error -> nullptr)
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of this and all following instances (see Trace.h, may be empty)
+	  * @return SharedPointer of the Slic2-Object. (Error -> nullptr, e.g. if Label is not able to number all clusters)
 	  * @see iterate
 	  */
-	  static Slic2P initialize(const Mat &img, const Mat &grad, int step, int stiffness, ThreadPoolP pool = ThreadPoolP());
+	  static Slic2TP<Label> initialize(const Mat &img, const Mat &grad, int step, int stiffness, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * initialize the algorithm with the given centers instead of the grid (e.g. the clusters of the neighbouring tiles, see Slic2Tiled).
+	  * Like the grid every center is moved to the minimum of the gradient in its neighbourhood.
+	  * @param img the picture
+	  * @param grad the gradient of the picture. Should be positive.
+	  * @param step how many pixel should belongs (approximately) to a clusters
+	  * @param stiffness the stiffness value
+	  * @param seeds the centers (x, y), moved inside if they are outside of the picture
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of this and all following instances (see Trace.h, may be empty)
+	  * @return SharedPointer of the Slic2-Object. (Error -> nullptr, e.g. if there are no seeds or Label is not able to number all of them)
+	  */
+	  static Slic2TP<Label> initialize(const Mat &img, const Mat &grad, int step, int stiffness, const vector<Vec2i> &seeds, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * initialize the algorithm with the clusters of another instance instead of the grid
+	  * (e.g. the result for a smaller picture or for the previous frame of a video, see nextFrame).
+	  * The clusters are projected to the size of img (see projectClusters), the next iteration starts with their centers
+	  * and (if the metric uses the features) the mean colors of their labels.
+	  * No gradient is needed. The stiffness, the Slico color maxima, the pool and the tracer of other are kept.
+	  * @param img the picture
+	  * @param other the instance to start with
+	  * @param step how many pixel should belongs (approximately) to a clusters (in img), 0 = the step of other scaled to img
+	  * @param keepLabels start with the labels of other (pixels no center reaches keep them), otherwise only with the centers
+	  * @return SharedPointer of the Slic2-Object. (Error -> nullptr, e.g. if other has no clusters)
+	  */
+	  static Slic2TP<Label> initialize(const Mat &img, const Slic2T<Label> &other, int step = 0, bool keepLabels = true);
+
+	  /**
+	  * initialize the algorithm with the given clusters (centers and labels of the size of img) and the settings of another instance
+	  * (stiffness, pool, tracer and optionally the Slico color maxima of the clusters with the same number),
+	  * e.g. after clusters of other were replaced or added (see nextFrame).
+	  * @param img the picture
+	  * @param other the instance with the settings
+	  * @param clusters the clusters to start with
+	  * @param step how many pixel should belongs (approximately) to a clusters (in img), 0 = the step of other scaled to img
+	  * @param keepSlicoMaxima start with the Slico color maxima of other, otherwise they are found again like after the grid.
+	  * They only grow, so a long chain of instances (like the frames of a video) should not keep them.
+	  * @return SharedPointer of the Slic2-Object. (Error -> nullptr, e.g. if there are no clusters or Label is not able to number all of them)
+	  */
+	  static Slic2TP<Label> initialize(const Mat &img, const Slic2T<Label> &other, ClusterSetT<Label> clusters, int step = 0, bool keepSlicoMaxima = true);
 
 	  ThreadPoolP threadpool() const;
 
+	  TracerP tracer() const;
+
 	  /**
 	  * Iterating the algorithm.
 	  * @param f the functor with the metrics for the iteration.
 	  * Has to be something like struct Example{..;inline double operator()(const cv::Vec2i &point, const cv::Vec2i &clusterCenter, const cv::Mat &mat, int stiffness, int step){...} ...}
 	  * (stiffness will be passed squared)
+	  * If it has an operator()(const cv::Vec2i &point, const ClusterFeatures &features, int clusterIdx, const cv::Mat &mat, int stiffness, int step),
+	  * the features of the clusters (e.g. mean color) will be computed once and this one is used instead.
 	  * @return a new instance of Slic2 with the results of the iteration.
 	  */
 	  template<typename F>
-	  Slic2P iterate(F f) const;
+	  Slic2TP<Label> iterate(F f) const;
 
 	  /**
 	  * Iterating the algorithm with another stiffness.
@@ -71,7 +161,7 @@ namespace RSlic {
 	  * @see iterate
 	  */
 	  template<typename F>
-	  Slic2P iterate(int stiffness, F f) const;
+	  Slic2TP<Label> iterate(int stiffness, F f) const;
 
 	  /**
 	  * Iterating the algorithm
@@ -80,7 +170,37 @@ namespace RSlic {
 	  * @return a new instance of Slic2 with the results of the iteration.
 	  */
 	  template<typename F>
-	  Slic2P iterateZero(F f) const;
+	  Slic2TP<Label> iterateZero(F f) const;
+
+	  /**
+	  * Iterating the algorithm only where the clusters changed.
+	  * A cluster is active if its center moved or its mean color (if the metric uses the features) changed
+	  * by more than tolerance since the iteration that created this instance.
+	  * Only the pixels near active clusters are assigned again (by all clusters that reach them),
+	  * everywhere else the labels and distances of this instance are kept.
+	  * So late iterations cost about as much as has changed, not as big as the picture is.
+	  * With tolerance 0 the result is the same as the one of iterate. Otherwise an inactive cluster
+	  * keeps the center and color it was assigned with until it moved further than tolerance.
+	  * Has to use the same metric (functor type and color range) and stiffness as the iteration before, else (or without one) every pixel is assigned again.
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again (in pixel and color values)
+	  * @return a new instance of Slic2 with the results of the iteration.
+	  * @see iterate
+	  */
+	  template<typename F>
+	  Slic2TP<Label> iterateActive(F f, double tolerance = 0) const;
+
+	  /**
+	  * Same as iterateActive, but using the zero parameter version (SLICO).
+	  * A change of the color maximum of a cluster makes it active, too.
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again
+	  * @return a new instance of Slic2 with the results of the iteration.
+	  * @see iterateZero
+	  * @see iterateActive
+	  */
+	  template<typename F>
+	  Slic2TP<Label> iterateZeroActive(F f, double tolerance = 0) const;
 
 
 	  /**
@@ -92,7 +212,7 @@ namespace RSlic {
 	  * @return a new instance of Slic2 with the results of the iteration.
 	  */
 	  template<typename F>
-	  Slic2P finalize(F f) const;
+	  Slic2TP<Label> finalize(F f) const;
 
 	  /**
 	  * Returns the step value
@@ -116,20 +236,36 @@ namespace RSlic {
 	  * Returns the computed clusters.
 	  * @return computed clusters
 	  */
-	  const ClusterSet &getClusters() const;
+	  const ClusterSetT<Label> &getClusters() const;
+
+	  /**
+	  * Returns how much the iteration that created this instance changed the clusters.
+	  * (Default values if not created by iterate or iterateZero)
+	  * @return the residual
+	  * @see iterateUntil
+	  */
+	  const Residual &getResidual() const;
 
-	  virtual ~Slic2();
+	  virtual ~Slic2T();
 
   private:
-	  ClusterSet clusters;
+	  ClusterSetT<Label> clusters;
 	  Settings *setting;
 	  Mat distance;
 
 	  vector<double> max_dist_color; // For Slico (square values)
+	  ClusterFeatures features; // Of clusters, empty if not computed yet
+	  Residual residual;
+	  shared_ptr<const AssignmentInputs> assignment; // What the iteration that created this instance assigned with (nullptr if none)
   protected:
-	  Slic2(Settings *s, ClusterSet &&clusters = ClusterSet(), const Mat &distance = cv::Mat());
+	  Slic2T(Settings *s, ClusterSetT<Label> &&clusters = ClusterSetT<Label>(), const Mat &distance = cv::Mat());
+
+	  static Settings *newSettings(const Mat &img, int step, int stiffness, ThreadPoolP pool, TracerP tracer);
+
+	  //Sets up the clusters at the grid (seeds == nullptr) or at seeds
+	  void init(const Mat &grad, const vector<Vec2i> *seeds = nullptr);
 
-	  void init(const Mat &grad);
+	  static Slic2TP<Label> create(const Mat &img, const Mat &grad, int step, int stiffness, const vector<Vec2i> *seeds, ThreadPoolP pool, TracerP tracer);
   };
 
  }
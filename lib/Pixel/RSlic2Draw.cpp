@@ -69,17 +69,19 @@ namespace priv {
 namespace {
  using namespace RSlic::Pixel;
 
- template<typename tp>
- inline tuple<priv::LongVector<tp>, vector<int>> calcMean(const Mat &m, const ClusterSet &set) {
+ template<typename tp, typename Label>
+ inline tuple<priv::LongVector<tp>, vector<int>> calcMean(const Mat &m, const ClusterSetT<Label> &set) {
 	 auto n = set.clusterCount();
 	 priv::LongVector<tp> meanValue(n, 0);
 	 vector<int> pixelCount(n, 0);
 	 auto label = set.getClusterLabel();
-	 for (int x = 0; x < m.cols; x++) {
-		 for (int y = 0; y < m.rows; y++) {
-			 auto idx = label.at<ClusterInt>(y, x);
+	 for (int y = 0; y < m.rows; y++) {
+		 const Label *labelRow = label[y];
+		 const tp *row = m.ptr<tp>(y);
+		 for (int x = 0; x < m.cols; x++) {
+			 auto idx = labelRow[x];
 			 if (idx < 0) continue;
-			 meanValue[idx] += m.at<tp>(y, x);
+			 meanValue[idx] += row[x];
 			 pixelCount[idx]++;
 		 }
 	 }
@@ -87,17 +89,19 @@ namespace {
  }
 
 
- template<typename tp>
- Mat drawClusterType(const Mat &m, const ClusterSet &set) {
+ template<typename tp, typename Label>
+ Mat drawClusterType(const Mat &m, const ClusterSetT<Label> &set) {
 	 Mat res(m.rows, m.cols, m.type());
 	 auto label = set.getClusterLabel();
 	 auto meantuple = calcMean<tp>(m, set);
 	 auto &&meanValue = get<0>(meantuple);
 	 auto &&pixelCount = get<1>(meantuple);
-	 for (int x = 0; x < m.cols; x++) {
-		 for (int y = 0; y < m.rows; y++) {
-			 auto idx = label.at<ClusterInt>(y, x);
-			 res.at<tp>(y, x) = meanValue[idx] / pixelCount[idx];
+	 for (int y = 0; y < m.rows; y++) {
+		 const Label *labelRow = label[y];
+		 tp *resRow = res.ptr<tp>(y);
+		 for (int x = 0; x < m.cols; x++) {
+			 auto idx = labelRow[x];
+			 resRow[x] = meanValue[idx] / pixelCount[idx];
 		 }
 	 }
 	 return res;
@@ -106,7 +110,11 @@ namespace {
  declareCVF_T(drawClusterType, drawClusterType_, return cv::Mat())
 }
 
-Mat RSlic::Pixel::drawCluster(const Mat &m, const ClusterSet &set) {
+template<typename Label>
+Mat RSlic::Pixel::drawCluster(const Mat &m, const ClusterSetT<Label> &set) {
 	return ::drawClusterType_(m.type(), m, set);
 }
 
+template Mat RSlic::Pixel::drawCluster<int16_t>(const Mat &m, const ClusterSetT<int16_t> &set);
+template Mat RSlic::Pixel::drawCluster<int32_t>(const Mat &m, const ClusterSetT<int32_t> &set);
+
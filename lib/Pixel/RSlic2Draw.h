@@ -11,10 +11,11 @@ namespace RSlic {
   /**
   * Colorize the cluster by using the mean color.
   * @param m the picture
-  * @param set the ClusterSet
+  * @param set the ClusterSet (int16_t or int32_t labels)
   * @return new picutre with colorized cluster
   */
-  Mat drawCluster(const Mat &m, const ClusterSet &set);
+  template<typename Label>
+  Mat drawCluster(const Mat &m, const ClusterSetT<Label> &set);
 
   /**
   * Draw the lines around the cluster. color_t have to be right type for the image.
@@ -23,17 +24,22 @@ namespace RSlic {
   * @param color the color for drawing
   * @return a new image
   */
-  template<typename color_t>
-  Mat contourCluster(const Mat &m, const ClusterSet &set, color_t color) {
+  template<typename color_t, typename Label>
+  Mat contourCluster(const Mat &m, const ClusterSetT<Label> &set, color_t color) {
 	  Mat res = m.clone();
-	  for (int x = 1; x < m.cols - 1; x++) {
-		  for (int y = 1; y < m.rows - 1; y++) {
-			  int currentLabel = set.at(y, x);
-			  if (set.at(y + 1, x) != currentLabel
-					  || set.at(y - 1, x) != currentLabel
-					  || set.at(y, x + 1) != currentLabel
-					  || set.at(y, x - 1) != currentLabel) {
-				  res.at<color_t>(y, x) = color;
+	  Mat_<Label> label = set.getClusterLabel();
+	  for (int y = 1; y < m.rows - 1; y++) {
+		  const Label *prevRow = label[y - 1];
+		  const Label *row = label[y];
+		  const Label *nextRow = label[y + 1];
+		  color_t *resRow = res.ptr<color_t>(y);
+		  for (int x = 1; x < m.cols - 1; x++) {
+			  Label currentLabel = row[x];
+			  if (nextRow[x] != currentLabel
+					  || prevRow[x] != currentLabel
+					  || row[x + 1] != currentLabel
+					  || row[x - 1] != currentLabel) {
+				  resRow[x] = color;
 			  }
 		  }
 	  }
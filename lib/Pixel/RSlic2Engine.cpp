@@ -0,0 +1,91 @@
+#include "RSlic2Engine.h"
+#include "RSlic2_impl.h"
+
+using namespace RSlic::Pixel;
+
+template<typename Label>
+unique_ptr<Slic2EngineT<Label>> RSlic::Pixel::Slic2EngineT<Label>::initialize(const Mat &img, const Mat &grad, int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	auto slic = Slic2T<Label>::initialize(img, grad, step, stiffness, pool, tracer);
+	if (slic.get() == nullptr) return unique_ptr<Slic2EngineT>();
+	unique_ptr<Slic2EngineT> res(new Slic2EngineT(*slic));
+	res->shared = false; // slic is gone
+	return res;
+}
+
+template<typename Label>
+RSlic::Pixel::Slic2EngineT<Label>::Slic2EngineT(const Slic2T<Label> &slic) :
+		setting(slic.setting), clusters(slic.clusters), distance(slic.distance), shared(true),
+		max_dist_color(slic.max_dist_color), features(slic.features), residual(slic.residual), assignment(slic.assignment) {
+	setting->__refcount++;
+}
+
+template<typename Label>
+RSlic::Pixel::Slic2EngineT<Label>::~Slic2EngineT() {
+	int count = --setting->__refcount;
+	if (count == 0) {
+		delete setting;
+	}
+}
+
+template<typename Label>
+void RSlic::Pixel::Slic2EngineT<Label>::swap(ClusterSetT<Label> &&newClusters, const Mat &newDistance) {
+	if (shared) {
+		spareLabel = Mat_<Label>();
+		spareDistance = Mat();
+	} else {
+		spareLabel = clusters.getClusterLabel();
+		spareDistance = distance;
+	}
+	clusters = std::move(newClusters);
+	distance = newDistance;
+	shared = false;
+}
+
+template<typename Label>
+Slic2TP<Label> RSlic::Pixel::Slic2EngineT<Label>::snapshot() {
+	Slic2T<Label> *res = new Slic2T<Label>(setting, ClusterSetT<Label>(clusters), distance);
+	res->max_dist_color = max_dist_color;
+	res->features = features;
+	res->residual = residual;
+	res->assignment = assignment;
+	shared = true;
+	return Slic2TP<Label>(res);
+}
+
+template<typename Label>
+const ClusterSetT<Label> &RSlic::Pixel::Slic2EngineT<Label>::getClusters() const {
+	return clusters;
+}
+
+template<typename Label>
+const Residual &RSlic::Pixel::Slic2EngineT<Label>::getResidual() const {
+	return residual;
+}
+
+template<typename Label>
+int RSlic::Pixel::Slic2EngineT<Label>::getStep() const {
+	return setting->step;
+}
+
+template<typename Label>
+int RSlic::Pixel::Slic2EngineT<Label>::getStiffness() const {
+	return setting->stiffness;
+}
+
+template<typename Label>
+Mat RSlic::Pixel::Slic2EngineT<Label>::getImg() const {
+	return setting->img;
+}
+
+template<typename Label>
+ThreadPoolP RSlic::Pixel::Slic2EngineT<Label>::threadpool() const {
+	return setting->pool;
+}
+
+template<typename Label>
+RSlic::TracerP RSlic::Pixel::Slic2EngineT<Label>::tracer() const {
+	return setting->tracer;
+}
+
+template class RSlic::Pixel::Slic2EngineT<int16_t>;
+template class RSlic::Pixel::Slic2EngineT<int32_t>;
@@ -0,0 +1,170 @@
+#ifndef RSlic2ENGINE_H
+#define RSlic2ENGINE_H
+
+#include "RSlic2.h"
+
+namespace RSlic {
+ namespace Pixel {
+
+  template<typename Label>
+  class Slic2EngineT;
+
+  using Slic2Engine = Slic2EngineT<ClusterInt>;
+
+  using Slic2Engine32 = Slic2EngineT<int32_t>;
+
+  /**
+  * The Slic algorithm for pictures, iterating in place.
+  * Slic2T creates a new instance (with new label and distance Mats) for every iteration, which is nice
+  * if you want to look back, but costs a lot of memory for big pictures.
+  * The engine has two buffers for labels and distances: every iteration writes into the spare one and swaps them.
+  * So after the first iterations nothing of picture size is allocated anymore.
+  * Slic2T itself iterates with an engine and keeps its result.
+  * @tparam Label the type of the cluster label (int16_t or int32_t).
+  * @see Slic2T
+  */
+  template<typename Label>
+  class Slic2EngineT {
+  public:
+	  /**
+	  * initialize the algorithm (see Slic2T::initialize)
+	  * @param img the picture
+	  * @param grad the gradient of the picture. Should be positive.
+	  * @param step how many pixel should belongs (approximately) to a clusters
+	  * @param stiffness the stiffness value
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of the engine (see Trace.h, may be empty)
+	  * @return the engine (Error -> nullptr, e.g. if Label is not able to number all clusters)
+	  */
+	  static unique_ptr<Slic2EngineT> initialize(const Mat &img, const Mat &grad, int step, int stiffness, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * Continues iterating from slic. Its Mats are shared, not copied (and never written).
+	  * @param slic the state to start with
+	  */
+	  explicit Slic2EngineT(const Slic2T<Label> &slic);
+
+	  Slic2EngineT(const Slic2EngineT &other) = delete;
+
+	  Slic2EngineT &operator=(const Slic2EngineT &other) = delete;
+
+	  /**
+	  * Iterating the algorithm (see Slic2T::iterate).
+	  * @param f the functor with the metrics for the iteration.
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterate(F f);
+
+	  /**
+	  * Iterating the algorithm with another stiffness (see Slic2T::iterate).
+	  * @param stiffness the stiffness factor.
+	  * @param f the functor with the metrics for the iteration.
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterate(int stiffness, F f);
+
+	  /**
+	  * Iterating the algorithm using SLICO (see Slic2T::iterateZero).
+	  * @param f the functor with the metrics for the iteration
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterateZero(F f);
+
+	  /**
+	  * Iterating the algorithm only where the clusters changed (see Slic2T::iterateActive).
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterateActive(F f, double tolerance = 0);
+
+	  /**
+	  * Same as iterateActive, but using SLICO (see Slic2T::iterateZeroActive).
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterateZeroActive(F f, double tolerance = 0);
+
+	  /**
+	  * Returns the current state as Slic2 instance (e.g. for finalize or drawing).
+	  * Nothing is copied: the engine won't write into these buffers anymore and allocates new ones if needed.
+	  * @return the Slic2 instance
+	  */
+	  Slic2TP<Label> snapshot();
+
+	  /**
+	  * Returns the current clusters.
+	  * The label Mat will be overwritten by the iteration after the next one, use snapshot to keep it.
+	  * @return current clusters
+	  */
+	  const ClusterSetT<Label> &getClusters() const;
+
+	  /**
+	  * Returns how much the last iteration changed the clusters.
+	  * @return the residual
+	  */
+	  const Residual &getResidual() const;
+
+	  /**
+	  * Returns the step value
+	  * @return step value
+	  */
+	  int getStep() const;
+
+	  /**
+	  * Returns the stiffness value
+	  * @return stiffness value
+	  */
+	  int getStiffness() const;
+
+	  /**
+	  * Returns the image
+	  * @return the image
+	  */
+	  Mat getImg() const;
+
+	  ThreadPoolP threadpool() const;
+
+	  TracerP tracer() const;
+
+	  ~Slic2EngineT();
+
+  private:
+	  using Settings = typename Slic2T<Label>::Settings;
+
+	  Settings *setting;
+	  ClusterSetT<Label> clusters;
+	  Mat distance;
+	  Mat_<Label> spareLabel; // written by the next iteration (empty if it has to be allocated)
+	  Mat spareDistance;
+	  bool shared; // whether clusters and distance are used by a Slic2 instance, too
+
+	  vector<double> max_dist_color; // For Slico (square values)
+	  ClusterFeatures features; // Of clusters, empty if not computed yet
+	  Residual residual;
+	  shared_ptr<const AssignmentInputs> assignment;
+
+	  //Returns the features of the clusters if F uses them (otherwise nullptr)
+	  template<typename F>
+	  const ClusterFeatures *featuresFor();
+
+	  //iterate and iterateActive (tolerance < 0: assign every pixel)
+	  template<typename F>
+	  const Residual &iterateNormal(int stiffness, F f, double tolerance);
+
+	  //iterateZero and iterateZeroActive (tolerance < 0: assign every pixel)
+	  template<typename F>
+	  const Residual &iterateSlico(F f, double tolerance);
+
+	  //Makes the result of an iteration the current state, the old one becomes the spare buffer (if not shared)
+	  void swap(ClusterSetT<Label> &&newClusters, const Mat &newDistance);
+  };
+ }
+}
+#endif // RSlic2ENGINE_H
@@ -0,0 +1,207 @@
+#include "../priv/Simd_p.h"
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RSLIC_SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace RSlic::priv::simd;
+
+namespace {
+ //Scalar version (same formula as Pixel::distanceColor)
+ void colorRowScalar(const uint8_t *row, int x0, int n, const double mean[3], int cx, int dy, int stiffness, int step, double *out) {
+	 const int ds_y = dy * dy;
+	 const uint8_t *pixel = row + 3 * x0;
+	 for (int i = 0; i < n; i++, pixel += 3) {
+		 double dl = pixel[0] - mean[0], da = pixel[1] - mean[1], db = pixel[2] - mean[2];
+		 int dx = x0 + i - cx;
+		 double dc = dl * dl + da * da + db * db;
+		 double ds = dx * dx + ds_y;
+		 out[i] = dc / stiffness + ds / (step * step);
+	 }
+ }
+
+ //Scalar version (same formula as Pixel::distanceGray)
+ void grayRowScalar(const uint8_t *row, int x0, int n, double mean, int cx, int dy, int stiffness, int step, double *out) {
+	 const int ds_y = dy * dy;
+	 for (int i = 0; i < n; i++) {
+		 double dc = row[x0 + i] - mean;
+		 int dx = x0 + i - cx;
+		 double ds = dx * dx + ds_y;
+		 out[i] = dc * dc / stiffness + ds / (step * step);
+	 }
+ }
+
+#ifdef RSLIC_SIMD_X86
+ //Moves the channels of 4 Lab pixels (12 bytes) into L0..L3 a0..a3 b0..b3
+ #define RSLIC_DEINTERLEAVE_MASK _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1)
+
+ //Channels of 4 pixels (as int32)
+ #define RSLIC_LOAD_LAB(pixel, l, a, b) \
+     __m128i l, a, b; { \
+     __m128i v = _mm_setzero_si128(); \
+     std::memcpy(&v, pixel, 12); \
+     v = _mm_shuffle_epi8(v, RSLIC_DEINTERLEAVE_MASK); \
+     l = _mm_cvtepu8_epi32(v); \
+     a = _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)); \
+     b = _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)); \
+ }
+
+ //Gray values of 4 pixels (as int32)
+ #define RSLIC_LOAD_GRAY(pixel, g) \
+     __m128i g; { \
+     int32_t bytes; \
+     std::memcpy(&bytes, pixel, 4); \
+     g = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)); \
+ }
+
+ //Squared spatial distance of 4 pixels (as int32)
+ #define RSLIC_SPATIAL_DS(x, cx, dsy, result) \
+     __m128i result; { \
+     __m128i dx = _mm_sub_epi32(_mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3)), cx); \
+     result = _mm_add_epi32(_mm_mullo_epi32(dx, dx), dsy); \
+ }
+
+ __attribute__((target("avx2")))
+ inline __m256d squareDiff(__m128i v, __m256d mean) {
+	 __m256d d = _mm256_sub_pd(_mm256_cvtepi32_pd(v), mean);
+	 return _mm256_mul_pd(d, d);
+ }
+
+ __attribute__((target("sse4.1")))
+ inline __m128d squareDiff(__m128i v, __m128d mean) {
+	 __m128d d = _mm_sub_pd(_mm_cvtepi32_pd(v), mean);
+	 return _mm_mul_pd(d, d);
+ }
+
+ __attribute__((target("avx2")))
+ void colorRowAvx2(const uint8_t *row, int x0, int n, const double mean[3], int cx, int dy, int stiffness, int step, double *out) {
+	 const __m256d ml = _mm256_set1_pd(mean[0]), ma = _mm256_set1_pd(mean[1]), mb = _mm256_set1_pd(mean[2]);
+	 const __m128i cxv = _mm_set1_epi32(cx), dsy = _mm_set1_epi32(dy * dy);
+	 const __m256d stiff = _mm256_set1_pd(stiffness), step2 = _mm256_set1_pd(step * step);
+	 int i = 0;
+	 for (; i + 4 <= n; i += 4) {
+		 RSLIC_LOAD_LAB(row + 3 * (x0 + i), l, a, b)
+		 RSLIC_SPATIAL_DS(x0 + i, cxv, dsy, ds)
+		 __m256d dc = _mm256_add_pd(_mm256_add_pd(squareDiff(l, ml), squareDiff(a, ma)), squareDiff(b, mb));
+		 __m256d res = _mm256_add_pd(_mm256_div_pd(dc, stiff), _mm256_div_pd(_mm256_cvtepi32_pd(ds), step2));
+		 _mm256_storeu_pd(out + i, res);
+	 }
+	 colorRowScalar(row, x0 + i, n - i, mean, cx, dy, stiffness, step, out + i);
+ }
+
+ __attribute__((target("sse4.1")))
+ void colorRowSse41(const uint8_t *row, int x0, int n, const double mean[3], int cx, int dy, int stiffness, int step, double *out) {
+	 const __m128d ml = _mm_set1_pd(mean[0]), ma = _mm_set1_pd(mean[1]), mb = _mm_set1_pd(mean[2]);
+	 const __m128i cxv = _mm_set1_epi32(cx), dsy = _mm_set1_epi32(dy * dy);
+	 const __m128d stiff = _mm_set1_pd(stiffness), step2 = _mm_set1_pd(step * step);
+	 int i = 0;
+	 for (; i + 4 <= n; i += 4) {
+		 RSLIC_LOAD_LAB(row + 3 * (x0 + i), l, a, b)
+		 RSLIC_SPATIAL_DS(x0 + i, cxv, dsy, ds)
+		 for (int half = 0; half < 2; half++) {
+			 __m128d dc = _mm_add_pd(_mm_add_pd(squareDiff(l, ml), squareDiff(a, ma)), squareDiff(b, mb));
+			 __m128d res = _mm_add_pd(_mm_div_pd(dc, stiff), _mm_div_pd(_mm_cvtepi32_pd(ds), step2));
+			 _mm_storeu_pd(out + i + 2 * half, res);
+			 l = _mm_srli_si128(l, 8);
+			 a = _mm_srli_si128(a, 8);
+			 b = _mm_srli_si128(b, 8);
+			 ds = _mm_srli_si128(ds, 8);
+		 }
+	 }
+	 colorRowScalar(row, x0 + i, n - i, mean, cx, dy, stiffness, step, out + i);
+ }
+
+ __attribute__((target("avx2")))
+ void grayRowAvx2(const uint8_t *row, int x0, int n, double mean, int cx, int dy, int stiffness, int step, double *out) {
+	 const __m256d m = _mm256_set1_pd(mean);
+	 const __m128i cxv = _mm_set1_epi32(cx), dsy = _mm_set1_epi32(dy * dy);
+	 const __m256d stiff = _mm256_set1_pd(stiffness), step2 = _mm256_set1_pd(step * step);
+	 int i = 0;
+	 for (; i + 4 <= n; i += 4) {
+		 RSLIC_LOAD_GRAY(row + x0 + i, g)
+		 RSLIC_SPATIAL_DS(x0 + i, cxv, dsy, ds)
+		 __m256d res = _mm256_add_pd(_mm256_div_pd(squareDiff(g, m), stiff), _mm256_div_pd(_mm256_cvtepi32_pd(ds), step2));
+		 _mm256_storeu_pd(out + i, res);
+	 }
+	 grayRowScalar(row, x0 + i, n - i, mean, cx, dy, stiffness, step, out + i);
+ }
+
+ __attribute__((target("sse4.1")))
+ void grayRowSse41(const uint8_t *row, int x0, int n, double mean, int cx, int dy, int stiffness, int step, double *out) {
+	 const __m128d m = _mm_set1_pd(mean);
+	 const __m128i cxv = _mm_set1_epi32(cx), dsy = _mm_set1_epi32(dy * dy);
+	 const __m128d stiff = _mm_set1_pd(stiffness), step2 = _mm_set1_pd(step * step);
+	 int i = 0;
+	 for (; i + 4 <= n; i += 4) {
+		 RSLIC_LOAD_GRAY(row + x0 + i, g)
+		 RSLIC_SPATIAL_DS(x0 + i, cxv, dsy, ds)
+		 for (int half = 0; half < 2; half++) {
+			 __m128d res = _mm_add_pd(_mm_div_pd(squareDiff(g, m), stiff), _mm_div_pd(_mm_cvtepi32_pd(ds), step2));
+			 _mm_storeu_pd(out + i + 2 * half, res);
+			 g = _mm_srli_si128(g, 8);
+			 ds = _mm_srli_si128(ds, 8);
+		 }
+	 }
+	 grayRowScalar(row, x0 + i, n - i, mean, cx, dy, stiffness, step, out + i);
+ }
+
+ #undef RSLIC_SPATIAL_DS
+ #undef RSLIC_LOAD_GRAY
+ #undef RSLIC_LOAD_LAB
+ #undef RSLIC_DEINTERLEAVE_MASK
+#endif
+
+ enum class InstructionSet {
+	 Scalar, SSE41, AVX2
+ };
+
+ //Checks the CPU only once
+ InstructionSet detect() {
+#ifdef RSLIC_SIMD_X86
+	 static const InstructionSet set = __builtin_cpu_supports("avx2") ? InstructionSet::AVX2 :
+			 __builtin_cpu_supports("sse4.1") ? InstructionSet::SSE41 : InstructionSet::Scalar;
+	 return set;
+#else
+	 return InstructionSet::Scalar;
+#endif
+ }
+}
+
+void RSlic::priv::simd::colorRow(const uint8_t *row, int x0, int n, const double mean[3], int cx, int dy, int stiffness, int step, double *out) {
+	switch (detect()) {
+#ifdef RSLIC_SIMD_X86
+		case InstructionSet::AVX2:
+			return colorRowAvx2(row, x0, n, mean, cx, dy, stiffness, step, out);
+		case InstructionSet::SSE41:
+			return colorRowSse41(row, x0, n, mean, cx, dy, stiffness, step, out);
+#endif
+		default:
+			return colorRowScalar(row, x0, n, mean, cx, dy, stiffness, step, out);
+	}
+}
+
+void RSlic::priv::simd::grayRow(const uint8_t *row, int x0, int n, double mean, int cx, int dy, int stiffness, int step, double *out) {
+	switch (detect()) {
+#ifdef RSLIC_SIMD_X86
+		case InstructionSet::AVX2:
+			return grayRowAvx2(row, x0, n, mean, cx, dy, stiffness, step, out);
+		case InstructionSet::SSE41:
+			return grayRowSse41(row, x0, n, mean, cx, dy, stiffness, step, out);
+#endif
+		default:
+			return grayRowScalar(row, x0, n, mean, cx, dy, stiffness, step, out);
+	}
+}
+
+const char *RSlic::priv::simd::instructionSet() {
+	switch (detect()) {
+		case InstructionSet::AVX2:
+			return "avx2";
+		case InstructionSet::SSE41:
+			return "sse4.1";
+		default:
+			return "scalar";
+	}
+}
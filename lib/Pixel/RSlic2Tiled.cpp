@@ -0,0 +1,268 @@
+#include "RSlic2Tiled.h"
+#include "RSlic2Engine.h"
+#include "RSlic2Util.h"
+#include "RSlic2_impl.h"
+#include <ThreadPool.h>
+#include <set>
+#include <tuple>
+
+using namespace RSlic::Pixel;
+
+namespace {
+ template<typename F>
+ void iterateTile(Slic2EngineT<int32_t> &engine, int iterations, bool slico) {
+	 F f;
+	 RSlic::Pixel::iterateUntil(engine, f, 0, iterations, slico);
+ }
+
+ bool inside(const Rect &r, const Size &size) {
+	 return r.x >= 0 && r.y >= 0 && r.width >= 0 && r.height >= 0 && r.x + r.width <= size.width && r.y + r.height <= size.height;
+ }
+}
+
+RSlic::Pixel::SimpleRaster::SimpleRaster(const Mat &mat) : mat(mat) {
+}
+
+Size RSlic::Pixel::SimpleRaster::size() const {
+	return mat.size();
+}
+
+int RSlic::Pixel::SimpleRaster::type() const {
+	return mat.type();
+}
+
+Mat RSlic::Pixel::SimpleRaster::read(const Rect &r) const {
+	if (!inside(r, mat.size())) return Mat();
+	return mat(r).clone();
+}
+
+bool RSlic::Pixel::SimpleRaster::write(const Rect &r, const Mat &m) {
+	if (!inside(r, mat.size()) || m.size() != r.size() || m.type() != mat.type()) return false;
+	Mat part = mat(r);
+	m.copyTo(part);
+	return true;
+}
+
+const Mat &RSlic::Pixel::SimpleRaster::getMat() const {
+	return mat;
+}
+
+RSlic::Pixel::RawRaster::RawRaster(const Size &size, int type) : rasterSize(size), rasterType(type) {
+}
+
+shared_ptr<RawRaster> RSlic::Pixel::RawRaster::open(const std::string &filename, const Size &size, int type) {
+	shared_ptr<RawRaster> res(new RawRaster(size, type));
+	res->file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+	if (!res->file.is_open()) res->file.open(filename, std::ios::in | std::ios::binary); // read only
+	if (!res->file.is_open()) return nullptr;
+	res->file.seekg(0, std::ios::end);
+	if (res->file.tellg() < res->offset(0, size.height)) return nullptr;
+	return res;
+}
+
+shared_ptr<RawRaster> RSlic::Pixel::RawRaster::create(const std::string &filename, const Size &size, int type) {
+	shared_ptr<RawRaster> res(new RawRaster(size, type));
+	res->file.open(filename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!res->file.is_open()) return nullptr;
+	const std::streamoff bytes = res->offset(0, size.height);
+	if (bytes > 0) {
+		// only the last byte is written, the file system does not need to store the rest until it is written
+		res->file.seekp(bytes - 1);
+		res->file.put(0);
+	}
+	if (!res->file.flush()) return nullptr;
+	return res;
+}
+
+Size RSlic::Pixel::RawRaster::size() const {
+	return rasterSize;
+}
+
+int RSlic::Pixel::RawRaster::type() const {
+	return rasterType;
+}
+
+std::streamoff RSlic::Pixel::RawRaster::offset(int x, int y) const {
+	return (static_cast<std::streamoff>(y) * rasterSize.width + x) * CV_ELEM_SIZE(rasterType);
+}
+
+Mat RSlic::Pixel::RawRaster::read(const Rect &r) const {
+	if (!inside(r, rasterSize)) return Mat();
+	Mat res(r.size(), rasterType);
+	const std::streamsize bytes = static_cast<std::streamsize>(r.width) * CV_ELEM_SIZE(rasterType);
+	std::lock_guard<std::mutex> lock(mutex);
+	file.clear();
+	for (int y = 0; y < r.height; y++) {
+		file.seekg(offset(r.x, r.y + y));
+		if (!file.read(res.ptr<char>(y), bytes)) return Mat();
+	}
+	return res;
+}
+
+bool RSlic::Pixel::RawRaster::write(const Rect &r, const Mat &m) {
+	if (!inside(r, rasterSize) || m.size() != r.size() || m.type() != rasterType) return false;
+	const std::streamsize bytes = static_cast<std::streamsize>(r.width) * CV_ELEM_SIZE(rasterType);
+	std::lock_guard<std::mutex> lock(mutex);
+	file.clear();
+	for (int y = 0; y < r.height; y++) {
+		file.seekp(offset(r.x, r.y + y));
+		if (!file.write(m.ptr<char>(y), bytes)) return false;
+	}
+	return static_cast<bool>(file.flush());
+}
+
+RSlic::Pixel::Slic2Tiled::Slic2Tiled(int step, int stiffness, int tile, int iterations, bool slico, ThreadPoolP pool) :
+		step(std::max(1, step)), stiffness(stiffness), iterations(iterations), slico(slico), pool(pool) {
+	this->tile = std::max(tile, 4 * this->step);
+	overlap = 2 * this->step;
+	if (this->pool.get() == nullptr) this->pool = ThreadPool::defaultPool();
+}
+
+bool RSlic::Pixel::Slic2Tiled::process(const Raster &img, Raster &labels) {
+	const Size size = img.size();
+	if ((img.type() != CV_8UC3 && img.type() != CV_8UC1) || labels.type() != CV_32SC1 || labels.size() != size) return false;
+	carried.clear();
+	nextLabel = 0;
+	for (int y = 0; y < size.height; y += tile) {
+		for (int x = 0; x < size.width; x += tile) {
+			if (!processTile(img, labels, Rect(x, y, std::min(tile, size.width - x), std::min(tile, size.height - y)))) return false;
+		}
+		// the next tiles start overlap rows above the next row, the clusters above can't reach them
+		for (auto it = carried.begin(); it != carried.end();) {
+			if (it->second[1] < y + tile - overlap) it = carried.erase(it);
+			else ++it;
+		}
+	}
+	return true;
+}
+
+int32_t RSlic::Pixel::Slic2Tiled::labelCount() const {
+	return nextLabel;
+}
+
+int RSlic::Pixel::Slic2Tiled::getTile() const {
+	return tile;
+}
+
+int RSlic::Pixel::Slic2Tiled::getOverlap() const {
+	return overlap;
+}
+
+bool RSlic::Pixel::Slic2Tiled::processTile(const Raster &img, Raster &labels, const Rect &core) {
+	const Size size = img.size();
+	const Rect outer = Rect(core.x - overlap, core.y - overlap, core.width + 2 * overlap, core.height + 2 * overlap) & Rect(0, 0, size.width, size.height);
+	const Mat part = img.read(outer);
+	if (part.empty()) return false;
+
+	// the clusters of the processed tiles (they keep their labels) and new ones on the grid of the whole picture
+	vector<Vec2i> seeds;
+	vector<int32_t> seedLabels;
+	std::set<std::pair<int, int>> taken; // grid points with a cluster on them
+	const int s = step;
+	for (const auto &c: carried) {
+		if (!outer.contains(Point(c.second[0], c.second[1]))) continue;
+		seeds.push_back(c.second - Vec2i(outer.x, outer.y));
+		seedLabels.push_back(c.first);
+		const int ix = (c.second[0] - s + s / 2) / s;
+		const int iy = (c.second[1] - s + s / 2) / s;
+		taken.insert(std::make_pair(ix, iy));
+	}
+	for (int ix = std::max(0, (outer.x - 1) / s); s + ix * s < std::min(outer.x + outer.width, size.width - s / 2); ix++) {
+		const int x = s + ix * s;
+		if (x < outer.x) continue;
+		for (int iy = std::max(0, (outer.y - 1) / s); s + iy * s < std::min(outer.y + outer.height, size.height - s / 2); iy++) {
+			const int y = s + iy * s;
+			if (y < outer.y || taken.count(std::make_pair(ix, iy)) > 0) continue;
+			if (y < core.y || (x < core.x && y < core.y + core.height)) continue; // written already, the carried clusters cover it
+			seeds.emplace_back(x - outer.x, y - outer.y);
+		}
+	}
+
+	Slic2TP<int32_t> slic;
+	if (!seeds.empty()) slic = Slic2T<int32_t>::initialize(part, buildGrad(part), s, stiffness, seeds, pool);
+	if (slic.get() == nullptr) {
+		// too small, nothing to cluster
+		return labels.write(core, Mat_<int32_t>(core.size(), -1));
+	}
+	Slic2EngineT<int32_t> engine(*slic);
+	slic.reset();
+	if (part.type() == CV_8UC3) iterateTile<distanceColor>(engine, iterations, slico);
+	else iterateTile<distanceGray>(engine, iterations, slico);
+	const Mat_<int32_t> &label = engine.getClusters().getClusterLabel();
+	const vector<Vec2i> &centers = engine.getClusters().getCenters();
+	const int count = engine.getClusters().clusterCount();
+
+	// a cluster goes on with the label it overlaps most in the labels already written (the tiles above and the one to the left),
+	// if that is most of it there (the clusters move while iterating, so the carried ones are not always the same superpixels as before)
+	vector<long> writtenPixels(count, 0);
+	std::map<std::pair<int32_t, int32_t>, long> overlapping; // (cluster, written label) -> pixels
+	for (const Rect &r: {Rect(outer.x, outer.y, outer.width, core.y - outer.y), Rect(outer.x, core.y, core.x - outer.x, core.height)}) {
+		if (r.area() == 0) continue;
+		const Mat old = labels.read(r);
+		if (old.empty()) return false;
+		for (int y = 0; y < r.height; y++) {
+			const int32_t *oldRow = old.ptr<int32_t>(y);
+			const int32_t *row = label.ptr<int32_t>(r.y - outer.y + y) + (r.x - outer.x);
+			for (int x = 0; x < r.width; x++) {
+				const int32_t k = row[x];
+				if (k < 0) continue;
+				writtenPixels[k]++;
+				if (oldRow[x] >= 0) overlapping[std::make_pair(k, oldRow[x])]++;
+			}
+		}
+	}
+	vector<std::tuple<long, int32_t, int32_t>> matches; // (pixels, cluster, label)
+	for (const auto &o: overlapping) {
+		if (2 * o.second > writtenPixels[o.first.first]) matches.emplace_back(o.second, o.first.first, o.first.second);
+	}
+	std::sort(matches.begin(), matches.end(), std::greater<std::tuple<long, int32_t, int32_t>>());
+	vector<int32_t> tileLabels(count, -1);
+	std::set<int32_t> used;
+	for (const auto &m: matches) {
+		const int32_t k = std::get<1>(m);
+		const int32_t l = std::get<2>(m);
+		if (tileLabels[k] >= 0 || used.count(l) > 0) continue;
+		tileLabels[k] = l;
+		used.insert(l);
+	}
+	// the others keep their label if it is free, new clusters get a new one when they are written
+	for (int k = 0; k < static_cast<int>(seedLabels.size()); k++) {
+		if (tileLabels[k] < 0 && used.count(seedLabels[k]) == 0) {
+			tileLabels[k] = seedLabels[k];
+			used.insert(seedLabels[k]);
+		}
+		carried.erase(seedLabels[k]);
+	}
+
+	Mat_<int32_t> out(core.size());
+	vector<long> pixels(count, 0);
+	for (int y = 0; y < outer.height; y++) {
+		const int32_t *row = label.ptr<int32_t>(y);
+		for (int x = 0; x < outer.width; x++) {
+			if (row[x] >= 0) pixels[row[x]]++;
+		}
+	}
+	for (int y = 0; y < core.height; y++) {
+		const int32_t *row = label.ptr<int32_t>(core.y - outer.y + y) + (core.x - outer.x);
+		int32_t *outRow = out.ptr<int32_t>(y);
+		for (int x = 0; x < core.width; x++) {
+			const int32_t k = row[x];
+			if (k >= 0 && tileLabels[k] < 0) tileLabels[k] = nextLabel++;
+			outRow[x] = k < 0 ? -1 : tileLabels[k];
+		}
+	}
+	if (!labels.write(core, out)) return false;
+
+	// the clusters of this tile and the ones that went on here reach into the next tiles (if they are not too small, like in finalize)
+	const long lims = static_cast<long>(s) * s;
+	for (int k = 0; k < count; k++) {
+		if (centers[k][0] < 0 || pixels[k] <= lims >> 2) continue;
+		const Vec2i center = centers[k] + Vec2i(outer.x, outer.y);
+		if (tileLabels[k] < 0) {
+			if (!core.contains(Point(center[0], center[1]))) continue; // belongs to a tile that is not processed yet
+			tileLabels[k] = nextLabel++;
+		}
+		carried[tileLabels[k]] = center;
+	}
+	return true;
+}
@@ -0,0 +1,186 @@
+#ifndef RSlic2TILED_H
+#define RSlic2TILED_H
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include "RSlic2.h"
+
+namespace RSlic {
+ namespace Pixel {
+
+  /**
+  * A picture that is read and written in parts (e.g. a file on disk that does not fit into memory).
+  */
+  class Raster {
+  public:
+	  virtual ~Raster() {
+	  }
+
+	  /**
+	  * Returns the size of the whole picture
+	  */
+	  virtual Size size() const = 0;
+
+	  /**
+	  * Returns the OpenCV type of the pixels (e.g. CV_8UC3)
+	  */
+	  virtual int type() const = 0;
+
+	  /**
+	  * Reads a part of the picture
+	  * @param r the part (has to be inside the picture)
+	  * @return a copy of the part (empty Mat on error)
+	  */
+	  virtual Mat read(const Rect &r) const = 0;
+
+	  /**
+	  * Writes a part of the picture
+	  * @param r the part (has to be inside the picture)
+	  * @param m the pixels (of the size of r and the type of the raster)
+	  * @return false on error
+	  */
+	  virtual bool write(const Rect &r, const Mat &m) = 0;
+  };
+
+  using RasterP = shared_ptr<Raster>;
+
+  /**
+  * Raster that keeps the whole picture in a Mat.
+  */
+  class SimpleRaster : public Raster {
+  public:
+	  /**
+	  * @param mat the picture (shared, not copied)
+	  */
+	  SimpleRaster(const Mat &mat);
+
+	  virtual Size size() const override;
+
+	  virtual int type() const override;
+
+	  virtual Mat read(const Rect &r) const override;
+
+	  virtual bool write(const Rect &r, const Mat &m) override;
+
+	  /**
+	  * Returns the picture
+	  */
+	  const Mat &getMat() const;
+
+  private:
+	  Mat mat;
+  };
+
+  /**
+  * Raster in a raw file: the rows one after another without any header, every pixel like in a Mat
+  * (e.g. BGR for CV_8UC3, host byte order for CV_32SC1). Only the rows of the requested parts are read or written.
+  */
+  class RawRaster : public Raster {
+  public:
+	  /**
+	  * Opens an existing file (for reading and, if allowed, writing)
+	  * @param filename the file
+	  * @param size the size of the picture
+	  * @param type the type of the pixels
+	  * @return the raster (nullptr if the file can't be opened or is too small)
+	  */
+	  static shared_ptr<RawRaster> open(const std::string &filename, const Size &size, int type);
+
+	  /**
+	  * Creates a file for a picture (an existing one is overwritten). The pixels are 0 until they are written.
+	  * @param filename the file
+	  * @param size the size of the picture
+	  * @param type the type of the pixels
+	  * @return the raster (nullptr if the file can't be created)
+	  */
+	  static shared_ptr<RawRaster> create(const std::string &filename, const Size &size, int type);
+
+	  RawRaster(const RawRaster &) = delete;
+
+	  RawRaster &operator=(const RawRaster &) = delete;
+
+	  virtual Size size() const override;
+
+	  virtual int type() const override;
+
+	  virtual Mat read(const Rect &r) const override;
+
+	  virtual bool write(const Rect &r, const Mat &m) override;
+
+  private:
+	  RawRaster(const Size &size, int type);
+
+	  //Position of the pixel (x, y) in the file
+	  std::streamoff offset(int x, int y) const;
+
+	  Size rasterSize;
+	  int rasterType;
+	  mutable std::mutex mutex;
+	  mutable std::fstream file;
+  };
+
+  /**
+  * Superpixels for pictures larger than the memory (e.g. satellite mosaics).
+  * The picture is processed in tiles (read from a Raster, the labels are written to another one),
+  * so only a tile with its overlap (2 * step on every side) and its buffers are in memory at once.
+  * The tiles are processed row by row. Every tile starts with the clusters of the processed tiles that reach into it
+  * (where they ended) and new ones on the grid of the whole picture, so the clusters go on across the seams.
+  * A cluster keeps the label it overlaps most in the labels already written (if that is most of its pixels there),
+  * the others get a new one, so a label means the same superpixel in the whole picture.
+  * Only the core of a tile (without the overlap) is written. Like Slic3Stream the connectivity is not enforced.
+  */
+  class Slic2Tiled {
+  public:
+	  /**
+	  * @param step how many pixel should belongs (approximately) to a clusters (in every direction)
+	  * @param stiffness the stiffness value
+	  * @param tile the width and height of the tiles (at least 4 * step)
+	  * @param iterations how many iterations are done per tile (at most, see iterateUntil)
+	  * @param slico use Slico
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool())
+	  */
+	  Slic2Tiled(int step, int stiffness, int tile = 2048, int iterations = 10, bool slico = false, ThreadPoolP pool = ThreadPoolP());
+
+	  /**
+	  * Computes the superpixels of the whole picture. Unassigned pixels get the label -1.
+	  * @param img the picture (CV_8UC3 or CV_8UC1)
+	  * @param labels where the labels are written to (CV_32SC1, of the size of img)
+	  * @return false on error (wrong types or sizes, reading or writing failed)
+	  */
+	  bool process(const Raster &img, Raster &labels);
+
+	  /**
+	  * Returns how many labels have been used by the last process (the labels are 0 to labelCount() - 1)
+	  * @return amount of labels
+	  */
+	  int32_t labelCount() const;
+
+	  /**
+	  * Returns the size of the tiles
+	  */
+	  int getTile() const;
+
+	  /**
+	  * Returns how many pixel on every side of a tile are used as context
+	  */
+	  int getOverlap() const;
+
+  private:
+	  //Iterates on core with its overlap and writes the labels of core
+	  bool processTile(const Raster &img, Raster &labels, const Rect &core);
+
+	  int step;
+	  int stiffness;
+	  int tile;
+	  int overlap;
+	  int iterations;
+	  bool slico;
+	  ThreadPoolP pool;
+
+	  std::map<int32_t, Vec2i> carried; // label -> center (in the picture) of the clusters that may reach into the next tiles
+	  int32_t nextLabel = 0;
+  };
+ }
+}
+#endif // RSlic2TILED_H
@@ -72,6 +72,26 @@ string RSlic::Pixel::getType(const Mat &m) {
 }
 
 
+namespace {
+ // Mean of all channels as CV_32FC1 (e.g. 16 bit color or the bands of a multispectral picture)
+ Mat meanOfChannels(const Mat &mat) {
+	 const int cn = mat.channels();
+	 Mat channels;
+	 mat.convertTo(channels, CV_MAKETYPE(CV_32F, cn));
+	 Mat res(mat.rows, mat.cols, CV_32FC1);
+	 for (int y = 0; y < mat.rows; y++) {
+		 const float *in = channels.ptr<float>(y);
+		 float *out = res.ptr<float>(y);
+		 for (int x = 0; x < mat.cols; x++, in += cn) {
+			 float sum = 0;
+			 for (int c = 0; c < cn; c++) sum += in[c];
+			 out[x] = sum / cn;
+		 }
+	 }
+	 return res;
+ }
+}
+
 Mat RSlic::Pixel::buildGrad(const Mat &mat) {
 	cv::Mat dx, dy, res;
 	cv::Mat mat_gray;
@@ -83,7 +103,7 @@ Mat RSlic::Pixel::buildGrad(const Mat &mat) {
 			cv::cvtColor(mat, mat_gray, cv::COLOR_BGRA2GRAY);
 			break;
 		default:
-			mat_gray = mat;
+			mat_gray = mat.channels() == 1 ? mat : meanOfChannels(mat);
 	}
 	mat_gray.convertTo(mat_gray, CV_32FC1);
 	cv::Sobel(mat_gray, dx, -1, 1, 0);
@@ -94,36 +114,199 @@ Mat RSlic::Pixel::buildGrad(const Mat &mat) {
 	return res;
 }
 
-template <typename F>
-static RSlic::Pixel::Slic2P shutUpAndTakeMyMoneyType(const Mat &m, int step, int stiffness, bool slico, int iterations) {
-    F f;
-    Mat grad = RSlic::Pixel::buildGrad(m);
-    auto res = RSlic::Pixel::Slic2::initialize(m,grad,step, stiffness);
-    if (res.get() == nullptr) return res; //error
-    for (int i=0; i< iterations; i++){
-        if (slico) res = res->iterateZero<F>(f);
-        else res = res->iterate<F>(f);
-    }
-    res = res->finalize<F>(f);
-    return res;
+double RSlic::Pixel::colorRange(const Mat &m) {
+	if (m.depth() == CV_8U || m.depth() == CV_8S) return 255;
+	if (m.empty()) return 1;
+	double lo, hi;
+	cv::minMaxLoc(m.reshape(1), &lo, &hi);
+	return hi > lo ? hi - lo : 1;
+}
+
+namespace {
+ template<typename Label>
+ struct ShutUpAndTakeMyMoneyRun {
+	 const Mat &m;
+	 int step, stiffness;
+	 bool slico;
+	 int iterations;
+
+	 template<typename F>
+	 RSlic::Pixel::Slic2TP<Label> operator()(F f) const {
+		 Mat grad = RSlic::Pixel::buildGrad(m);
+		 auto engine = RSlic::Pixel::Slic2EngineT<Label>::initialize(m, grad, step, stiffness);
+		 if (engine.get() == nullptr) return RSlic::Pixel::Slic2TP<Label>(); //error
+		 RSlic::Pixel::iterateUntil(*engine, f, 0, iterations, slico);
+		 return engine->snapshot()->template finalize<F>(f);
+	 }
+ };
 }
 
 
 RSlic::Pixel::Slic2P  RSlic::Pixel::shutUpAndTakeMyMoney(const Mat &m, int count, int stiffness, bool slico, int iterations) {
+	return shutUpAndTakeMyMoney<ClusterInt>(m, count, stiffness, slico, iterations);
+}
+
+template<typename Label>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::shutUpAndTakeMyMoney(const Mat &m, int count, int stiffness, bool slico, int iterations) {
 	int w = m.cols;
 	int h = m.rows;
 	int step = sqrt(w * h * 1.0 / count);
 
-    if (m.type() == CV_8UC3) {
-        return shutUpAndTakeMyMoneyType<distanceColor>(m,step, stiffness,slico,iterations);
-    }
-    if (m.type() == CV_8UC4) {
-		Mat other;
-		cv::cvtColor(m, other, cv::COLOR_BGRA2BGR);
-        return shutUpAndTakeMyMoneyType<distanceColor>(other,step, stiffness,slico,iterations);
-	}//TODO: More Types
-	if (m.type() == CV_8UC1) {
-    	return shutUpAndTakeMyMoneyType<distanceGray>(m,step, stiffness,slico,iterations);
+	return withMetric(m, ShutUpAndTakeMyMoneyRun<Label>{m, step, stiffness, slico, iterations});
+}
+
+template RSlic::Pixel::Slic2TP<int16_t> RSlic::Pixel::shutUpAndTakeMyMoney<int16_t>(const Mat &m, int count, int stiffness, bool slico, int iterations);
+template RSlic::Pixel::Slic2TP<int32_t> RSlic::Pixel::shutUpAndTakeMyMoney<int32_t>(const Mat &m, int count, int stiffness, bool slico, int iterations);
+
+template<typename Label>
+RSlic::Pixel::ClusterSetT<Label> RSlic::Pixel::projectClusters(const ClusterSetT<Label> &clusters, const Size &size) {
+	const Mat_<Label> &label = clusters.getClusterLabel();
+	const double fx = size.width * 1.0 / label.cols;
+	const double fy = size.height * 1.0 / label.rows;
+	vector<Vec2i> centers;
+	centers.reserve(clusters.clusterCount());
+	for (const Vec2i &c: clusters.getCenters()) {
+		if (c[0] < 0 || c[1] < 0) centers.push_back(c); // no pixel
+		else centers.push_back(Vec2i(std::min(size.width - 1, static_cast<int>((c[0] + 0.5) * fx)), std::min(size.height - 1, static_cast<int>((c[1] + 0.5) * fy))));
 	}
-	return nullptr;
+	Mat_<Label> projected;
+	cv::resize(label, projected, size, 0, 0, cv::INTER_NEAREST);
+	return ClusterSetT<Label>(std::move(centers), projected);
+}
+
+namespace {
+ template<typename Label>
+ struct CoarseToFineRun {
+	 const Mat &m;
+	 int step, stiffness;
+	 bool slico;
+	 int levels, coarseIterations, refineIterations;
+	 ThreadPoolP pool;
+
+	 template<typename F>
+	 RSlic::Pixel::Slic2TP<Label> operator()(F f) const {
+		 // pyramid[0] is the picture itself
+		 vector<Mat> pyramid(1, m);
+		 while (static_cast<int>(pyramid.size()) <= levels && (step >> pyramid.size()) >= 4) {
+			 Mat down;
+			 cv::pyrDown(pyramid.back(), down);
+			 pyramid.push_back(down);
+		 }
+		 int level = pyramid.size() - 1;
+		 auto engine = RSlic::Pixel::Slic2EngineT<Label>::initialize(pyramid[level], RSlic::Pixel::buildGrad(pyramid[level]), step >> level, stiffness, pool);
+		 if (engine.get() == nullptr) return RSlic::Pixel::Slic2TP<Label>(); //error
+		 RSlic::Pixel::iterateUntil(*engine, f, 0, coarseIterations, slico);
+		 while (level > 0) {
+			 level--;
+			 auto slic = RSlic::Pixel::Slic2T<Label>::initialize(pyramid[level], *engine->snapshot(), step >> level);
+			 if (slic.get() == nullptr) return RSlic::Pixel::Slic2TP<Label>();
+			 engine.reset(new RSlic::Pixel::Slic2EngineT<Label>(*slic));
+			 RSlic::Pixel::iterateUntil(*engine, f, 0, refineIterations, slico);
+		 }
+		 return engine->snapshot()->template finalize<F>(f);
+	 }
+ };
 }
+
+RSlic::Pixel::Slic2P RSlic::Pixel::coarseToFine(const Mat &m, int count, int stiffness, bool slico, int levels, int coarseIterations, int refineIterations, ThreadPoolP pool) {
+	return coarseToFine<ClusterInt>(m, count, stiffness, slico, levels, coarseIterations, refineIterations, pool);
+}
+
+template<typename Label>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::coarseToFine(const Mat &m, int count, int stiffness, bool slico, int levels, int coarseIterations, int refineIterations, ThreadPoolP pool) {
+	int step = sqrt(m.cols * m.rows * 1.0 / count);
+	return withMetric(m, CoarseToFineRun<Label>{m, step, stiffness, slico, levels, coarseIterations, refineIterations, pool});
+}
+
+namespace {
+ // Clusters of the previous frame for the next one. Where new content comes into the picture, the centers move away from the border
+ // with the old content and the clusters left there grow up to the size of their window. So every cell of the grid without
+ // a center within 3/4 step gets a new one. The new ones take the numbers of the clusters that nearly vanished (their content left the picture)
+ // first, so the count stays about the same and the other clusters keep their numbers.
+ // Returns false if nothing has to be added.
+ template<typename Label>
+ bool refillClusters(const RSlic::Pixel::ClusterSetT<Label> &clusters, int step, RSlic::Pixel::ClusterSetT<Label> &res) {
+	 const Mat_<Label> label = clusters.getClusterLabel();
+	 const int w = label.cols;
+	 const int h = label.rows;
+	 const int gw = (w + step - 1) / step;
+	 const int gh = (h + step - 1) / step;
+	 auto middle = [&](int gx, int gy) {
+		 return Vec2i(std::min(w - 1, gx * step + step / 2), std::min(h - 1, gy * step + step / 2));
+	 };
+	 const int radius = step * 3 / 4;
+	 vector<uint8_t> covered(gw * gh, 0);
+	 for (const Vec2i &c: clusters.getCenters()) {
+		 for (int gy = std::max(0, c[1] / step - 1); gy <= std::min(gh - 1, c[1] / step + 1); gy++) {
+			 for (int gx = std::max(0, c[0] / step - 1); gx <= std::min(gw - 1, c[0] / step + 1); gx++) {
+				 const Vec2i m = middle(gx, gy);
+				 if (std::abs(m[0] - c[0]) <= radius && std::abs(m[1] - c[1]) <= radius) covered[gy * gw + gx] = 1;
+			 }
+		 }
+	 }
+	 vector<Vec2i> seeds;
+	 for (int gy = 0; gy < gh; gy++) {
+		 for (int gx = 0; gx < gw; gx++) {
+			 if (!covered[gy * gw + gx]) seeds.push_back(middle(gx, gy));
+		 }
+	 }
+	 if (seeds.empty()) return false;
+
+	 const RSlic::PixelIndex &index = clusters.pixelIndex();
+	 vector<int> vanished;
+	 for (int k = 0; k < clusters.clusterCount(); k++) {
+		 if (index.size(k) < step * step / 4) vanished.push_back(k);
+	 }
+	 vector<Vec2i> centers = clusters.getCenters();
+	 Mat_<Label> newLabel = label.clone();
+	 for (size_t i = 0; i < seeds.size(); i++) {
+		 if (i >= vanished.size()) {
+			 centers.push_back(seeds[i]);
+			 continue;
+		 }
+		 const int k = vanished[i];
+		 centers[k] = seeds[i];
+		 // the old pixels must not count for the mean color of the new cluster
+		 for (const int32_t *it = index.begin(k); it != index.end(k); ++it) newLabel(*it / w, *it % w) = -1;
+	 }
+	 res = RSlic::Pixel::ClusterSetT<Label>(std::move(centers), newLabel);
+	 return true;
+ }
+
+ template<typename Label>
+ struct NextFrameRun {
+	 const Mat &frame;
+	 const RSlic::Pixel::Slic2T<Label> &previous;
+	 bool slico;
+	 int maxIterations;
+	 double threshold;
+	 int *iterations;
+
+	 template<typename F>
+	 RSlic::Pixel::Slic2TP<Label> operator()(F f) const {
+		 const RSlic::Pixel::ClusterSetT<Label> &last = previous.getClusters();
+		 RSlic::Pixel::ClusterSetT<Label> clusters = last.getClusterLabel().size() == frame.size() ? last : RSlic::Pixel::projectClusters(last, frame.size());
+		 RSlic::Pixel::ClusterSetT<Label> refilled;
+		 if (refillClusters(clusters, previous.getStep(), refilled)) clusters = std::move(refilled);
+		 // the Slico maxima would only grow from frame to frame
+		 auto slic = RSlic::Pixel::Slic2T<Label>::initialize(frame, previous, std::move(clusters), 0, false);
+		 if (slic.get() == nullptr) return RSlic::Pixel::Slic2TP<Label>(); //error
+		 RSlic::Pixel::Slic2EngineT<Label> engine(*slic);
+		 const int done = RSlic::Pixel::iterateUntil(engine, f, threshold, maxIterations, slico);
+		 if (iterations != nullptr) *iterations = done;
+		 return engine.snapshot();
+	 }
+ };
+}
+
+template<typename Label>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::nextFrame(const Mat &frame, const Slic2T<Label> &previous, bool slico, int maxIterations, double threshold, int *iterations) {
+	return withMetric(frame, NextFrameRun<Label>{frame, previous, slico, maxIterations, threshold, iterations});
+}
+
+template RSlic::Pixel::ClusterSetT<int16_t> RSlic::Pixel::projectClusters<int16_t>(const ClusterSetT<int16_t> &clusters, const Size &size);
+template RSlic::Pixel::ClusterSetT<int32_t> RSlic::Pixel::projectClusters<int32_t>(const ClusterSetT<int32_t> &clusters, const Size &size);
+template RSlic::Pixel::Slic2TP<int16_t> RSlic::Pixel::coarseToFine<int16_t>(const Mat &m, int count, int stiffness, bool slico, int levels, int coarseIterations, int refineIterations, ThreadPoolP pool);
+template RSlic::Pixel::Slic2TP<int32_t> RSlic::Pixel::coarseToFine<int32_t>(const Mat &m, int count, int stiffness, bool slico, int levels, int coarseIterations, int refineIterations, ThreadPoolP pool);
+template RSlic::Pixel::Slic2TP<int16_t> RSlic::Pixel::nextFrame<int16_t>(const Mat &frame, const Slic2T<int16_t> &previous, bool slico, int maxIterations, double threshold, int *iterations);
+template RSlic::Pixel::Slic2TP<int32_t> RSlic::Pixel::nextFrame<int32_t>(const Mat &frame, const Slic2T<int32_t> &previous, bool slico, int maxIterations, double threshold, int *iterations);
@@ -3,6 +3,8 @@
 
 #include "RSlic2.h"
 #include "RSlic2_impl.h"
+#include "RSlic2Engine.h"
+#include <priv/Simd_p.h>
 
 /*
  * Helpful functions for Slic and OpenCV
@@ -46,6 +48,24 @@ namespace RSlic {
 		  return dc / stiffness + ds / (step * step);
 	  }
 
+	  /**
+	  * Same metric, but compares with the mean color of the cluster.
+	  */
+	  inline double operator()(const cv::Vec2i &point, const ClusterFeatures &features, int clusterIdx, const cv::Mat &mat, int stiffness, int step) {
+		  const int cx = features.x[clusterIdx], cy = features.y[clusterIdx];
+		  if (cy < 0 || cx < 0) {
+			  return DINF;
+		  }
+		  cv::Vec3b pixel = mat.at<cv::Vec3b>(point[1], point[0]);
+		  double dl = pixel[0] - features.mean[0][clusterIdx];
+		  double da = pixel[1] - features.mean[1][clusterIdx];
+		  double db = pixel[2] - features.mean[2][clusterIdx];
+		  int dx = point[0] - cx, dy = point[1] - cy;
+		  double dc = dl * dl + da * da + db * db;
+		  double ds = dx * dx + dy * dy;
+
+		  return dc / stiffness + ds / (step * step);
+	  }
   };
 
   /**
@@ -56,44 +76,355 @@ namespace RSlic {
 		  if (clusterCenter[1] < 0 || clusterCenter[0] < 0) {
 			  return DINF;
 		  }
-		  int8_t pixel = mat.at<uint8_t>(point[1], point[0]);
-		  int8_t clust_pixel = mat.at<uint8_t>(clusterCenter[1], clusterCenter[0]);
-		  double dc = abs(pixel - clust_pixel);
-		  double ds = sqrt(pow(point[0] - clusterCenter[0], 2) + pow(point[1] - clusterCenter[1], 2));
+		  int pixel = mat.at<uint8_t>(point[1], point[0]);
+		  int clust_pixel = mat.at<uint8_t>(clusterCenter[1], clusterCenter[0]);
+		  double dc = pow(pixel - clust_pixel, 2);
+		  double ds = pow(point[0] - clusterCenter[0], 2) + pow(point[1] - clusterCenter[1], 2);
+
+		  return dc / stiffness + ds / (step * step);
+	  }
+
+	  /**
+	  * Same metric, but compares with the mean gray value of the cluster.
+	  */
+	  inline double operator()(const cv::Vec2i &point, const ClusterFeatures &features, int clusterIdx, const cv::Mat &mat, int stiffness, int step) {
+		  const int cx = features.x[clusterIdx], cy = features.y[clusterIdx];
+		  if (cy < 0 || cx < 0) {
+			  return DINF;
+		  }
+		  double dc = mat.at<uint8_t>(point[1], point[0]) - features.mean[0][clusterIdx];
+		  int dx = point[0] - cx, dy = point[1] - cy;
+		  double ds = dx * dx + dy * dy;
+
+		  return dc * dc / stiffness + ds / (step * step);
+	  }
+  };
+
+  /**
+  * The metric of the paper for pictures of any type: T is the type of a pixel (e.g. uint16_t, cv::Vec3f or cv::Vec<uint16_t, 16>).
+  * With a scalar T the picture may have any amount of channels of that type (e.g. 16 bands of a remote sensing picture).
+  * The color distance is scaled to the range of 8 bit pictures, so the same stiffness works for every type.
+  */
+  template<typename T>
+  struct distanceT {
+	  using Channel = typename RSlic::priv::PixelType<T>::channel;
+
+	  /**
+	  * @param range the range of the values of the picture (e.g. 4095 for 12 bit, 1 for float pictures in [0, 1]), see colorRange
+	  */
+	  explicit distanceT(double range = 255) : colorFactor(255.0 * 255.0 / (range * range)) {
+	  }
+
+	  inline double operator()(const cv::Vec2i &point, const cv::Vec2i &clusterCenter, const cv::Mat &mat, double stiffness, int step) {
+		  if (clusterCenter[1] < 0 || clusterCenter[0] < 0) {
+			  return DINF;
+		  }
+		  const int cn = channels(mat);
+		  const Channel *pixel = mat.ptr<Channel>(point[1]) + point[0] * cn;
+		  const Channel *clust_pixel = mat.ptr<Channel>(clusterCenter[1]) + clusterCenter[0] * cn;
+		  double dc = 0;
+		  for (int c = 0; c < cn; c++) {
+			  const double d = static_cast<double>(pixel[c]) - clust_pixel[c];
+			  dc += d * d;
+		  }
+		  int dx = point[0] - clusterCenter[0], dy = point[1] - clusterCenter[1];
+		  double ds = dx * dx + dy * dy;
+
+		  return dc * colorFactor / stiffness + ds / (step * step);
+	  }
+
+	  /**
+	  * Same metric, but compares with the mean color of the cluster.
+	  */
+	  inline double operator()(const cv::Vec2i &point, const ClusterFeatures &features, int clusterIdx, const cv::Mat &mat, double stiffness, int step) {
+		  const int cx = features.x[clusterIdx], cy = features.y[clusterIdx];
+		  if (cy < 0 || cx < 0) {
+			  return DINF;
+		  }
+		  const int cn = channels(mat);
+		  const Channel *pixel = mat.ptr<Channel>(point[1]) + point[0] * cn;
+		  double dc = 0;
+		  for (int c = 0; c < cn; c++) {
+			  const double d = pixel[c] - features.mean[c][clusterIdx];
+			  dc += d * d;
+		  }
+		  int dx = point[0] - cx, dy = point[1] - cy;
+		  double ds = dx * dx + dy * dy;
+
+		  return dc * colorFactor / stiffness + ds / (step * step);
+	  }
 
-		  return pow(dc, 2) / stiffness + pow(ds / step, 2);
+	  //Amount of channels of a pixel (known at compile time for cv::Vec)
+	  static inline int channels(const cv::Mat &mat) {
+		  return RSlic::priv::PixelType<T>::channels > 0 ? RSlic::priv::PixelType<T>::channels : mat.channels();
 	  }
+
+	  double colorFactor; // (255 / range)^2
   };
 
+  /**
+  * Returns the range of the values of the picture for distanceT: 255 for 8 bit pictures,
+  * otherwise the difference of the largest and the smallest value of all channels (e.g. about 4095 for 12 bit data in 16 bit).
+  * @param m the picture
+  * @return the range (1 if all values are the same)
+  */
+  double colorRange(const Mat &m);
+
+  namespace priv {
+   //Vectorized row kernel for distanceColor (Lab images)
+   template<>
+   struct RowKernel<distanceColor> {
+	   static inline bool apply(distanceColor &, const Mat &img, int y, int x0, int x1, const ClusterFeatures &features, int clusterIdx, double stiffness, int step, double *out) {
+		   if (img.type() != CV_8UC3) return false;
+		   const int cx = features.x[clusterIdx], cy = features.y[clusterIdx];
+		   if (cy < 0 || cx < 0) {
+			   std::fill(out, out + (x1 - x0), DINF);
+			   return true;
+		   }
+		   const double mean[3] = {features.mean[0][clusterIdx], features.mean[1][clusterIdx], features.mean[2][clusterIdx]};
+		   RSlic::priv::simd::colorRow(img.ptr<uint8_t>(y), x0, x1 - x0, mean, cx, y - cy, static_cast<int>(stiffness), step, out);
+		   return true;
+	   }
+   };
+
+   //Vectorized row kernel for distanceGray
+   template<>
+   struct RowKernel<distanceGray> {
+	   static inline bool apply(distanceGray &, const Mat &img, int y, int x0, int x1, const ClusterFeatures &features, int clusterIdx, double stiffness, int step, double *out) {
+		   if (img.type() != CV_8UC1) return false;
+		   const int cx = features.x[clusterIdx], cy = features.y[clusterIdx];
+		   if (cy < 0 || cx < 0) {
+			   std::fill(out, out + (x1 - x0), DINF);
+			   return true;
+		   }
+		   RSlic::priv::simd::grayRow(img.ptr<uint8_t>(y), x0, x1 - x0, features.mean[0][clusterIdx], cx, y - cy, static_cast<int>(stiffness), step, out);
+		   return true;
+	   }
+   };
+
+   //Row kernel for distanceT: the pixels are read in a row, the amount of channels is known at compile time for cv::Vec
+   template<typename T>
+   struct RowKernel<distanceT<T>> {
+	   static inline bool apply(distanceT<T> &f, const Mat &img, int y, int x0, int x1, const ClusterFeatures &features, int clusterIdx, double stiffness, int step, double *out) {
+		   using Channel = typename distanceT<T>::Channel;
+		   const int n = RSlic::priv::PixelType<T>::channels;
+		   if (img.depth() != cv::DataType<Channel>::depth || (n > 0 && img.channels() != n)) return false;
+		   const int cx = features.x[clusterIdx], cy = features.y[clusterIdx];
+		   if (cy < 0 || cx < 0) {
+			   std::fill(out, out + (x1 - x0), DINF);
+			   return true;
+		   }
+		   const int cn = distanceT<T>::channels(img);
+		   double mean[n > 0 ? n : CV_CN_MAX];
+		   for (int c = 0; c < cn; c++) mean[c] = features.mean[c][clusterIdx];
+		   const Channel *pixel = img.ptr<Channel>(y) + x0 * cn;
+		   const int dy = y - cy;
+		   for (int x = x0; x < x1; x++, pixel += cn) {
+			   double dc = 0;
+			   for (int c = 0; c < cn; c++) {
+				   const double d = pixel[c] - mean[c];
+				   dc += d * d;
+			   }
+			   int dx = x - cx;
+			   double ds = dx * dx + dy * dy;
+			   out[x - x0] = dc * f.colorFactor / stiffness + ds / (step * step);
+		   }
+		   return true;
+	   }
+   };
+  }
+
+  namespace priv {
+   //The metric for pixels of type T (1 to 4 channels, more are handled by runWithChannels)
+   template<typename T>
+   struct DefaultMetric {
+	   static inline distanceT<T> create(const Mat &m) {
+		   return distanceT<T>(colorRange(m));
+	   }
+   };
+
+   template<>
+   struct DefaultMetric<uint8_t> {
+	   static inline distanceGray create(const Mat &) {
+		   return distanceGray();
+	   }
+   };
+
+   template<>
+   struct DefaultMetric<cv::Vec3b> {
+	   static inline distanceColor create(const Mat &) {
+		   return distanceColor();
+	   }
+   };
+
+   template<typename T, typename Run>
+   inline auto runWithMetric(const Mat &m, Run &run) -> decltype(run(distanceGray())) {
+	   return run(DefaultMetric<T>::create(m));
+   }
+
+   declareCVF_T(runWithMetric, runWithMetricHelper, return {})
+
+   //More than 4 channels: S is the type of one channel
+   template<typename S, typename Run>
+   inline auto runWithChannels(const Mat &m, Run &run) -> decltype(run(distanceGray())) {
+	   return run(distanceT<S>(colorRange(m)));
+   }
+
+   declareCVF_D(runWithChannels, runWithChannelsHelper, return {})
+  }
+
+  /**
+  * Calls run with the metric for the type of the picture, every type gets its own instantiation:
+  * distanceGray for CV_8UC1, distanceColor for CV_8UC3 and distanceT (with colorRange) for all other types and amounts of channels.
+  * @param m the picture
+  * @param run functor with a template operator()(F f), that is called with the metric
+  * @return the result of run (empty if the depth is not supported)
+  */
+  template<typename Run>
+  inline auto withMetric(const Mat &m, Run run) -> decltype(run(distanceGray())) {
+	  if (m.channels() > 4) return priv::runWithChannelsHelper(m.depth(), m, run);
+	  return priv::runWithMetricHelper(m.type(), m, run);
+  }
+
   /**
   * Returns Slic2P without any "complicated" parameter.
   * @param m the picture
   * @param the amount of Superpixel (approximately)
   * @param slico use the slico version?
-  * @param iterations how many iterations
+  * @param iterations how many iterations (at most, it stops if nothing changes anymore)
   * @return instance of Slic2 (shared_ptr) where no iterating or something similar is needed. (error -> nullptr)
   */
   Slic2P shutUpAndTakeMyMoney(const Mat &m, int count = 400, int stiffness = 40, bool slico = false, int iterations = 10);
 
   /**
-  * Heelping for do an iteration by selecting the metrics autmaticly.
+  * Same as shutUpAndTakeMyMoney above, but with the label type Label (int16_t or int32_t).
+  * Use it with withClusterInt to select the label type based on count.
+  * @see shutUpAndTakeMyMoney
+  */
+  template<typename Label>
+  Slic2TP<Label> shutUpAndTakeMyMoney(const Mat &m, int count = 400, int stiffness = 40, bool slico = false, int iterations = 10);
+
+  /**
+  * Scales clusters to another picture size (e.g. from one level of a pyramid to the next one).
+  * The centers are scaled, the labels are resized with nearest neighbour.
+  * @param clusters the clusters
+  * @param size the new size
+  * @return the clusters for a picture of the given size
+  */
+  template<typename Label>
+  ClusterSetT<Label> projectClusters(const ClusterSetT<Label> &clusters, const Size &size);
+
+  /**
+  * Same as shutUpAndTakeMyMoney, but coarse-to-fine: the picture is halved levels times (cv::pyrDown),
+  * most iterations are done on the smallest picture and the clusters are projected up the pyramid (see Slic2T::initialize).
+  * Every larger picture (and at last the picture itself) gets only a few refining iterations.
+  * With two levels most of the work is done with 1/16 of the pixels.
+  * @param m the picture
+  * @param count the amount of Superpixel (approximately)
+  * @param stiffness the stiffness value
+  * @param slico use the slico version?
+  * @param levels how often the picture is halved (at most, the step on the smallest picture stays at least 4)
+  * @param coarseIterations how many iterations on the smallest picture (at most, it stops if nothing changes anymore)
+  * @param refineIterations how many iterations on every larger picture (at most)
+  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+  * @return instance of Slic2 (shared_ptr) where no iterating or something similar is needed. (error -> nullptr)
+  */
+  Slic2P coarseToFine(const Mat &m, int count = 400, int stiffness = 40, bool slico = false, int levels = 2, int coarseIterations = 10, int refineIterations = 2, ThreadPoolP pool = ThreadPoolP());
+
+  /**
+  * Same as coarseToFine above, but with the label type Label (int16_t or int32_t).
+  * @see coarseToFine
+  */
+  template<typename Label>
+  Slic2TP<Label> coarseToFine(const Mat &m, int count = 400, int stiffness = 40, bool slico = false, int levels = 2, int coarseIterations = 10, int refineIterations = 2, ThreadPoolP pool = ThreadPoolP());
+
+  /**
+  * Superpixels of the next frame of a video: starts with the clusters of the previous frame (see Slic2T::initialize)
+  * instead of the grid and without a gradient. Consecutive frames are nearly the same, so usually one or two iterations are enough.
+  * The result is not finalized, so its labels stay the same clusters from frame to frame; pass it as previous
+  * for the following frame and call finalize only for the output.
+  * @param frame the picture (any type, see withMetric)
+  * @param previous the clusters of the previous frame (e.g. shutUpAndTakeMyMoney for the first frame)
+  * @param slico use the slico version?
+  * @param maxIterations how many iterations (at most)
+  * @param threshold stop as soon as at most this fraction of the pixels got another label (see iterateUntil)
+  * @param iterations if not nullptr, the amount of done iterations will be stored there
+  * @return the iterated instance of Slic2 (shared_ptr). (error -> nullptr)
+  */
+  template<typename Label>
+  Slic2TP<Label> nextFrame(const Mat &frame, const Slic2T<Label> &previous, bool slico = false, int maxIterations = 2, double threshold = 0.01, int *iterations = nullptr);
+
+  namespace priv {
+   template<typename Label>
+   struct IterateRun {
+	   Slic2TP<Label> slic;
+	   bool slico;
+
+	   template<typename F>
+	   Slic2TP<Label> operator()(F f) const {
+		   if (slico) return slic->template iterateZero<F>(f);
+		   return slic->template iterate<F>(f);
+	   }
+   };
+  }
+
+  /**
+  * Heelping for do an iteration by selecting the metrics autmaticly (see withMetric).
   * @param slic the Slic2-Object to iterate
   * @param type the type of the image (img.type() in OpenCV)
   * @param slico using Slico
   * @return the result of slic->iterate or slic->iterateZero with the right metrics.
-  * (May nullptr if type is not supported or any other error occurs)
+  * (May nullptr if type is not the type of the image or any other error occurs)
+  */
+  template<typename Label>
+  inline Slic2TP<Label> iteratingHelper(Slic2TP<Label> slic, int type, bool slico = false) {
+	  const Mat img = slic->getImg();
+	  if (img.type() != type) return Slic2TP<Label>();
+	  return withMetric(img, priv::IterateRun<Label>{slic, slico});
+  }
+
+  /**
+  * Iterates until the clusters (nearly) don't change anymore.
+  * @param slic the Slic2-Object to iterate
+  * @param f the functor with the metrics for the iteration
+  * @param threshold stop as soon as at most this fraction of the pixels got another label (Residual::changed).
+  * With 0 it only stops if nothing changes anymore, so the result is the same as after maxIter iterations.
+  * Only the clusters that still change are assigned again (iterateActive with tolerance 0), the result is the same as with iterate.
+  * @param maxIter maximal amount of iterations
+  * @param slico use iterateZero instead of iterate
+  * @param iterations if not nullptr, the amount of done iterations will be stored there
+  * @return the last instance (slic itself if maxIter <= 0)
+  */
+  template<typename Label, typename F>
+  inline Slic2TP<Label> iterateUntil(Slic2TP<Label> slic, F f, double threshold, int maxIter, bool slico = false, int *iterations = nullptr) {
+	  int i = 0;
+	  while (i < maxIter) {
+		  slic = slico ? slic->template iterateZeroActive<F>(f) : slic->template iterateActive<F>(f);
+		  i++;
+		  if (slic->getResidual().changed <= threshold) break;
+	  }
+	  if (iterations != nullptr) *iterations = i;
+	  return slic;
+  }
+
+  /**
+  * Same as iterateUntil, but iterates the engine in place (no new buffers for every iteration).
+  * @param engine the engine to iterate
+  * @param f the functor with the metrics for the iteration
+  * @param threshold stop as soon as at most this fraction of the pixels got another label (Residual::changed).
+  * @param maxIter maximal amount of iterations
+  * @param slico use iterateZeroActive instead of iterateActive
+  * @return the amount of done iterations
   */
-  inline Slic2P iteratingHelper(Slic2P slic, int type, bool slico = false) {
-	  if (type == CV_8UC1) {
-		  distanceGray g;
-		  if (slico) return slic->iterateZero<distanceGray>(g);
-		  return slic->iterate<distanceGray>(g);
-	  } else if (type == CV_8UC3) {
-		  distanceColor c;
-		  if (slico) return slic->iterateZero<distanceColor>(c);
-		  return slic->iterate<distanceColor>(c);
+  template<typename Label, typename F>
+  inline int iterateUntil(Slic2EngineT<Label> &engine, F f, double threshold, int maxIter, bool slico = false) {
+	  int i = 0;
+	  while (i < maxIter) {
+		  const Residual &residual = slico ? engine.template iterateZeroActive<F>(f) : engine.template iterateActive<F>(f);
+		  i++;
+		  if (residual.changed <= threshold) break;
 	  }
-	  return Slic2P(); //unsupported type
+	  return i;
   }
  }
 }
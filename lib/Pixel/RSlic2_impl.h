@@ -2,9 +2,16 @@
 #define RSlic2_IMPL_H
 
 #include "RSlic2.h"
+#include "ClusterFeatures.h"
+#include "RSlic2Engine.h"
 #include <priv/ZeroSlico_p.h>
 #include <priv/Useful.h>
-#include <3rd/ThreadPool.h>
+#include <priv/Parallel_p.h>
+#include <priv/ActiveSet_p.h>
+#include <priv/Connectivity_p.h>
+#include <priv/Trace_p.h>
+#include <ThreadPool.h>
+#include <typeindex>
 
 #ifndef u_long
 #define u_long unsigned long
@@ -17,39 +24,171 @@ using namespace RSlic::Pixel;
 using RSlic::priv::aSize;
 
 //Settings that are shared over several instances.
-struct RSlic::Pixel::Slic2::Settings {
+template<typename Label>
+struct RSlic::Pixel::Slic2T<Label>::Settings {
 	Settings() : __refcount(0), step(0), stiffness(0) {
 	}
 
 	Settings(const Settings *other) :
 			__refcount(0), step(other->step),
-			img(other->img), stiffness(other->stiffness), pool(other->pool) {
+			img(other->img), stiffness(other->stiffness), pool(other->pool), tracer(other->tracer) {
 	}
 
+	// threadcount <= 0: the default pool (shared by everyone, so not every initialize starts threads)
 	void initThreadPool(int threadcount = -1) {
 		if (threadcount <= 0)
-			threadcount = std::thread::hardware_concurrency();
-		pool = std::make_shared<ThreadPool>(threadcount);
+			pool = ThreadPool::defaultPool();
+		else
+			pool = std::make_shared<ThreadPool>(threadcount);
 	}
 
 	Mat img;
 	int step;
 	int stiffness;
 	shared_ptr<ThreadPool> pool;
+	TracerP tracer; // may be empty
 
 	std::atomic<int> __refcount;
 };
 
 
+template<typename Label>
 template<typename F>
-RSlic::Pixel::Slic2P RSlic::Pixel::Slic2::iterate(F f) const {
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::iterate(F f) const {
 	return iterate<F>(setting->stiffness, f);
 }
 
+//The persistent API iterates with an engine that starts at this instance and keeps the result
+template<typename Label>
+template<typename F>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::iterate(int stiffness, F f) const {
+	Slic2EngineT<Label> engine(*this);
+	engine.template iterate<F>(stiffness, f);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::iterateActive(F f, double tolerance) const {
+	Slic2EngineT<Label> engine(*this);
+	engine.template iterateActive<F>(f, tolerance);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::iterateZero(F f) const {
+	Slic2EngineT<Label> engine(*this);
+	engine.template iterateZero<F>(f);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::iterateZeroActive(F f, double tolerance) const {
+	Slic2EngineT<Label> engine(*this);
+	engine.template iterateZeroActive<F>(f, tolerance);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterate(F f) {
+	return iterateNormal<F>(setting->stiffness, f, -1);
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterate(int stiffness, F f) {
+	return iterateNormal<F>(stiffness, f, -1);
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterateActive(F f, double tolerance) {
+	return iterateNormal<F>(setting->stiffness, f, std::max(0.0, tolerance));
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterateZero(F f) {
+	return iterateSlico<F>(f, -1);
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterateZeroActive(F f, double tolerance) {
+	return iterateSlico<F>(f, std::max(0.0, tolerance));
+}
+
 namespace RSlic {
  namespace Pixel {
   namespace priv {
 
+   /**
+   * Whether the metric F takes the features of the cluster instead of its center:
+   * double operator()(const Vec2i &point, const ClusterFeatures &features, int clusterIdx, const Mat &mat, double stiffness, int step)
+   * If so, the features will be computed once per iteration.
+   */
+   template<typename F>
+   struct usesFeatures {
+	   template<typename G>
+	   static auto test(int) -> decltype(std::declval<G &>()(Vec2i(), std::declval<const ClusterFeatures &>(), 0, std::declval<const Mat &>(), 0, 0), std::true_type());
+
+	   template<typename G>
+	   static std::false_type test(...);
+
+	   static const bool value = decltype(test<F>(0))::value;
+   };
+
+   //Calls the metric with the center or the features of the cluster (see usesFeatures)
+   template<typename F, bool = usesFeatures<F>::value>
+   struct Metric {
+	   static inline double call(F &f, const Vec2i &point, const Vec2i &center, int clusterIdx, const ClusterFeatures *, const Mat &img, double stiffness, int step) {
+		   return f(point, center, img, stiffness, step);
+	   }
+   };
+
+   template<typename F>
+   struct Metric<F, true> {
+	   static inline double call(F &f, const Vec2i &point, const Vec2i &, int clusterIdx, const ClusterFeatures *features, const Mat &img, double stiffness, int step) {
+		   return f(point, *features, clusterIdx, img, stiffness, step);
+	   }
+   };
+
+   /**
+   * Computes the metric of F for a whole row segment [x0, x1) at once.
+   * The default does nothing (returns false), so every functor still works pixel by pixel.
+   * Specialized for the metrics that have a row kernel (see RSlic2Util.h).
+   */
+   template<typename F>
+   struct RowKernel {
+	   static inline bool apply(F &f, const Mat &img, int y, int x0, int x1, const ClusterFeatures &features, int clusterIdx, double stiffness, int step, double *out) {
+		   return false;
+	   }
+   };
+
+   /**
+   * The factor the metric F multiplies the squared color distance with (its member colorFactor, 1 if there is none).
+   * Slico scales the maxima of the color distances with it, so they are in the same unit as the stiffness.
+   */
+   template<typename F>
+   struct ColorFactor {
+	   template<typename G>
+	   static auto get(const G &f, int) -> decltype(static_cast<double>(f.colorFactor)) {
+		   return f.colorFactor;
+	   }
+
+	   template<typename G>
+	   static double get(const G &, ...) {
+		   return 1;
+	   }
+
+	   static double of(const F &f) {
+		   return get<F>(f, 0);
+	   }
+   };
+
    /**
    * In order to share code between iterate and iterateZero we need
    * to take out the different parts.
@@ -58,261 +197,348 @@ namespace RSlic {
    template<typename F>
    struct DistNormal {
 	   inline double operator()(const Vec2i &point, const Vec2i &center, int clusterIdx) {
-		   return f(point, center, img, stiffness * stiffness, step);
+		   return Metric<F>::call(f, point, center, clusterIdx, features, img, stiffness * stiffness, step);
+	   }
+
+	   //Distances of the pixels [x0, x1) of row y to cluster clusterIdx
+	   inline void row(int y, int x0, int x1, const Vec2i &center, int clusterIdx, double *out) {
+		   if (features != nullptr && RowKernel<F>::apply(f, img, y, x0, x1, *features, clusterIdx, stiffness * stiffness, step, out)) return;
+		   for (int x = x0; x < x1; x++) out[x - x0] = (*this)(Vec2i(x, y), center, clusterIdx);
 	   }
 
 	   const cv::Mat &img;
 	   F &f;
 	   int stiffness;
 	   int step;
+	   const ClusterFeatures *features; // nullptr if F does not use them
    };
   }
  }
 }
-namespace {
-#ifdef PARALLEL
-
- /**
- * For doing some parallel computing we have to reduce the results of the threads.
- * Instead of iterating over all pixels, we just calculating the computed parts with
- * BRect.
- */
- struct BRect {
-         static constexpr uint imax = std::numeric_limits<unsigned int>::max();
-         struct point {
-                 uint x;
-                 uint y;
-         };
-         point topLeft, bottomRight;
-
-         BRect(uint tx, uint ty, uint bx, uint by) : topLeft{tx, ty}, bottomRight{bx, by} {
-         }
-
-         BRect() : topLeft{imax, imax}, bottomRight{0, 0} {
-         }
-
-         void combineWith(const BRect &other) {
-                 topLeft.x = std::min(topLeft.x, other.topLeft.x);
-                 topLeft.y = std::min(topLeft.y, other.topLeft.y);
-                 bottomRight.x = std::max(bottomRight.x, other.bottomRight.x);
-                 bottomRight.y = std::max(bottomRight.y, other.bottomRight.y);
-         }
- };
-
-#endif
-}
 namespace RSlic {
  namespace Pixel {
+  /**
+  * What an iteration assigned the pixels with (see Slic2T::iterateActive).
+  * The next active iteration compares its inputs with these ones.
+  */
+  struct AssignmentInputs {
+	  AssignmentInputs(std::type_index metric, double colorFactor, bool zero, int stiffness, const vector<Vec2i> &centers, const ClusterFeatures *features, const vector<double> *maxDistance) :
+			  metric(metric), colorFactor(colorFactor), zero(zero), stiffness(stiffness), centers(centers), sums(0, 0) {
+		  if (features != nullptr) mean = features->mean;
+		  if (maxDistance != nullptr) this->maxDistance = *maxDistance;
+	  }
+
+	  std::type_index metric; // typeid of the metric functor
+	  double colorFactor; // of the metric (see priv::ColorFactor)
+	  bool zero; // Slico
+	  int stiffness;
+	  vector<Vec2i> centers;
+	  vector<vector<double>> mean; // empty if the metric does not use the features
+	  vector<double> maxDistance; // Slico
+	  FeatureSums sums; // over all pixels (of the resulting labels)
+  };
+
   namespace priv {
 
    /**
-   * Results of the common iteration algorithm
+   * Results of the common iteration algorithm.
+   * Label and distance are separate planes (the label plane becomes the ClusterSet without copying),
+   * both are walked row by row. They are the spare buffers of the engine, so iterating does not allocate them every time.
+   * The features (and with them the new centers) are summed up while assigning.
    */
+   template<typename Label>
    struct iterateCommonRes {
-	   Mat_<ClusterInt> label;
-	   Mat_<double> dist;
-
-	   iterateCommonRes(int w, int h) : label(h, w, -1), dist(h, w, DINF) {
+	   using Dist = RSlic::priv::DistanceType;
+
+	   Mat_<Label> label;
+	   Mat_<Dist> dist;
+	   ClusterFeatures features; // of the new clusters
+	   vector<double> maxColor; // Slico: largest color distance per cluster (empty if not requested)
+	   Residual residual;
+
+	   //Writes into the given buffers, they are (re)allocated only if they don't fit. The content is set by iterateCommon.
+	   iterateCommonRes(Mat_<Label> &spareLabel, Mat &spareDist, int w, int h) {
+		   spareLabel.create(h, w);
+		   spareDist.create(h, w, DataType<Dist>::type);
+		   label = spareLabel;
+		   dist = spareDist;
 	   }
 
-	   inline double &distAt(int y, int x) {
-		   return dist.at<double>(y, x);
+	   inline Dist *distRow(int y) {
+		   return dist[y];
 	   }
 
-	   inline ClusterInt &labelAt(int y, int x) {
-		   return label.at<ClusterInt>(y, x);
+	   inline Label *labelRow(int y) {
+		   return label[y];
 	   }
-
-#ifdef PARALLEL
-         BRect calcRect;
-#endif
    };
 
-   using iterateCommonResP = unique_ptr<iterateCommonRes>;
+   template<typename Label>
+   using iterateCommonResP = unique_ptr<iterateCommonRes<Label>>;
+
+   /**
+   * Decides which clusters are active and marks the cells of their old and new windows as dirty.
+   * Inactive clusters get the inputs of the last assignment back (next is changed), so
+   * the kept pixels and the assigned ones see the same clusters.
+   * @param last the last assignment (may be nullptr)
+   * @param next the inputs of this assignment
+   * @param tolerance how much a cluster may change and still be inactive (< 0: everything is active)
+   * @param s the step
+   * @param w the width of the picture
+   * @param h the height of the picture
+   * @return the dirty cells, nullptr if every pixel has to be assigned
+   */
+   inline unique_ptr<RSlic::priv::DirtyCells> planActive(const AssignmentInputs *last, AssignmentInputs &next, double tolerance, int s, int w, int h) {
+	   if (tolerance < 0 || last == nullptr || last->metric != next.metric || last->colorFactor != next.colorFactor || last->zero != next.zero || last->stiffness != next.stiffness
+			   || last->centers.size() != next.centers.size() || last->mean.size() != next.mean.size())
+		   return unique_ptr<RSlic::priv::DirtyCells>();
+	   unique_ptr<RSlic::priv::DirtyCells> dirty(new RSlic::priv::DirtyCells(s, h, w));
+	   for (size_t k = 0; k < next.centers.size(); k++) {
+		   const Vec2i &before = last->centers[k];
+		   const Vec2i &now = next.centers[k];
+		   const double dx = now[0] - before[0], dy = now[1] - before[1];
+		   bool active = dx * dx + dy * dy > tolerance * tolerance;
+		   for (size_t c = 0; c < next.mean.size() && !active; c++)
+			   active = std::abs(next.mean[c][k] - last->mean[c][k]) > tolerance;
+		   if (next.zero && !active) active = std::abs(next.maxDistance[k] - last->maxDistance[k]) > tolerance;
+		   if (active) {
+			   dirty->markWindow(before[0], before[1], 0, s);
+			   dirty->markWindow(now[0], now[1], 0, s);
+		   } else {
+			   next.centers[k] = before;
+			   for (size_t c = 0; c < next.mean.size(); c++) next.mean[c][k] = last->mean[c][k];
+			   if (next.zero) next.maxDistance[k] = last->maxDistance[k];
+		   }
+	   }
+	   return dirty;
+   }
+
+   /**
+   * Returns features with the centers and colors of the assignment (for the metrics).
+   * (Only the ones of inactive clusters differ from features)
+   */
+   inline ClusterFeatures assignedFeatures(const ClusterFeatures &features, const AssignmentInputs &assignment) {
+	   ClusterFeatures res(features);
+	   for (size_t k = 0; k < assignment.centers.size(); k++) {
+		   res.x[k] = assignment.centers[k][0];
+		   res.y[k] = assignment.centers[k][1];
+	   }
+	   res.mean = assignment.mean;
+	   return res;
+   }
   }
  }
 }
 namespace {
  /**
- * Executes the Slic-Algorithm. Depending on the functor it computes the Slic or Slico version (or some unknown one ;).
- * @param f the functor. Have to be something like struct ExampleF{...; double operator()(const Vec2i& point, const Vec2i & center, int clusterIdx){...} ....}
- * @param beg the first cluster for computing
- * @param end the last cluster for computing
+ * Executes the Slic-Algorithm for the rows [yBeg, yEnd). Depending on the functor it computes the Slic or Slico version (or some unknown one ;).
+ * Only the pixels of these rows will be written, so several bands can share one result.
+ * Because every pixel looks at the clusters in the same order, the result does not depend on the partition.
+ * The distances are computed a row segment at a time (f.row), so vectorized metrics can be used.
+ * @param f the functor. Have to be something like struct ExampleF{...; void row(int y, int x0, int x1, const Vec2i & center, int clusterIdx, double *out){...} ....}
+ * @param yBeg the first row for computing
+ * @param yEnd the row after the last one for computing
  * @param w the width of the picture
- * @param h the height of the picture
  * @param centers the central points of the clusters
  * @param s the step
- * @param pool the threadpool for parallel computing
- * @result the results composed of the label Mat, distance Mat and may the rect of calculation
+ * @param result the label Mat and distance Mat to write into
+ * @param dirty if not nullptr, only the pixels in its dirty cells are assigned (they have to be reset before)
+ * @return how many distances were computed
  * @see iterate
  * @see iterateZero
  * @see priv::DistNormal
  */
- template<typename F>
- inline RSlic::Pixel::priv::iterateCommonResP iterateCommonIteration(F f, int beg, int end, int w, int h, const vector<Vec2i> &centers, int s, ThreadPoolP pool) {
-	 RSlic::Pixel::priv::iterateCommonResP result(new RSlic::Pixel::priv::iterateCommonRes(w, h));
-	 for (int k = beg; k < end; k++) {
+ template<typename F, typename Label>
+ inline long iterateCommonIteration(F &f, int yBeg, int yEnd, int w, const vector<Vec2i> &centers, int s, RSlic::Pixel::priv::iterateCommonRes<Label> &result, const RSlic::priv::DirtyCells *dirty = nullptr) {
+	 using Dist = RSlic::priv::DistanceType;
+	 const int N = centers.size();
+	 long distanceCount = 0;
+	 vector<double> distances(2 * s + 1);
+	 for (int k = 0; k < N; k++) {
 		 auto center = centers[k];
 		 int px = center[0];
 		 int py = center[1];
-#ifdef PARALLEL
-                 BRect currentRect(std::max(0, px - s), std::max(0, py - s), std::min(w, px + s + 1), std::min(h, py + s + 1));
-                 result->calcRect.combineWith(currentRect);
-#endif
-		 for (int x = std::max(0, px - s); x < std::min(w, px + s + 1); x++) {
-			 for (int y = std::max(0, py - s); y < std::min(h, py + s + 1); y++) {
-				 Vec2i point(x, y);
-				 double &d = result->distAt(y, x);
-				 double D = f(point, center, k);
-				 if (D < d) {
-					 d = D;
-					 result->labelAt(y, x) = k;
+		 int y0 = std::max(yBeg, py - s);
+		 int y1 = std::min(yEnd, py + s + 1);
+		 if (y0 >= y1) continue; // window is not in this band
+		 const int x0 = std::max(0, px - s);
+		 const int x1 = std::min(w, px + s + 1);
+		 if (dirty != nullptr && !dirty->any(y0, y1, x0, x1)) continue; // nothing to do in this window
+		 for (int y = y0; y < y1; y++) {
+			 Dist *distRow = result.distRow(y);
+			 Label *labelRow = result.labelRow(y);
+			 auto assignRun = [&](int xBeg, int xEnd) {
+				 f.row(y, xBeg, xEnd, center, k, distances.data());
+				 distanceCount += xEnd - xBeg;
+				 for (int x = xBeg; x < xEnd; x++) {
+					 const Dist D = static_cast<Dist>(distances[x - xBeg]);
+					 if (D < distRow[x]) {
+						 distRow[x] = D;
+						 labelRow[x] = k;
+					 }
 				 }
-			 }
+			 };
+			 if (dirty == nullptr) assignRun(x0, x1);
+			 else dirty->forEachRunInRow(y, x0, x1, assignRun);
 		 }
 	 }
-	 return result;
+	 return distanceCount;
  }
 
-#ifndef PARALLEL
-
  /**
  * Executes the Slic-Algorithm. Depending on the functor it computes the Slic or Slico version (or some unknown one ;).
- * @param f the functor. Have to be something like struct ExampleF{...; double operator()(const Vec2i& point, const Vec2i & center, int clusterIdx){...} ....}
+ * With PARALLEL the picture is split in bands of rows and every thread computes its own band
+ * in the shared result (no reduce needed). The labels are the same for every thread count.
+ * As soon as a band is assigned, its pixels are added to the sums of this band (new centers, mean color
+ * and for Slico the color maxima) and compared with the old labels (residual).
+ * The sums are merged in band order, so no further pass over the picture is needed.
+ * With dirty cells (active iteration) the result starts as a copy of the old labels and distances and only the dirty pixels
+ * are assigned. The sums of the last assignment are updated with them (old label out, new label in).
+ * The color maxima only see the dirty pixels, but the others can't raise the maxima of the clusters anyway
+ * (they have been measured against the same center and mean color before).
+ * @param f the functor. Have to be something like priv::DistNormal or priv::DistZero
  * @param clusters the ClusterSet
+ * @param distance the distances of the old labels (only used with dirty)
+ * @param assignment the inputs of this assignment, gets the sums of the new labels
+ * @param last the last assignment (only used with dirty and an integer picture, float sums are recomputed)
+ * @param dirty the cells to assign, nullptr for all of them
  * @param s the step
+ * @param img the picture
+ * @param withMaxColor compute the color maxima for Slico (against f.features, if the metric uses them)
  * @param pool the threadpool for parallel computing
- * @result the results composed of the label Mat and distance Mat
+ * @param spareLabel buffer for the new labels (must not be the one of clusters)
+ * @param spareDist buffer for the new distances (must not be distance)
+ * @param tracer gets the phases (may be nullptr)
+ * @result the results composed of the label Mat, distance Mat, the features of the new clusters and the residual
  * @see iterate
  * @see iterateZero
+ * @see iterateActive
  * @see priv::DistNormal
  */
- template<typename F>
- RSlic::Pixel::priv::iterateCommonResP iterateCommon(F f, const ClusterSet &clusters, int s, ThreadPoolP pool) {
-	 auto centers = clusters.getCenters();
+ template<typename F, typename Label>
+ RSlic::Pixel::priv::iterateCommonResP<Label> iterateCommon(F f, const ClusterSetT<Label> &clusters, const Mat &distance,
+		 RSlic::Pixel::AssignmentInputs &assignment, const RSlic::Pixel::AssignmentInputs *last, const RSlic::priv::DirtyCells *dirty,
+		 int s, const Mat &img, bool withMaxColor, ThreadPoolP pool, Mat_<Label> &spareLabel, Mat &spareDist, RSlic::Tracer *tracer) {
+	 using Dist = RSlic::priv::DistanceType;
+	 const auto &centers = assignment.centers;
 	 int h = clusters.getClusterLabel().rows;
 	 int w = clusters.getClusterLabel().cols;
-	 int N = centers.size(); 
-
-	 return iterateCommonIteration(f, 0, N, w, h, centers, s, pool);
- }
-
-#else
-
-/**
- * Executes the Slic-Algorithm. Depending on the functor it computes the Slic or Slico version (or some unknown one ;).
- * (Do the parallel computing version)
- * @param f the functor. Have to be something like struct ExampleF{...; double operator()(const Vec2i& point, const Vec2i & center, int clusterIdx){...} ....}
- * @param clusters the ClusterSet
- * @param s the step
- * @param pool the threadpool for parallel computing
- * @result the results composed of the label Mat and distance Mat
- * @see iterate
- * @see iterateZero
- * @see priv::DistNormal
- */
- template<typename F>
- RSlic::Pixel::priv::iterateCommonResP iterateCommon(F f, const ClusterSet &clusters, int s, ThreadPoolP pool) {
-         auto centers = clusters.getCenters();
-         int h = clusters.getClusterLabel().rows;
-         int w = clusters.getClusterLabel().cols;
-         RSlic::Pixel::priv::iterateCommonResP result(new  RSlic::Pixel::priv::iterateCommonRes(w, h));
-
-         int N = centers.size(); 
-         int thread_step = N / pool->threadcount();
-         std::vector<std::future<RSlic::Pixel::priv::iterateCommonResP>> futures;
-         futures.reserve(pool->threadcount());
-         //Map
-        
-         for (int thread_start = 0; thread_start < N; thread_start += thread_step) {
-                 futures.push_back(pool->enqueue([&](int start) {
-                         return iterateCommonIteration(f, start, std::min(start + thread_step, N), w, h, centers, s, pool);
-                 }, thread_start));
-         }
-         //Reduce
-         for (auto &&fut: futures) {
-                 auto &&thread_result = fut.get(); 
-                 //Only use changed parts for reducing
-                 for (int x = thread_result->calcRect.topLeft.x; x < thread_result->calcRect.bottomRight.x; x++) {
-                         for (int y = thread_result->calcRect.topLeft.y; y < thread_result->calcRect.bottomRight.y; y++) {
-                                 double dist_thread = thread_result->distAt(y, x);
-                                 double &dist_result = result->distAt(y, x);
-                                 if (dist_thread < dist_result) {
-                                         dist_result = dist_thread;
-                                         result->labelAt(y, x) = thread_result->labelAt(y, x);
-                                 }
-                         }
-                 }
-         }
-         return result;
+	 const Mat_<Label> oldLabel = clusters.getClusterLabel();
+	 const Mat_<Dist> oldDist = distance;
+	 RSlic::priv::TraceScope traceAssign(tracer, "assign", -1, RSlic::priv::bandThreads(pool.get(), h));
+	 const void *spareData[] = {spareLabel.data, spareDist.data};
+	 RSlic::Pixel::priv::iterateCommonResP<Label> result(new RSlic::Pixel::priv::iterateCommonRes<Label>(spareLabel, spareDist, w, h));
+	 if (spareLabel.data != spareData[0]) traceAssign.allocated(RSlic::priv::matBytes(spareLabel));
+	 if (spareDist.data != spareData[1]) traceAssign.allocated(RSlic::priv::matBytes(spareDist));
+	 if (dirty != nullptr && dirty->mostlyDirty()) dirty = nullptr; // same result, but cheaper
+
+	 // Float sums are not exact: they use bands that don't depend on the threads and are recomputed
+	 // for all pixels instead of updated for the dirty ones, so neither the threads nor the active set change them
+	 const bool exact = RSlic::priv::exactDepth(img.depth());
+	 const RSlic::priv::DirtyCells *sumDirty = exact ? dirty : nullptr;
+	 const int bands = RSlic::priv::sumBandCount(pool.get(), h, exact);
+	 vector<FeatureSums> sums(bands, FeatureSums(centers.size(), img.channels(), false, withMaxColor));
+	 vector<FeatureSums> removed(sumDirty == nullptr ? 0 : bands, FeatureSums(centers.size(), img.channels()));
+	 vector<long> changed(bands, 0);
+	 RSlic::priv::forEachBand(pool.get(), h, bands, [&](int band, int yBeg, int yEnd) {
+		 RSlic::priv::TraceScope traceBand(tracer, "assign", band);
+		 // Start with nothing assigned or (active) with the old labels except for the dirty pixels
+		 for (int y = yBeg; y < yEnd; y++) {
+			 Dist *distRow = result->distRow(y);
+			 Label *labelRow = result->labelRow(y);
+			 if (dirty == nullptr) {
+				 std::fill(distRow, distRow + w, std::numeric_limits<Dist>::infinity());
+				 std::fill(labelRow, labelRow + w, static_cast<Label>(-1));
+				 continue;
+			 }
+			 std::copy(oldDist[y], oldDist[y] + w, distRow);
+			 std::copy(oldLabel[y], oldLabel[y] + w, labelRow);
+			 dirty->forEachRunInRow(y, 0, w, [&](int xBeg, int xEnd) {
+				 std::fill(distRow + xBeg, distRow + xEnd, std::numeric_limits<Dist>::infinity());
+				 std::fill(labelRow + xBeg, labelRow + xEnd, static_cast<Label>(-1));
+			 });
+		 }
+		 if (sumDirty != nullptr) accumulateFeatures(img, oldLabel, yBeg, yEnd, removed[band], nullptr, nullptr, sumDirty);
+		 traceBand.count(iterateCommonIteration(f, yBeg, yEnd, w, centers, s, *result, dirty), static_cast<long>(yEnd - yBeg) * w);
+		 accumulateFeatures(img, result->label, yBeg, yEnd, sums[band], withMaxColor ? &centers : nullptr, f.features, sumDirty);
+		 for (int y = yBeg; y < yEnd; y++) {
+			 const Label *oldRow = oldLabel[y];
+			 const Label *newRow = result->labelRow(y);
+			 auto compareRun = [&](int xBeg, int xEnd) {
+				 for (int x = xBeg; x < xEnd; x++) {
+					 if (oldRow[x] != newRow[x]) changed[band]++;
+				 }
+			 };
+			 if (dirty == nullptr) compareRun(0, w);
+			 else dirty->forEachRunInRow(y, 0, w, compareRun);
+		 }
+	 });
+	 traceAssign.end();
+	 long changedSum = 0;
+	 FeatureSums total = sumDirty == nullptr ? FeatureSums(centers.size(), img.channels()) : last->sums;
+	 {
+		 RSlic::priv::TraceScope trace(tracer, "reduce");
+		 for (int band = 0; band < bands; band++) {
+			 total += sums[band];
+			 if (sumDirty != nullptr) total -= removed[band];
+			 changedSum += changed[band];
+		 }
+	 }
+	 {
+		 RSlic::priv::TraceScope trace(tracer, "centers");
+		 result->features = mergeFeatures(img, vector<FeatureSums>(1, total), &clusters.getCenters());
+		 result->residual.displacement = RSlic::priv::centerDisplacement(clusters.getCenters(), result->features.centers());
+	 }
+	 assignment.sums = std::move(total);
+	 result->residual.changed = static_cast<double>(changedSum) / (static_cast<double>(w) * h);
+	 if (withMaxColor) {
+		 RSlic::priv::TraceScope trace(tracer, "slico");
+		 result->maxColor.assign(centers.size(), 0);
+		 for (const FeatureSums &band: sums) {
+			 for (size_t i = 0; i < centers.size(); i++)
+				 result->maxColor[i] = std::max(result->maxColor[i], band.maxColor[i]);
+		 }
+	 }
+	 return result;
  }
-
-#endif
 }
 
+template<typename Label>
 template<typename F>
-RSlic::Pixel::Slic2P RSlic::Pixel::Slic2::iterate(int stiffness, F f) const {
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterateNormal(int stiffness, F f, double tolerance) {
 	int s = setting->step;
 	int w = setting->img.cols;
 	int h = setting->img.rows;
 
-	// Setting up the normal Slic
-	RSlic::Pixel::priv::DistNormal<F> distF{setting->img, f, stiffness, s};
-	auto res = ::iterateCommon<RSlic::Pixel::priv::DistNormal<F>>(distF, clusters, s, setting->pool);
+	// Which clusters have to be assigned again (all of them without tolerance)
+	const ClusterFeatures *features = featuresFor<F>();
+	auto next = std::make_shared<AssignmentInputs>(typeid(F), Pixel::priv::ColorFactor<F>::of(f), false, stiffness, clusters.getCenters(), features, nullptr);
+	auto dirty = Pixel::priv::planActive(assignment.get(), *next, tolerance, s, w, h);
+	ClusterFeatures assigned;
+	if (dirty && features != nullptr) {
+		assigned = Pixel::priv::assignedFeatures(*features, *next);
+		features = &assigned;
+	}
+
+	// Setting up the normal Slic (with the features of the clusters if the metric wants them)
+	RSlic::Pixel::priv::DistNormal<F> distF{setting->img, f, stiffness, s, features};
+	auto res = ::iterateCommon<RSlic::Pixel::priv::DistNormal<F>, Label>(distF, clusters, distance, *next, assignment.get(), dirty.get(), s, setting->img, false, setting->pool, spareLabel, spareDistance, setting->tracer.get());
 
-	// Creating the new instace
-	Settings *newSetting = setting;
+	// The new state
 	if (setting->stiffness != stiffness) {
-		newSetting = new Settings(setting);
+		Settings *newSetting = new Settings(setting);
 		newSetting->stiffness = stiffness;
+		newSetting->__refcount++;
+		if (--setting->__refcount == 0) delete setting;
+		setting = newSetting;
 	}
-	Slic2 *result = new Slic2(newSetting, ClusterSet(res->label, clusters.getCenters().size()), res->dist);
-
-	return shared_ptr<Slic2>(result);
+	swap(ClusterSetT<Label>(res->features.centers(), res->label), res->dist);
+	this->features = std::move(res->features);
+	residual = res->residual;
+	assignment = std::move(next);
+	return residual;
 }
 
-namespace {
- //Update the color-distance-maxima-matrix for slico that will be used for the next iteration.
- template<typename T>
- inline void iterateZeroUpdate(
-		 const Mat &img, const Mat &label,
-		 const vector<Vec2i> &centers, vector<double> &max_dist_color, shared_ptr<ThreadPool> pool) {
-	 int w = img.cols;
-	 int h = img.rows;
-	 //Update Slico distance maxima
-#ifdef PARALLEL
-         int step = w / pool->threadcount();
-         std::vector<std::future<void>> results;
-         results.reserve(pool->threadcount());
-         for (int xx = 0; xx < w; xx += step) {
-                 results.push_back(pool->enqueue([&](int xx) {
-                         for (int x = xx; x < std::min(xx + step, w); x++) {
-#else
-	 for (int x = 0; x < w; x++) {
-#endif
-		 for (int y = 0; y < h; y++) {
-			 ClusterInt nearest_segment = label.at<ClusterInt>(y, x);
-			 if (nearest_segment == -1) continue;
-			 auto point = centers[nearest_segment];
-			 int py = point[1];
-			 int px = point[0];
-             auto distColor = RSlic::priv::zero::zeroMetrik(img.at<T>(y, x), img.at<T>(py, px));
-			 if (max_dist_color.at(nearest_segment) < distColor) {
-				 max_dist_color.at(nearest_segment) = distColor;
-			 }
-		 }
-	 }
-#ifdef PARALLEL
-                 }, xx));
-         }
-         for (auto &res: results) {res.get();}
-#endif
- }
-
- //For calling without template
- declareCVF_T(iterateZeroUpdate, iterateZeroUpdateHelper,
-		 return)
-}
 namespace RSlic {
  namespace Pixel {
   namespace priv {
@@ -321,106 +547,143 @@ namespace RSlic {
    template<typename F>
    struct DistZero {
 	   inline double operator()(const Vec2i &point, const Vec2i &center, int clusterIdx) {
-		   return f(point, center, img, max_distance[clusterIdx], step);
+		   return Metric<F>::call(f, point, center, clusterIdx, features, img, stiffness(clusterIdx), step);
+	   }
+
+	   //Distances of the pixels [x0, x1) of row y to cluster clusterIdx
+	   inline void row(int y, int x0, int x1, const Vec2i &center, int clusterIdx, double *out) {
+		   if (features != nullptr && RowKernel<F>::apply(f, img, y, x0, x1, *features, clusterIdx, stiffness(clusterIdx), step, out)) return;
+		   for (int x = x0; x < x1; x++) out[x - x0] = (*this)(Vec2i(x, y), center, clusterIdx);
+	   }
+
+	   //The largest color distance of the cluster in the unit of the metric (1 as long as it is unknown or 0)
+	   inline double stiffness(int clusterIdx) const {
+		   return max_distance[clusterIdx] > 0 ? max_distance[clusterIdx] * colorFactor : 1;
 	   }
 
 	   const cv::Mat &img;
 	   F f;
 	   const vector<double> &max_distance;
 	   int step;
+	   const ClusterFeatures *features; // nullptr if F does not use them
+	   double colorFactor; // see ColorFactor
    };
   }
  }
 }
 
 //Slico
+template<typename Label>
 template<typename F>
-RSlic::Pixel::Slic2P RSlic::Pixel::Slic2::iterateZero(F f) const {
+const RSlic::Pixel::Residual &RSlic::Pixel::Slic2EngineT<Label>::iterateSlico(F f, double tolerance) {
 	int s = setting->step;
 	int w = setting->img.cols;
 	int h = setting->img.rows;
 
+	// Which clusters have to be assigned again (all of them without tolerance)
+	const ClusterFeatures *features = featuresFor<F>();
+	auto next = std::make_shared<AssignmentInputs>(typeid(F), Pixel::priv::ColorFactor<F>::of(f), true, setting->stiffness, clusters.getCenters(), features, &max_dist_color);
+	auto dirty = Pixel::priv::planActive(assignment.get(), *next, tolerance, s, w, h);
+	ClusterFeatures assigned;
+	if (dirty && features != nullptr) {
+		assigned = Pixel::priv::assignedFeatures(*features, *next);
+		features = &assigned;
+	}
+
 	//Setting up Slico
-	Pixel::priv::DistZero<F> distF{setting->img, f, max_dist_color, s};
-	auto res = ::iterateCommon<Pixel::priv::DistZero<F>>(distF, clusters, s, setting->pool);
-
-	auto newClusters = ClusterSet(res->label, clusters.getCenters().size());
-	vector<double> new_max_dist_color(max_dist_color);
-	//
-	//Update values
-	::iterateZeroUpdateHelper(setting->img.type(), setting->img, res->label, newClusters.getCenters(), new_max_dist_color, setting->pool);
-
-	//Creating a new instance
-	Slic2 *result = new Slic2(setting, std::move(newClusters), res->dist);
-	result->max_dist_color = std::move(new_max_dist_color);
-	return shared_ptr<Slic2>(result);
+	Pixel::priv::DistZero<F> distF{setting->img, f, next->maxDistance, s, features, Pixel::priv::ColorFactor<F>::of(f)};
+	auto res = ::iterateCommon<Pixel::priv::DistZero<F>, Label>(distF, clusters, distance, *next, assignment.get(), dirty.get(), s, setting->img, true, setting->pool, spareLabel, spareDistance, setting->tracer.get());
+
+	//Update values (the color maxima were collected while assigning)
+	for (size_t i = 0; i < max_dist_color.size(); i++) {
+		max_dist_color[i] = std::max(max_dist_color[i], res->maxColor[i]);
+	}
+
+	//The new state
+	swap(ClusterSetT<Label>(res->features.centers(), res->label), res->dist);
+	this->features = std::move(res->features);
+	residual = res->residual;
+	assignment = std::move(next);
+	return residual;
 }
 
+template<typename Label>
 template<typename F>
-RSlic::Pixel::Slic2P RSlic::Pixel::Slic2::finalize(F f) const {
+const ClusterFeatures *RSlic::Pixel::Slic2EngineT<Label>::featuresFor() {
+	if (!Pixel::priv::usesFeatures<F>::value) return nullptr;
+	// Computed by the last iteration or now
+	if (features.size() != clusters.clusterCount()) {
+		features = computeFeatures(setting->img, clusters, setting->pool);
+	}
+	return &features;
+}
+
+template<typename Label>
+template<typename F>
+RSlic::Pixel::Slic2TP<Label> RSlic::Pixel::Slic2T<Label>::finalize(F f) const {
 	int w = setting->img.cols;
 	int h = setting->img.rows;
-	Mat_<ClusterInt> finalClusters(h, w, -1);
+	RSlic::priv::TraceScope trace(setting->tracer.get(), "finalize");
+	Mat_<Label> finalClusters(h, w, -1);
 	int currentLabel = 0;
 	const int lims = (h * w) / (clusters.clusterCount());
 	static const int neighboursX[] = {1, 0, -1, 0};
 	static const int neighboursY[aSize(neighboursX)] = {0, 1, 0, -1};
-
-	for (int x = 0; x < w; x++) {
-		for (int y = 0; y < h; y++) {
-			//Some unassigned pixel?
-			if (finalClusters.at<ClusterInt>(y, x) == -1) {
-				vector<Vec2i> current_points;
-				current_points.emplace_back(x, y);
-				finalClusters.at<ClusterInt>(y, x) = currentLabel;
-
-				//Look transitively for all unassigned neighbors
-				//set them in current_points and finalCluster
-				for (int i = 0; i < current_points.size(); i++) {
-					Vec2i point = current_points[i];
-
-					for (int neighbour = 0; neighbour < aSize(neighboursX); neighbour++) {
-						int px = point[0] + neighboursX[neighbour];
-						int py = point[1] + neighboursY[neighbour];
-						if (px < 0 || px >= w || py < 0 || py >= h) continue; // not in the picture anymore
-						if (finalClusters.at<ClusterInt>(py, px) == -1
-								&& clusters.at(y, x) == clusters.at(py, px)) {
-							current_points.emplace_back(px, py);
-							finalClusters.at<ClusterInt>(py, px) = currentLabel;
-						}
+	const Mat_<Label> labels = clusters.getClusterLabel();
+
+	//The connected pixel of the same cluster (4-neighbourhood), numbered in the order of their first pixel
+	const RSlic::priv::ComponentsT<int> components = RSlic::priv::connectedComponents<int>(setting->pool.get(), h, w, [&labels, w](int y, int x, int *out) {
+		const Label *row = labels[y];
+		int count = 0;
+		if (x > 0 && row[x - 1] == row[x]) out[count++] = y * w + x - 1;
+		if (y > 0 && labels[y - 1][x] == row[x]) out[count++] = (y - 1) * w + x;
+		return count;
+	});
+
+	//Every component becomes a new cluster. If there are not enough pixel in it (or no label is left)
+	//look for the best in the environment (of its first pixel, among the ones before) and conjoin both
+	const int count = components.first.size();
+	vector<int> componentLabel(count);
+	long distanceCount = 0;
+	for (int c = 0; c < count; c++) {
+		if (components.size[c] <= lims >> 2 || currentLabel == std::numeric_limits<Label>::max()) {
+			const int x = components.first[c] % w;
+			const int y = components.first[c] / w;
+			int adjlabel = currentLabel; //best neighbor
+			double topdist = DINF; //best neighbor value
+			//finding best neighbor
+			for (int neighbour = 0; neighbour < 4; neighbour++) {
+				int px = x + neighboursX[neighbour];
+				int py = y + neighboursY[neighbour];
+				if (px < 0 || px >= w || py < 0 || py >= h) continue;
+				const int other = components.id[py * w + px];
+				if (other >= c) continue; // not labeled yet
+				int label = componentLabel[other];
+				if (label != currentLabel) {
+					double dist = f(Vec2i(x, y), Vec2i(px, py), setting->img, 1, setting->step);
+					distanceCount++;
+					if (dist < topdist) { 
+						topdist = dist;
+						adjlabel = label;
 					}
 				}
-
-				//If there are not enough pixel in the cluster
-				//look for the best in the environment and conjoin both
-				if (current_points.size() <= lims >> 2) {
-					int adjlabel = currentLabel; //best neighbor
-					double topdist = DINF; //best neighbor value
-					//finding best neighbor
-					for (int neighbour = 0; neighbour < 4; neighbour++) {
-						int px = x + neighboursX[neighbour];
-						int py = y + neighboursY[neighbour];
-						if (px < 0 || px >= w || py < 0 || py >= h) continue;
-						ClusterInt label = finalClusters.at<ClusterInt>(py, px);
-						if (label >= 0 && label != currentLabel) {
-							double dist = f(Vec2i(x, y), Vec2i(px, py), setting->img, 1, setting->step);
-							if (dist < topdist) { 
-								topdist = dist;
-								adjlabel = label;
-							}
-						}
-					}
-					//Set pixel to this neighbor
-					for (const Vec2i point: current_points) {
-						finalClusters.at<ClusterInt>(point[1], point[0]) = adjlabel;
-					}
-				} else currentLabel++; //Else I've created a new cluster
 			}
-		}
+			componentLabel[c] = adjlabel;
+		} else componentLabel[c] = currentLabel++; //Else I've created a new cluster
 	}
 
-	Slic2 *result = new Slic2(setting, ClusterSet(finalClusters, currentLabel), distance);
-	return std::shared_ptr<Slic2>(result);
+	RSlic::priv::forEachBand(setting->pool.get(), h, [&](int, int begin, int end) {
+		for (int y = begin; y < end; y++) {
+			Label *finalRow = finalClusters[y];
+			const int *ids = components.id.data() + y * w;
+			for (int x = 0; x < w; x++) finalRow[x] = componentLabel[ids[x]];
+		}
+	});
+	trace.count(distanceCount, static_cast<long>(w) * h);
+	trace.allocated(RSlic::priv::matBytes(finalClusters) + 2 * sizeof(int) * w * h); // and the ids and trees of the components
+
+	Slic2T *result = new Slic2T(setting, ClusterSetT<Label>(finalClusters, currentLabel), distance);
+	return std::shared_ptr<Slic2T>(result);
 }
 
 
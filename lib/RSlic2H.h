@@ -3,10 +3,13 @@
 
 #include <Pixel/RSlic2.h>
 #include <Pixel/RSlic2_impl.h>
+#include <Pixel/RSlic2Engine.h>
 #include <Pixel/RSlic2Draw.h>
 #include <Pixel/RSlic2Util.h>
+#include <Pixel/RSlic2Tiled.h>
 #include <Pixel/ClusterSet.h>
+#include <Pixel/ClusterFeatures.h>
 
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 
 #endif
@@ -1,10 +1,12 @@
 #ifndef RSlic3H_H
 #define RSlic3H_H
 
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 #include <Voxel/RSlic3.h>
+#include <Voxel/RSlic3Engine.h>
 #include <Voxel/RSlic3_impl.h>
 #include <Voxel/RSlic3Utils.h>
+#include <Voxel/RSlic3Stream.h>
 #include <Voxel/ClusterSet.h>
 
 #endif
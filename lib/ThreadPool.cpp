@@ -0,0 +1,106 @@
+#include "ThreadPool.h"
+
+namespace {
+ // The worker that runs in this thread (pool and index of its deque)
+ thread_local const ThreadPool *currentPool = nullptr;
+ thread_local size_t currentQueue = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads) : queued(0), sleeping(0), nextQueue(0), stop(false) {
+	for (size_t i = 0; i < threads; i++) queues.emplace_back(new Queue());
+	for (size_t i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for (std::thread &worker: workers) worker.join();
+}
+
+std::shared_ptr<ThreadPool> ThreadPool::defaultPool() {
+	static std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+	return pool;
+}
+
+void ThreadPool::push(const Task &task) {
+	const size_t index = currentPool == this ? currentQueue : nextQueue++ % queues.size();
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mutex);
+		queues[index]->tasks.push_back(task);
+	}
+	queued++;
+	// only bother the sleeping workers (they check queued after announcing that they sleep)
+	if (sleeping.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+bool ThreadPool::pop(Task &task) {
+	if (queued.load() == 0) return false;
+	const bool worker = currentPool == this;
+	const size_t count = queues.size();
+	const size_t start = worker ? currentQueue : nextQueue.load() % count;
+	// the newest task of the own deque (its data is still in the cache), the oldest one of the others
+	if (worker) {
+		Queue &own = *queues[start];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	for (size_t i = worker ? 1 : 0; i < count; i++) {
+		Queue &other = *queues[(start + i) % count];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty()) {
+			task = other.tasks.front();
+			other.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::wait(Group &group) {
+	Task task;
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(group.mutex);
+			if (group.remaining == 0) break;
+		}
+		if (pop(task)) {
+			task.run(task.data, task.begin, task.end);
+			continue;
+		}
+		// the rest is running in other threads
+		std::unique_lock<std::mutex> lock(group.mutex);
+		group.done.wait(lock, [&group] { return group.remaining == 0; });
+		break;
+	}
+	std::lock_guard<std::mutex> lock(group.mutex);
+	if (group.error) std::rethrow_exception(group.error);
+}
+
+void ThreadPool::loop(size_t index) {
+	currentPool = this;
+	currentQueue = index;
+	Task task;
+	while (true) {
+		if (pop(task)) {
+			task.run(task.data, task.begin, task.end);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleeping++;
+		wake.wait(lock, [this] { return stop || queued.load() > 0; });
+		sleeping--;
+		if (stop && queued.load() == 0) return;
+	}
+}
@@ -0,0 +1,217 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+* Work-stealing executor.
+* Every worker has its own deque of tasks: it takes the newest one of its own deque and, if that is empty,
+* steals the oldest one of another worker. So there is no single queue all threads wait for.
+* parallel_for and parallel_reduce split a range into chunks, the calling thread works on them, too
+* (therefore they may be called from within a task).
+*/
+class ThreadPool {
+public:
+	/**
+	* Starts the workers.
+	* @param threads amount of workers (0: everything runs in the calling thread)
+	*/
+	explicit ThreadPool(size_t threads);
+
+	/**
+	* Finishes the tasks that are left and joins the workers.
+	*/
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	/**
+	* Returns the amount of workers
+	*/
+	size_t threadcount() const {
+		return workers.size();
+	}
+
+	/**
+	* The pool for everyone who does not bring an own one.
+	* It is created at the first call (one worker per hardware thread) and lives until the process ends.
+	* @return the pool
+	*/
+	static std::shared_ptr<ThreadPool> defaultPool();
+
+	/**
+	* Calls f(chunkBegin, chunkEnd) for the chunks [begin, begin + grain), [begin + grain, begin + 2 * grain), ... of [begin, end)
+	* and blocks until all of them are done. The chunks don't depend on the threads.
+	* If f throws, the first exception is rethrown (after all chunks are done).
+	* @param begin first index
+	* @param end index after the last one
+	* @param grain size of a chunk (at least 1)
+	* @param f functor like void(int chunkBegin, int chunkEnd)
+	*/
+	template<typename F>
+	void parallel_for(int begin, int end, int grain, F f);
+
+	/**
+	* Computes f(chunkBegin, chunkEnd) for the chunks (see parallel_for) and combines the results in the order of the chunks:
+	* reduce(...reduce(reduce(identity, f(chunk 0)), f(chunk 1))..., f(last chunk)).
+	* So the result is deterministic even if reduce is not associative (e.g. floating point sums).
+	* @param begin first index
+	* @param end index after the last one
+	* @param grain size of a chunk (at least 1)
+	* @param identity the start value
+	* @param f functor like T(int chunkBegin, int chunkEnd)
+	* @param reduce functor like T(const T &, const T &)
+	* @return the combined result
+	*/
+	template<typename T, typename F, typename R>
+	T parallel_reduce(int begin, int end, int grain, T identity, F f, R reduce);
+
+	/**
+	* Runs f(args...) in a worker.
+	* @return future of the result
+	*/
+	template<class F, class... Args>
+	auto enqueue(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+
+private:
+	// No std::function, a chunk of a parallel_for just points to its context on the stack of the caller
+	struct Task {
+		void (*run)(void *data, int begin, int end);
+		void *data;
+		int begin;
+		int end;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	// The chunks of a parallel_for that are not done yet
+	struct Group {
+		std::mutex mutex;
+		std::condition_variable done;
+		int remaining;
+		std::exception_ptr error;
+	};
+
+	template<typename F>
+	struct ForContext {
+		F *f;
+		Group group;
+	};
+
+	template<typename F>
+	static void runChunk(void *data, int begin, int end);
+
+	template<typename P>
+	static void runPackaged(void *data, int, int);
+
+	//Puts the task into the deque of the current worker (or of any worker if the current thread is none)
+	void push(const Task &task);
+
+	//Takes a task (own deque first, then stealing), false if there is none
+	bool pop(Task &task);
+
+	//Works on other tasks until the group is done, then rethrows its exception
+	void wait(Group &group);
+
+	void loop(size_t index);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<int> queued; // tasks in all deques
+	std::atomic<int> sleeping; // workers that wait for tasks
+	std::atomic<unsigned> nextQueue; // round robin for threads that are no workers
+	bool stop;
+};
+
+typedef std::shared_ptr<ThreadPool> ThreadPoolP;
+
+template<typename F>
+void ThreadPool::runChunk(void *data, int begin, int end) {
+	ForContext<F> *context = static_cast<ForContext<F> *>(data);
+	std::exception_ptr error;
+	try {
+		(*context->f)(begin, end);
+	} catch (...) {
+		error = std::current_exception();
+	}
+	// the last access to the context, the caller may return right afterwards
+	std::lock_guard<std::mutex> lock(context->group.mutex);
+	if (error && !context->group.error) context->group.error = error;
+	if (--context->group.remaining == 0) context->group.done.notify_all();
+}
+
+template<typename F>
+void ThreadPool::parallel_for(int begin, int end, int grain, F f) {
+	if (end <= begin) return;
+	grain = std::max(1, grain);
+	const int chunks = static_cast<int>((static_cast<long>(end) - begin + grain - 1) / grain);
+	auto chunkEnd = [&](int c) {
+		return static_cast<int>(std::min<long>(end, begin + static_cast<long>(c + 1) * grain));
+	};
+	if (chunks == 1 || workers.empty()) {
+		for (int c = 0; c < chunks; c++) f(begin + c * grain, chunkEnd(c));
+		return;
+	}
+	ForContext<F> context;
+	context.f = &f;
+	context.group.remaining = chunks;
+	for (int c = chunks - 1; c > 0; c--) push(Task{&runChunk<F>, &context, begin + c * grain, chunkEnd(c)});
+	runChunk<F>(&context, begin, chunkEnd(0));
+	wait(context.group);
+}
+
+template<typename T, typename F, typename R>
+T ThreadPool::parallel_reduce(int begin, int end, int grain, T identity, F f, R reduce) {
+	if (end <= begin) return identity;
+	grain = std::max(1, grain);
+	const int chunks = static_cast<int>((static_cast<long>(end) - begin + grain - 1) / grain);
+	std::vector<T> results(chunks, identity);
+	parallel_for(0, chunks, 1, [&](int c0, int c1) {
+		for (int c = c0; c < c1; c++) {
+			results[c] = f(begin + c * grain, static_cast<int>(std::min<long>(end, begin + static_cast<long>(c + 1) * grain)));
+		}
+	});
+	T res = identity;
+	for (const T &r: results) res = reduce(res, r);
+	return res;
+}
+
+template<typename P>
+void ThreadPool::runPackaged(void *data, int, int) {
+	std::unique_ptr<P> task(static_cast<P *>(data));
+	(*task)();
+}
+
+template<class F, class... Args>
+auto ThreadPool::enqueue(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type> {
+	using return_type = typename std::result_of<F(Args...)>::type;
+	using Packaged = std::packaged_task<return_type()>;
+	Packaged *task = new Packaged(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+	std::future<return_type> res = task->get_future();
+	if (workers.empty()) {
+		runPackaged<Packaged>(task, 0, 0);
+		return res;
+	}
+	push(Task{&runPackaged<Packaged>, task, 0, 0});
+	return res;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "Trace.h"
+
+#include <algorithm>
+
+using namespace RSlic;
+
+void TraceRecorder::record(const TraceEvent &event) {
+	std::lock_guard<std::mutex> lock(mutex);
+	list.push_back(event);
+}
+
+std::vector<TraceEvent> TraceRecorder::events() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return list;
+}
+
+std::map<std::string, PhaseStats> TraceRecorder::phases() const {
+	std::map<std::string, PhaseStats> res;
+	std::map<std::string, bool> banded;
+	for (const TraceEvent &event: events()) {
+		PhaseStats &stats = res[event.phase];
+		const double ms = event.duration / 1e6;
+		if (event.band < 0) {
+			stats.calls++;
+			stats.wallMs += ms;
+			stats.threads = std::max(stats.threads, event.threads);
+		} else {
+			stats.busyMs += ms;
+			banded[event.phase] = true;
+		}
+		stats.distances += event.distances;
+		stats.pixels += event.pixels;
+		stats.bytes += event.bytes;
+	}
+	for (auto &phase: res) {
+		if (!banded[phase.first]) phase.second.busyMs = phase.second.wallMs;
+	}
+	return res;
+}
+
+void TraceRecorder::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	list.clear();
+}
+
+void TraceRecorder::writeChromeTrace(std::ostream &out) const {
+	const std::vector<TraceEvent> all = events();
+	int64_t start = all.empty() ? 0 : all.front().begin;
+	for (const TraceEvent &event: all) start = std::min(start, event.begin);
+	// small numbers for the tracks
+	std::vector<std::thread::id> threads;
+	out << "{\"traceEvents\": [";
+	for (size_t i = 0; i < all.size(); i++) {
+		const TraceEvent &event = all[i];
+		auto thread = std::find(threads.begin(), threads.end(), event.thread);
+		const size_t tid = thread - threads.begin();
+		if (thread == threads.end()) threads.push_back(event.thread);
+		out << (i == 0 ? "\n" : ",\n");
+		out << "{\"name\": \"" << event.phase;
+		if (event.band >= 0) out << " " << event.band;
+		out << "\", \"cat\": \"" << (event.band < 0 ? "phase" : "band") << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << tid
+			<< ", \"ts\": " << (event.begin - start) / 1000.0 << ", \"dur\": " << event.duration / 1000.0
+			<< ", \"args\": {\"threads\": " << event.threads << ", \"distances\": " << event.distances
+			<< ", \"pixels\": " << event.pixels << ", \"bytes\": " << event.bytes << "}}";
+	}
+	out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
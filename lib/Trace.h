@@ -0,0 +1,117 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace RSlic {
+
+ /**
+ * Whether the library reports to tracers (cmake option TRACING).
+ * Without it the hooks are compiled out and a tracer never gets an event.
+ */
+#ifdef TRACING
+ const bool tracingEnabled = true;
+#else
+ const bool tracingEnabled = false;
+#endif
+
+ /**
+ * One measured piece of work.
+ * The phases are "initialize", "assign" (distances and labels, Slic2 sums the features of its band there, too),
+ * "reduce" (combining the results of the bands), "centers" (the new centers), "slico" (updating the color maxima) and "finalize".
+ * A phase that is split into bands reports every band (band >= 0, in the thread that computed it)
+ * and the whole phase (band -1, in the calling thread).
+ */
+ struct TraceEvent {
+	 const char *phase = "";
+	 int band = -1;
+	 int threads = 1; // how many threads could work on the bands of the phase (1 if it is not split)
+	 std::thread::id thread;
+	 int64_t begin = 0; // ns (steady clock)
+	 int64_t duration = 0; // ns
+	 long distances = 0; // distance evaluations
+	 long pixels = 0; // pixels (voxels) visited
+	 size_t bytes = 0; // bytes of the buffers the phase allocated
+ };
+
+ /**
+ * Receives the events of the Slic2/Slic3 instances it is attached to (see initialize).
+ * record is called from the threads of the pool, too, so it has to be thread safe.
+ */
+ class Tracer {
+ public:
+	 virtual ~Tracer() {
+	 }
+
+	 virtual void record(const TraceEvent &event) = 0;
+ };
+
+ using TracerP = std::shared_ptr<Tracer>;
+
+ /**
+ * The sum of the events of one phase.
+ */
+ struct PhaseStats {
+	 long calls = 0;
+	 double wallMs = 0; // time of the whole phases
+	 double busyMs = 0; // time of the bands (= wallMs if the phase is not split)
+	 long distances = 0;
+	 long pixels = 0;
+	 size_t bytes = 0;
+	 int threads = 1;
+
+	 /**
+	 * How busy the threads were during the phase (0 to 1)
+	 */
+	 double utilisation() const {
+		 return wallMs <= 0 ? 0 : busyMs / (wallMs * threads);
+	 }
+ };
+
+ /**
+ * Tracer that keeps all events. They can be summed up per phase or written as Chrome trace.
+ */
+ class TraceRecorder : public Tracer {
+ public:
+	 void record(const TraceEvent &event) override;
+
+	 /**
+	 * Returns the events so far (in the order they ended)
+	 */
+	 std::vector<TraceEvent> events() const;
+
+	 /**
+	 * Sums the events up per phase
+	 * @return the stats of every phase that occurred
+	 */
+	 std::map<std::string, PhaseStats> phases() const;
+
+	 /**
+	 * Forgets all events
+	 */
+	 void clear();
+
+	 /**
+	 * Writes the events in the Trace Event Format (JSON), which chrome://tracing and Perfetto show as timeline.
+	 * Every thread gets its own track, the counters are the arguments of the events.
+	 * @param out the stream to write to
+	 */
+	 void writeChromeTrace(std::ostream &out) const;
+
+ private:
+	 mutable std::mutex mutex;
+	 std::vector<TraceEvent> list;
+ };
+
+ using TraceRecorderP = std::shared_ptr<TraceRecorder>;
+}
+
+#endif // TRACE_H
@@ -1,5 +1,9 @@
 #include "ClusterSet.h"
 #include "../priv/Useful.h"
+#include "../priv/Adjacency_p.h"
+#include "../priv/ClusterIndex_p.h"
+#include <ThreadPool.h>
+#include <climits>
 
 using namespace RSlic::Voxel;
 using RSlic::priv::aSize;
@@ -12,24 +16,29 @@ inline tuple<u_long, u_long, u_long> operator+(const tuple<u_long, u_long, u_lon
 	);
 }
 
-RSlic::Voxel::ClusterSet3::ClusterSet3(cv::Mat_<ClusterInt> clusters, int clusterCount)
-		: data{clusters, vector<Vec3i>(), clusterCount, false} {
+template<typename Label>
+RSlic::Voxel::ClusterSet3T<Label>::ClusterSet3T(cv::Mat_<Label> clusters, int clusterCount)
+		: data{clusters, vector<Vec3i>(), clusterCount, false, false, AdjacencyGraph(), false, VoxelIndex()} {
 }
 
-Mat_<ClusterInt> RSlic::Voxel::ClusterSet3::getClusterLabel() const {
+template<typename Label>
+Mat_<Label> RSlic::Voxel::ClusterSet3T<Label>::getClusterLabel() const {
 	return data.clusterLabel;
 }
 
-const vector<Vec3i> &RSlic::Voxel::ClusterSet3::getCenters() const {
+template<typename Label>
+const vector<Vec3i> &RSlic::Voxel::ClusterSet3T<Label>::getCenters() const {
 	if (!data.centers_calculated) refindCenters();
 	return data.centers;
 }
 
-int RSlic::Voxel::ClusterSet3::clusterCount() const {
+template<typename Label>
+int RSlic::Voxel::ClusterSet3T<Label>::clusterCount() const {
 	return data._clusterCount;
 }
 
-void RSlic::Voxel::ClusterSet3::refindCenters() const {
+template<typename Label>
+void RSlic::Voxel::ClusterSet3T<Label>::refindCenters() const {
 	std::lock_guard<std::mutex> guard(mutex);
 	if (data.centers_calculated) return;
 	int w = data.clusterLabel.size[1];
@@ -38,10 +47,11 @@ void RSlic::Voxel::ClusterSet3::refindCenters() const {
 	vector<u_long> centersCounts(data._clusterCount, 0);
 	vector<tuple<u_long, u_long, u_long>> centerCoord(data._clusterCount, make_tuple(0l, 0l, 0l));
 
-	for (int x = 0; x < w; x++) {
-		for (int y = 0; y < h; y++) {
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const Label *row = data.clusterLabel.template ptr<Label>(y, x);
 			for (int t = 0; t < d; t++) {
-				ClusterInt idx = data.clusterLabel.at<ClusterInt>(y, x, t);
+				Label idx = row[t];
 				if (idx < 0) continue;
 				centersCounts[idx] = centersCounts[idx] + 1;
 				centerCoord[idx] = centerCoord[idx] + make_tuple(static_cast<u_long>(x), static_cast<u_long>(y), static_cast<u_long>(t));
@@ -51,11 +61,11 @@ void RSlic::Voxel::ClusterSet3::refindCenters() const {
 
 	for (int i = 0; i < data._clusterCount; i++) {
 		auto counts = centersCounts[i];
-		assert(counts > 0);
-		/*if (counts == 0) {
-			centers.push_back(Vec3i(0, 0, 0));
+		if (counts == 0) {
+			// like Pixel (e.g. a carried cluster of Slic3Stream that lost all of its voxels)
+			data.centers.emplace_back(0, 0, 0);
 			continue;
-		}*/
+		}
 		data.centers.emplace_back(
 				std::get<0>(centerCoord[i]) / counts,
 				std::get<1>(centerCoord[i]) / counts,
@@ -64,52 +74,116 @@ void RSlic::Voxel::ClusterSet3::refindCenters() const {
 	data.centers_calculated = true;
 }
 
-Mat RSlic::Voxel::ClusterSet3::maskOfCluster(ClusterInt idx) const {
-	int w = data.clusterLabel.size[1];
-	int h = data.clusterLabel.size[0];
-	int d = data.clusterLabel.size[2];
-	cv::Mat res = cv::Mat(3, data.clusterLabel.size, CV_8U);
-	for (int x = 0; x < w; x++) {
+template<typename Label>
+Mat RSlic::Voxel::ClusterSet3T<Label>::maskOfCluster(Label idx) const {
+	cv::Mat res = cv::Mat::zeros(3, data.clusterLabel.size, CV_8U);
+	if (idx < 0 || idx >= clusterCount()) { // not in the index (e.g. -1 = no cluster)
+		int w = data.clusterLabel.size[1];
+		int h = data.clusterLabel.size[0];
+		int d = data.clusterLabel.size[2];
 		for (int y = 0; y < h; y++) {
-			for (int t = 0; t < d; t++) {
-				if (data.clusterLabel.at<ClusterInt>(y, x, t) == idx)
-					res.at<uint8_t>(y, x, t) = 1;
+			for (int x = 0; x < w; x++) {
+				const Label *row = data.clusterLabel.template ptr<Label>(y, x);
+				uint8_t *resRow = res.ptr<uint8_t>(y, x);
+				for (int t = 0; t < d; t++) {
+					resRow[t] = row[t] == idx ? 1 : 0;
+				}
 			}
 		}
+		return res;
 	}
+	uint8_t *resData = res.ptr<uint8_t>(0); // continuous, same order as the elements of the index
+	const VoxelIndex &index = voxelIndex();
+	for (const int64_t *it = index.begin(idx); it != index.end(idx); ++it) resData[*it] = 1;
 	return res;
 }
 
+template<typename Label>
+Mat RSlic::Voxel::ClusterSet3T<Label>::maskOfCluster(Label idx, Vec3i &origin) const {
+	origin = Vec3i(0, 0, 0);
+	if (idx < 0 || idx >= clusterCount() || voxelIndex().size(idx) == 0) return Mat();
+	Vec3i lo(INT_MAX, INT_MAX, INT_MAX), hi(-1, -1, -1);
+	forEachVoxel(idx, [&](int y, int x, int t) {
+		lo = Vec3i(std::min(lo[0], x), std::min(lo[1], y), std::min(lo[2], t));
+		hi = Vec3i(std::max(hi[0], x), std::max(hi[1], y), std::max(hi[2], t));
+	});
+	origin = lo;
+	const int size[] = {hi[1] - lo[1] + 1, hi[0] - lo[0] + 1, hi[2] - lo[2] + 1};
+	cv::Mat res = cv::Mat::zeros(3, size, CV_8U);
+	forEachVoxel(idx, [&](int y, int x, int t) {
+		res.ptr<uint8_t>(y - lo[1], x - lo[0])[t - lo[2]] = 1;
+	});
+	return res;
+}
 
-namespace {
- inline void setClusterAdjacent(Mat &m, int p1, int p2) {
-	 m.at<uint8_t>(p1, p2) = 1;
-	 m.at<uint8_t>(p2, p1) = 1;
- }
+template<typename Label>
+const RSlic::VoxelIndex &RSlic::Voxel::ClusterSet3T<Label>::voxelIndex() const {
+	if (!data.index_calculated) refindIndex();
+	return data.index;
 }
 
-cv::Mat RSlic::Voxel::ClusterSet3::adjacentMatrix() const {
-	int size = clusterCount();
-	Mat res = Mat::eye(size, size, CV_8UC1);
-	Mat_<ClusterInt> clusterMat = getClusterLabel();
-	int w = clusterMat.size[1];
-	int h = clusterMat.size[0];
-	int d = clusterMat.size[2];
-	static const int xNeighbour[] = {1, 0, 0, 1, 0, 1, 1};
-	static const int yNeighbour[aSize(xNeighbour)] = {0, 1, 0, 1, 1, 0, 1};
-	static const int zNeighbour[aSize(xNeighbour)] = {0, 0, 1, 0, 1, 1, 1};
-	for (int x = 0; x < w - 1; x++) {
-		for (int y = 0; y < h - 1; y++) {
-			for (int t = 0; t < d - 1; t++) {
-				ClusterInt currentCluster = clusterMat.at<RSlic::Voxel::ClusterInt>(y, x, t);
-				for (int i = 0; i < aSize(xNeighbour); i++) {
-					ClusterInt otherCluster = clusterMat.at<RSlic::Voxel::ClusterInt>(y + yNeighbour[i], x + xNeighbour[i], t + zNeighbour[i]);
-					if (currentCluster != otherCluster) {
-						setClusterAdjacent(res, currentCluster, otherCluster);
+template<typename Label>
+void RSlic::Voxel::ClusterSet3T<Label>::refindIndex() const {
+	std::lock_guard<std::mutex> guard(indexMutex);
+	if (data.index_calculated) return;
+	const Mat_<Label> &clusterMat = data.clusterLabel;
+	const int w = clusterMat.size[1];
+	const int h = clusterMat.size[0];
+	const int d = clusterMat.size[2];
+	data.index = RSlic::priv::clusterIndex<int64_t>(ThreadPool::defaultPool().get(), h, clusterCount(), [&](int begin, int end, RSlic::priv::IndexVisitor<int64_t> &visit) {
+		for (int y = begin; y < end; y++) {
+			for (int x = 0; x < w; x++) {
+				const Label *row = clusterMat.template ptr<Label>(y, x);
+				const int64_t first = (static_cast<int64_t>(y) * w + x) * d;
+				for (int t = 0; t < d; t++) visit(row[t], first + t);
+			}
+		}
+	});
+	data.index_calculated = true;
+}
+
+
+template<typename Label>
+const RSlic::AdjacencyGraph &RSlic::Voxel::ClusterSet3T<Label>::adjacencyGraph() const {
+	if (!data.graph_calculated) refindAdjacent();
+	return data.graph;
+}
+
+template<typename Label>
+cv::Mat RSlic::Voxel::ClusterSet3T<Label>::adjacentMatrix() const {
+	return adjacencyGraph().denseMatrix();
+}
+
+template<typename Label>
+void RSlic::Voxel::ClusterSet3T<Label>::refindAdjacent() const {
+	std::lock_guard<std::mutex> guard(graphMutex);
+	if (data.graph_calculated) return;
+	const Mat_<Label> &clusterMat = data.clusterLabel;
+	const int w = clusterMat.size[1];
+	const int h = clusterMat.size[0];
+	const int d = clusterMat.size[2];
+	// the 13 neighbours after a voxel (26-neighbourhood): the first three are along the axes (they count for the boundary), the others are diagonal
+	static const int xNeighbour[] = {1, 0, 0, 1, 1, 1, 1, -1, -1, -1, 0, 0, 1};
+	static const int yNeighbour[aSize(xNeighbour)] = {0, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 0};
+	static const int zNeighbour[aSize(xNeighbour)] = {0, 0, 1, -1, 0, 1, 1, -1, 0, 1, -1, 1, -1};
+	data.graph = RSlic::priv::adjacencyGraph(ThreadPool::defaultPool().get(), h, clusterCount(), [&](int begin, int end, RSlic::priv::EdgeCollector &add) {
+		for (int y = begin; y < end; y++) {
+			for (int x = 0; x < w; x++) {
+				const Label *row = clusterMat.template ptr<Label>(y, x);
+				for (size_t i = 0; i < aSize(xNeighbour); i++) {
+					if (y + yNeighbour[i] >= h || x + xNeighbour[i] < 0 || x + xNeighbour[i] >= w) continue;
+					const Label *otherRow = clusterMat.template ptr<Label>(y + yNeighbour[i], x + xNeighbour[i]) + zNeighbour[i];
+					const int length = i < 3 ? 1 : 0;
+					const int tEnd = std::min(d, d - zNeighbour[i]);
+					for (int t = std::max(0, -zNeighbour[i]); t < tEnd; t++) {
+						if (row[t] != otherRow[t]) add(row[t], otherRow[t], length);
 					}
 				}
 			}
 		}
-	}
-	return res;
+	});
+	data.graph_calculated = true;
 }
+
+template class RSlic::Voxel::ClusterSet3T<int16_t>;
+template class RSlic::Voxel::ClusterSet3T<int32_t>;
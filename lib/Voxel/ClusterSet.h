@@ -2,36 +2,51 @@
 #define ClUSTERSET3_H
 
 #include <vector>
+#include <mutex>
+#include <type_traits>
 #include <opencv2/core/core.hpp>
+#include <AdjacencyGraph.h>
+#include <ClusterIndex.h>
+#include "../priv/Useful.h"
 
 using namespace std;
 using namespace cv;
 
 namespace RSlic {
  namespace Voxel {
+  /**
+  * Default label type (int32_t).
+  * Use int16_t (e.g. ClusterSet3_16, Slic3T<int16_t>) to save memory if there are less than 32767 clusters.
+  * @see withClusterInt
+  */
   using ClusterInt=int; //int32_t
 
+  using RSlic::priv::withClusterInt;
+
 /**
 * @brief Representing cluster (also called "Supervoxel") with some functionality
+* @tparam Label the type of the cluster label (int16_t or int32_t)
 */
-  class ClusterSet3 {
+  template<typename Label>
+  class ClusterSet3T {
   public:
+	  static_assert(std::is_signed<Label>::value && std::is_integral<Label>::value, "Label has to be a signed integer");
 
-	  ClusterSet3() : data{Mat_<ClusterInt>(), vector<Vec3i>(), 0, false} {
+	  ClusterSet3T() : data{Mat_<Label>(), vector<Vec3i>(), 0, false, false, AdjacencyGraph(), false, VoxelIndex()} {
 	  }
 
-	  ClusterSet3(ClusterSet3 &&other) : data(std::move(other.data)) {
+	  ClusterSet3T(ClusterSet3T &&other) : data(std::move(other.data)) {
 	  }
 
-	  ClusterSet3(const ClusterSet3 &other) : data(other.data) {
+	  ClusterSet3T(const ClusterSet3T &other) : data(other.data) {
 	  }
 
-	  ClusterSet3 &operator=(ClusterSet3 &&other) {
+	  ClusterSet3T &operator=(ClusterSet3T &&other) {
 		  data = std::move(other.data);
 		  return *this;
 	  }
 
-	  ClusterSet3 &operator=(const ClusterSet3 &other) {
+	  ClusterSet3T &operator=(const ClusterSet3T &other) {
 		  data = other.data;
 		  return *this;
 	  }
@@ -44,7 +59,7 @@ namespace RSlic {
 	  template<typename T, typename= typename std::enable_if<
 			  std::is_same<vector<Vec3i>, typename std::decay<T>::type>::value
 	  >::type>
-	  ClusterSet3(T &&_centers, cv::Mat_<ClusterInt> _clusters) : data{_clusters, std::forward<T>(_centers), 0, true} {
+	  ClusterSet3T(T &&_centers, cv::Mat_<Label> _clusters) : data{_clusters, std::forward<T>(_centers), 0, true, false, AdjacencyGraph(), false, VoxelIndex()} {
 		  data._clusterCount = data.centers.size();
 	  }
 
@@ -55,22 +70,71 @@ namespace RSlic {
 	  * @param clusterCount the amount of the clusters
 	  * @see getCenters()
 	  */
-	  ClusterSet3(cv::Mat_<ClusterInt> clusters, int clusterCount);
+	  ClusterSet3T(cv::Mat_<Label> clusters, int clusterCount);
 
 
 	  /**
 	  * Returns a mask of the cluster with the number idx.
+	  * Only the voxels of the cluster are visited (see voxelIndex()).
 	  * @param idx Clusters index
 	  * @return binary mask.
 	  */
-	  Mat maskOfCluster(ClusterInt idx) const; // Binäres Bild. 0 => gehört nicht dazu, 1 => gehört dazu
+	  Mat maskOfCluster(Label idx) const; // Binäres Bild. 0 => gehört nicht dazu, 1 => gehört dazu
+
+	  /**
+	  * Returns the mask of the cluster with the number idx cropped to its bounding box (3-Dim, same order as the cluster label).
+	  * The costs depend only on the size of the cluster, not on the size of the movie.
+	  * @param idx Clusters index
+	  * @param origin is set to the first corner (x, y, t) of the bounding box
+	  * @return binary mask of the size of the bounding box (empty if the cluster has no voxel)
+	  */
+	  Mat maskOfCluster(Label idx, Vec3i &origin) const;
+
+	  /**
+	  * Returns the voxels of every cluster (compressed rows, element = (y * width + x) * duration + t).
+	  * This is a lazy-evaluation (one counting sort, computed in parallel).
+	  * @return the index
+	  */
+	  const VoxelIndex &voxelIndex() const;
+
+	  /**
+	  * Calls f(y, x, t) for every voxel of the cluster with the number idx (in the storage order of the cluster label).
+	  * @param idx Clusters index
+	  * @param f the functor
+	  */
+	  template<typename F>
+	  void forEachVoxel(Label idx, F f) const {
+		  const VoxelIndex &index = voxelIndex();
+		  const int64_t w = data.clusterLabel.size[1];
+		  const int64_t d = data.clusterLabel.size[2];
+		  for (const int64_t *it = index.begin(idx); it != index.end(idx); ++it) {
+			  const int64_t yx = *it / d;
+			  f(static_cast<int>(yx / w), static_cast<int>(yx % w), static_cast<int>(*it % d));
+		  }
+	  }
+
+	  /**
+	  * Returns the values of the movie at all voxels of the cluster with the number idx.
+	  * @tparam T element type of the images (e.g. Vec3b)
+	  * @param movie anything with at<T>(y, x, t), e.g. MovieFrames of the whole movie
+	  * @param idx Clusters index
+	  * @return the values
+	  */
+	  template<typename T, typename M>
+	  vector<T> gather(const M &movie, Label idx) const {
+		  const VoxelIndex &index = voxelIndex();
+		  vector<T> res;
+		  res.reserve(index.size(idx));
+		  forEachVoxel(idx, [&](int y, int x, int t) { res.push_back(movie.template at<T>(y, x, t)); });
+		  return res;
+	  }
 
 
 	  /**
 	  * Returns a Mat m where where m[x,y]=i means that the point x,y belongs to the cluster with the number i
 	  * @return Mat with the cluster label
 	  */
-	  Mat_<ClusterInt> getClusterLabel() const;
+	  Mat_<Label> getClusterLabel() const;
 
 	  /**
 	  * Returns the central points of the clusters.
@@ -92,16 +156,25 @@ namespace RSlic {
 	  * @param x x-coordinate
 	  * @return cluster index
 	  */
-	  inline ClusterInt at(int y, int x, int t) const {
-		  return data.clusterLabel.at<ClusterInt>(y, x, t);
+	  inline Label at(int y, int x, int t) const {
+		  return data.clusterLabel.template at<Label>(y, x, t);
 	  }
 
+	  /**
+	  * Returns the region adjacency graph: the neighbours of every cluster (26-neighbourhood, the same ones as in adjacentMatrix)
+	  * and the length (area) of the boundaries they share. It only needs memory for the edges.
+	  * This is a lazy-evaluation (computed in parallel).
+	  * @return the graph
+	  */
+	  const AdjacencyGraph &adjacencyGraph() const;
+
 	  /**
 	  * Returns the adjacent matrix m (type CV_8UC1).
 	  * If m[x,y] == 1 then the cluster with number x
 	  * and the cluster with number y are neighbor.
 	  * It is always m[x,x] == 1 and if m[x,y]==1
 	  * it means that m[y,x] == 1.
+	  * It is built from adjacencyGraph() on every call and needs clusterCount()² bytes, so prefer the graph for many clusters.
 	  * @return adjacent matrix.
 	  */
 	  cv::Mat adjacentMatrix() const;
@@ -116,18 +189,29 @@ namespace RSlic {
 
 		  nonspecial &operator=(nonspecial &&other) = default;
 
-		  Mat_<ClusterInt> clusterLabel; //3-Dim
+		  Mat_<Label> clusterLabel; //3-Dim
 
 		  mutable vector<Vec3i> centers;
 		  int _clusterCount;
 		  mutable bool centers_calculated;
+		  mutable bool graph_calculated;
+		  mutable AdjacencyGraph graph;
+		  mutable bool index_calculated;
+		  mutable VoxelIndex index;
 	  } data;
 
-	  mutable std::mutex mutex;
+	  mutable std::mutex mutex, graphMutex, indexMutex;
 
 	  void refindCenters() const;
+
+	  void refindAdjacent() const; //computes adjacency graph -> data.graph
+
+	  void refindIndex() const; //computes voxel index -> data.index
   };
 
+  using ClusterSet3 = ClusterSet3T<ClusterInt>;
+  using ClusterSet3_16 = ClusterSet3T<int16_t>;
+
  }
 }
 #endif
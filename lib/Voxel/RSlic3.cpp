@@ -1,7 +1,8 @@
 #include "RSlic3.h"
 #include <priv/ZeroSlico_p.h>
-#include <3rd/ThreadPool.h>
+#include <ThreadPool.h>
 #include <priv/Useful.h>
+#include <priv/Trace_p.h>
 #include "RSlic3_impl.h"
 #include <atomic>
 
@@ -16,12 +17,39 @@ using RSlic::priv::aSize;
 using namespace RSlic::Voxel;
 
 
-ThreadPoolP Slic3::threadpool() const {
+template<typename Label>
+ThreadPoolP Slic3T<Label>::threadpool() const {
 	return setting->pool;
 }
 
-Slic3P Slic3::initialize(const MovieCacheP &img, const GradFunc &grad,  int step, int stiffness, ThreadPoolP pool) {
-	Slic3::Settings *setting = new Slic3::Settings();
+template<typename Label>
+RSlic::TracerP Slic3T<Label>::tracer() const {
+	return setting->tracer;
+}
+
+template<typename Label>
+Slic3TP<Label> Slic3T<Label>::initialize(const MovieCacheP &img, const GradFunc &grad,  int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	return create(img, grad, step, stiffness, nullptr, pool, tracer);
+}
+
+template<typename Label>
+Slic3TP<Label> Slic3T<Label>::initialize(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, const vector<Vec3i> &seeds, ThreadPoolP pool, TracerP tracer) {
+	return create(img, grad, step, stiffness, &seeds, pool, tracer);
+}
+
+template<typename Label>
+Slic3TP<Label> Slic3T<Label>::initialize(const MovieCacheP &img, int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	return create(img, GradFunc(), step, stiffness, nullptr, pool, tracer);
+}
+
+template<typename Label>
+Slic3TP<Label> Slic3T<Label>::initialize(const MovieCacheP &img, int step, int stiffness, const vector<Vec3i> &seeds, ThreadPoolP pool, TracerP tracer) {
+	return create(img, GradFunc(), step, stiffness, &seeds, pool, tracer);
+}
+
+template<typename Label>
+Slic3TP<Label> Slic3T<Label>::create(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, const vector<Vec3i> *seeds, ThreadPoolP pool, TracerP tracer) {
+	Settings *setting = new Settings();
 	setting->img = img;
 	setting->step = step;
 	setting->stiffness = stiffness;
@@ -30,23 +58,32 @@ Slic3P Slic3::initialize(const MovieCacheP &img, const GradFunc &grad,  int step
 		setting->initThread();
 	else
 		setting->pool = pool;
-
-	Slic3 *res = new Slic3(setting);
-	res->init();
-	if (res->clusters.clusterCount() == 0) {
+	setting->tracer = tracer;
+
+	Slic3T *res = new Slic3T(setting);
+	{
+		RSlic::priv::TraceScope trace(tracer.get(), "initialize");
+		res->init(seeds);
+		trace.count(0, static_cast<long>(res->clusters.getClusterLabel().total()));
+		trace.allocated(RSlic::priv::matBytes(res->clusters.getClusterLabel()) + RSlic::priv::matBytes(res->distance));
+	}
+	const int count = res->clusters.clusterCount();
+	if (count == 0 || count > std::numeric_limits<Label>::max()) {
 		delete res;
-		return Slic3P();
+		return Slic3TP<Label>();
 	}
-	return Slic3P(res);
+	return Slic3TP<Label>(res);
 }
 
-RSlic::Voxel::Slic3::Slic3(Settings *s, ClusterSet3 &&set, const Mat &d) : clusters(std::move(set)), distance(d) {
+template<typename Label>
+RSlic::Voxel::Slic3T<Label>::Slic3T(Settings *s, ClusterSet3T<Label> &&set, const Mat &d) : clusters(std::move(set)), distance(d) {
 	assert(s != nullptr);
 	setting = s;
 	s->__refcount++;
 }
 
-RSlic::Voxel::Slic3::~Slic3() {
+template<typename Label>
+RSlic::Voxel::Slic3T<Label>::~Slic3T() {
 	int count = --setting->__refcount;
 	if (count == 0) {
 		delete setting;
@@ -78,49 +115,134 @@ namespace {
 	 return minPos;
  }
 
+ inline int intensity(const uint8_t &v) {
+	 return v;
+ }
+
+ inline int intensity(const Vec3b &v) {
+	 return v[0] + v[1] + v[2];
+ }
+
+ // The built-in gradient (squared): differences of the neighbours in x, y and t (the nearest voxel at the borders)
+ // frames has to contain t - 1 to t + 1 (as far as they exist)
+ template<typename T>
+ inline int gradient(const MovieFrames &frames, int w, int h, int x, int y, int t) {
+	 const T *row = frames.row<T>(y, t);
+	 const int dx = intensity(row[std::min(w - 1, x + 1)]) - intensity(row[std::max(0, x - 1)]);
+	 const int dy = intensity(frames.at<T>(std::min(h - 1, y + 1), x, t)) - intensity(frames.at<T>(std::max(0, y - 1), x, t));
+	 const int dt = intensity(frames.at<T>(y, x, std::min(frames.end() - 1, t + 1))) - intensity(frames.at<T>(y, x, std::max(frames.begin(), t - 1)));
+	 return dx * dx + dy * dy + dt * dt;
+ }
+
+ // Same as above with the built-in gradient, frames has to contain center[2] - 2 to center[2] + 2 (as far as they exist)
+ template<typename T>
+ Vec3i find_local_minimum(const MovieFrames &frames, int w, int h, int duration, const Vec3i &center) {
+	 auto px = center[0];
+	 auto py = center[1];
+	 auto pt = center[2];
+	 int min_value = std::numeric_limits<int>::max();
+	 cv::Vec3i minPos = center;
+	 for (int x = std::max(px - 1, 0); x < std::min(w, px + 2); x++) {
+		 for (int y = std::max(0, py - 1); y < std::min(h, py + 2); y++) {
+			 for (int t = std::max(0, pt - 1); t < std::min(duration, pt + 2); t++) {
+				 auto currentVal = gradient<T>(frames, w, h, x, y, t);
+				 if (currentVal < min_value) {
+					 min_value = currentVal;
+					 minPos = Vec3i(x, y, t);
+				 }
+			 }
+		 }
+	 }
+	 return minPos;
+ }
+
+ Vec3i find_local_minimum(const MovieFrames &frames, int type, int w, int h, int duration, const Vec3i &center) {
+	 if (type == CV_8UC3) return find_local_minimum<Vec3b>(frames, w, h, duration, center);
+	 if (type == CV_8UC1) return find_local_minimum<uint8_t>(frames, w, h, duration, center);
+	 return center;
+ }
 }
 
-void RSlic::Voxel::Slic3::init() {
+template<typename Label>
+void RSlic::Voxel::Slic3T<Label>::init(const vector<Vec3i> *seeds) {
 	int s = setting->step;
 	int w = setting->img->width();
 	int h = setting->img->height();
 	int d = setting->img->duration();
 	std::vector<Vec3i> centerGrid;
-	centerGrid.reserve(w * h * d / s / s / s);
-	// initialize the grid and set the minimum of the gradient at once
-	for (int x = s; x < w - s / 2; x += s) {
-		for (int y = s; y < h - s / 2; y += s) {
-			for (int t = s; t < d - s / 2; t += s) {
-				Vec3i p(x, y, t);
-				centerGrid.push_back(find_local_minimum(setting->img, setting->gradFunc, p)); 
+	const MovieCacheP &img = setting->img;
+	const int type = img->type();
+	// a GradFunc may not be thread-safe, the built-in gradient is computed in parallel (straight from the pinned images)
+	const bool builtin = !setting->gradFunc;
+	if (seeds != nullptr) {
+		centerGrid.resize(seeds->size());
+		RSlic::priv::forEachBand(builtin ? setting->pool.get() : nullptr, seeds->size(), [&](int, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				const Vec3i &seed = (*seeds)[i];
+				// the gradient needs the neighbours of every point that is searched
+				Vec3i p(std::min(std::max(seed[0], 2), w - 3), std::min(std::max(seed[1], 2), h - 3), std::min(std::max(seed[2], 2), d - 3));
+				if (builtin) centerGrid[i] = find_local_minimum(img->frames(p[2] - 2, p[2] + 3), type, w, h, d, p);
+				else centerGrid[i] = find_local_minimum(img, setting->gradFunc, p);
 			}
-		}
+		});
+	} else {
+		// initialize the grid and set the minimum of the gradient at once
+		// (image by image, so a cache has to keep only a few of them; the order of the centers is x, y, t nevertheless)
+		const int nx = std::max(0, (w - s / 2 - 1) / s);
+		const int ny = std::max(0, (h - s / 2 - 1) / s);
+		const int nt = std::max(0, (d - s / 2 - 1) / s);
+		centerGrid.resize(nx * ny * nt);
+		RSlic::priv::forEachBand(builtin ? setting->pool.get() : nullptr, nt, [&](int, int begin, int end) {
+			for (int it = begin; it < end; it++) {
+				const int t = s + it * s;
+				img->prefetch(t - 2, t + s + 3);
+				const MovieFrames frames = builtin ? img->frames(t - 2, t + 3) : MovieFrames();
+				for (int ix = 0; ix < nx; ix++) {
+					for (int iy = 0; iy < ny; iy++) {
+						Vec3i p(s + ix * s, s + iy * s, t);
+						centerGrid[(ix * ny + iy) * nt + it] = builtin ? find_local_minimum(frames, type, w, h, d, p) : find_local_minimum(img, setting->gradFunc, p);
+					}
+				}
+			}
+		});
 	}
 
 
 	int *size = setting->img->sizeArray();
-	Mat_<ClusterInt> label(3, size, -1);
+	Mat_<Label> label(3, size, -1);
 ;
 	delete size;
-	clusters = ClusterSet3(centerGrid, label);
+	clusters = ClusterSet3T<Label>(centerGrid, label);
 
 	max_dist_color = std::vector<double>(clusters.clusterCount(), 1); //for slico
 }
 
 
-int RSlic::Voxel::Slic3::getStep() const {
+template<typename Label>
+int RSlic::Voxel::Slic3T<Label>::getStep() const {
 	return setting->step;
 }
 
-int RSlic::Voxel::Slic3::getStiffness() const {
+template<typename Label>
+int RSlic::Voxel::Slic3T<Label>::getStiffness() const {
 	return setting->stiffness;
 }
 
-MovieCacheP RSlic::Voxel::Slic3::getImg() const {
+template<typename Label>
+MovieCacheP RSlic::Voxel::Slic3T<Label>::getImg() const {
 	return setting->img;
 }
 
 
-const ClusterSet3 &RSlic::Voxel::Slic3::getClusters() const {
+template<typename Label>
+const ClusterSet3T<Label> &RSlic::Voxel::Slic3T<Label>::getClusters() const {
 	return clusters;
 }
+
+template<typename Label>
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3T<Label>::getResidual() const {
+	return residual;
+}
+
+template class RSlic::Voxel::Slic3T<int16_t>;
+template class RSlic::Voxel::Slic3T<int32_t>;
@@ -9,7 +9,9 @@
 #include <ostream>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
+#include <Trace.h>
 #include "ClusterSet.h"
 
 
@@ -26,13 +28,103 @@ using ThreadPoolP=shared_ptr<ThreadPool>;
 namespace RSlic {
  namespace Voxel {
 
+  /**
+  * Pinned frames [begin, end) of a MovieCache.
+  * It holds the Mats of the frames, so they stay valid (even if the cache drops them) as long as the span exists.
+  * Accessing a voxel is just a pointer offset, no virtual call or Mat copy like with MovieCache::at.
+  */
+  class MovieFrames {
+  public:
+	  MovieFrames() : t0(0) {
+	  }
+
+	  /**
+	  * Pins the frames.
+	  * @param frames the images of the positions t0, t0 + 1, ...
+	  * @param t0 position of the first image
+	  */
+	  MovieFrames(std::vector<Mat> &&frames, int t0) : frames(std::move(frames)), t0(t0) {
+		  data.reserve(this->frames.size());
+		  steps.reserve(this->frames.size());
+		  for (const Mat &m: this->frames) {
+			  data.push_back(m.data);
+			  steps.push_back(m.step[0]);
+		  }
+	  }
+
+	  /**
+	  * Returns the pointer to row y of the image at position t (t has to be within [begin, end))
+	  */
+	  template<typename T>
+	  inline const T *row(int y, int t) const {
+		  return reinterpret_cast<const T *>(data[t - t0] + y * steps[t - t0]);
+	  }
+
+	  /**
+	  * Returns the value of the point x,y from the picture at position t (same as MovieCache::at)
+	  */
+	  template<typename T>
+	  inline const T &at(int y, int x, int t) const {
+		  return row<T>(y, t)[x];
+	  }
+
+	  /**
+	  * Returns the value of the point v (x, y, t)
+	  */
+	  template<typename T>
+	  inline const T &at(const Vec3i &v) const {
+		  return row<T>(v[1], v[2])[v[0]];
+	  }
+
+	  /**
+	  * Returns the image at position t (t has to be within [begin, end))
+	  */
+	  inline const Mat &matAt(int t) const {
+		  return frames[t - t0];
+	  }
+
+	  /**
+	  * Position of the first pinned frame
+	  */
+	  inline int begin() const {
+		  return t0;
+	  }
+
+	  /**
+	  * Position after the last pinned frame
+	  */
+	  inline int end() const {
+		  return t0 + static_cast<int>(frames.size());
+	  }
+
+  private:
+	  std::vector<Mat> frames;
+	  std::vector<const uint8_t *> data;
+	  std::vector<size_t> steps;
+	  int t0;
+  };
+
   /**
   * Abstract class for managing the pictures of a sequence for the Supervoxel algorithm.
   * (E.g. load and destroy images if memory is low)
   * By subclassing it you have to make sure that are pictures have the same type and size.
+  * For reading many voxels take a MovieFrames span (frames()) instead of at(), at() calls matAt for every voxel.
   */
   class MovieCache {
   public:
+	  MovieCache() : cachedHeight(-1), cachedWidth(-1), cachedType(-1) {
+	  }
+
+	  // The metadata is not copied, it will be loaded again
+	  MovieCache(const MovieCache &) : MovieCache() {
+	  }
+
+	  MovieCache &operator=(const MovieCache &) {
+		  return *this;
+	  }
+
+	  virtual ~MovieCache() {
+	  }
 
 	  /**
 	  * Returns the image at the position t
@@ -41,6 +133,49 @@ namespace RSlic {
 	  */
 	  virtual Mat matAt(int t) const = 0;
 
+	  /**
+	  * Pins the images of the positions [t0, t1) for fast access.
+	  * The default calls matAt once per image, subclasses may load them at once.
+	  * @param t0 first position
+	  * @param t1 position after the last one (will be clipped to the duration)
+	  * @return the pinned frames
+	  */
+	  virtual MovieFrames frames(int t0, int t1) const {
+		  t0 = std::max(0, t0);
+		  t1 = std::min(duration(), t1);
+		  std::vector<Mat> res;
+		  res.reserve(std::max(0, t1 - t0));
+		  for (int t = t0; t < t1; t++) res.push_back(matAt(t));
+		  return MovieFrames(std::move(res), t0);
+	  }
+
+	  /**
+	  * Pins all images (see frames(t0, t1))
+	  * @return the pinned frames
+	  */
+	  inline MovieFrames frames() const {
+		  return frames(0, duration());
+	  }
+
+	  /**
+	  * Returns how many images should be pinned at once (at least 1).
+	  * The Voxel iteration walks through the movie in slabs of this size, so a cache that keeps only some
+	  * images in memory is not forced to load all of them. The default is the whole movie.
+	  * @return amount of images
+	  */
+	  virtual int windowSize() const {
+		  return duration();
+	  }
+
+	  /**
+	  * Hint that the images of the positions [t0, t1) will be needed soon.
+	  * A cache that loads images may start loading them in the background. The default does nothing.
+	  * @param t0 first position
+	  * @param t1 position after the last one
+	  */
+	  virtual void prefetch(int /*t0*/, int /*t1*/) const {
+	  }
+
 	  /**
 	  * Returns the value of the point x,y from the picture at position t
 	  * (Similar to Mat::at)
@@ -76,7 +211,8 @@ namespace RSlic {
 	  * @return the width
 	  */
 	  inline int width() const {
-		  return matAt(0).size[1];
+		  loadMetadata();
+		  return cachedWidth.load(std::memory_order_relaxed);
 	  }
 
 	  /**
@@ -84,7 +220,8 @@ namespace RSlic {
 	  * @return the height
 	  */
 	  inline int height() const {
-		  return matAt(0).size[0];
+		  loadMetadata();
+		  return cachedHeight.load(std::memory_order_relaxed);
 	  }
 
 	  /**
@@ -92,7 +229,7 @@ namespace RSlic {
 	  * @returns size tuple
 	  */
 	  inline tuple<int, int, int> sizeTuple() const {
-		  return std::make_tuple(matAt(0).size[0], matAt(0).size[1], duration());
+		  return std::make_tuple(height(), width(), duration());
 	  }
 
 
@@ -103,8 +240,8 @@ namespace RSlic {
 	  */
 	  inline int *sizeArray() const {
 		  int *res = new int[3];
-		  res[0] = matAt(0).size[0];
-		  res[1] = matAt(0).size[1];
+		  res[0] = height();
+		  res[1] = width();
 		  res[2] = duration();
 		  return res;
 	  }
@@ -114,29 +251,84 @@ namespace RSlic {
 	  * @returns image type
 	  */
 	  inline int type() const {
-		  return matAt(0).type();
+		  loadMetadata();
+		  return cachedType.load(std::memory_order_relaxed);
+	  }
+
+  private:
+	  //Reads size and type from the first image (only once, they are the same for all images)
+	  inline void loadMetadata() const {
+		  if (cachedType.load(std::memory_order_acquire) >= 0) return;
+		  Mat first = matAt(0);
+		  cachedHeight.store(first.size[0], std::memory_order_relaxed);
+		  cachedWidth.store(first.size[1], std::memory_order_relaxed);
+		  cachedType.store(first.type(), std::memory_order_release);
 	  }
+
+	  mutable std::atomic<int> cachedHeight, cachedWidth, cachedType;
   };
 
   using  MovieCacheP=shared_ptr<MovieCache>;
 
 
 
+  /**
+  * How much an iteration changed the clusters.
+  */
+  struct Residual {
+	  /**
+	  * Sum of the distances the centers moved (in voxel)
+	  */
+	  double displacement = DINF;
+
+	  /**
+	  * Fraction of the voxels that got another label (0 to 1).
+	  * If it is 0, further iterations won't change anything.
+	  */
+	  double changed = 1;
+  };
+
   using DistanceFunc = function<double(const Vec3i & /*point*/, const Vec3i & /*clusterCenter*/, const MovieCacheP &/*img*/, int /*stiffness*/, int /*step*/)>;
   using GradFunc = function<double(const MovieCacheP &, const Vec3i &)>;
 
-  class Slic3;
+  struct AssignmentInputs;
+
+  template<typename Label>
+  class Slic3T;
+
+  template<typename Label>
+  class Slic3EngineT;
 
-  using Slic3P = shared_ptr<Slic3>;
+  template<typename Label>
+  using Slic3TP = shared_ptr<Slic3T<Label>>;
 
-  class Slic3 {
+  using Slic3 = Slic3T<ClusterInt>;
+
+  using Slic3P = Slic3TP<ClusterInt>;
+
+  using Slic3_16 = Slic3T<int16_t>;
+
+  using Slic3P16 = Slic3TP<int16_t>;
+
+  /**
+  * The Slic algorithm for picture sequences.
+  * @tparam Label the type of the cluster label (int16_t or int32_t).
+  * int16_t needs half the memory, but is only able to number 32767 clusters.
+  * @see withClusterInt
+  */
+  template<typename Label>
+  class Slic3T {
   private:
 	  struct Settings;
 
+	  friend class Slic3EngineT<Label>;
+
   public:
-	  Slic3(const Slic3 &other) = delete;
+	  using ClusterSetType = ClusterSet3T<Label>;
+
+	  Slic3T(const Slic3T &other) = delete;
 
-	  Slic3(Slic3 &&other) = default;
+	  Slic3T(Slic3T &&other) = default;
 
 	  /**
 	  * initialize the algorithm. It build the gradient and set the needed values
@@ -144,11 +336,50 @@ namespace RSlic {
 	  * @param a function to calculate the gradient
 	  * @param step how many pixel should belongs (approximately) to a clusters
 	  * @param stiffness the stiffness value
-	  * @param pool ThreadPool for computing parallel.
-	  * @return SharedPointer of the Slic3-Object. (Error -> nullptr)
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of this and all following instances (see Trace.h, may be empty)
+	  * @return SharedPointer of the Slic3-Object. (Error -> nullptr, e.g. if Label is not able to number all clusters)
 	  * @see iterate
 	  */
-	  static Slic3P initialize(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, ThreadPoolP pool = ThreadPoolP());
+	  static Slic3TP<Label> initialize(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * initialize the algorithm with the given centers instead of the grid (e.g. the clusters of the last window when streaming).
+	  * Like the grid every center is moved to the minimum of the gradient in its neighbourhood.
+	  * @param img the MoveCache
+	  * @param a function to calculate the gradient
+	  * @param step how many pixel should belongs (approximately) to a clusters
+	  * @param stiffness the stiffness value
+	  * @param seeds the centers (x, y, t), moved inside if they are less than 2 voxel away from the border (img needs at least 5 voxel in every direction)
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of this and all following instances (see Trace.h, may be empty)
+	  * @return SharedPointer of the Slic3-Object. (Error -> nullptr, e.g. if there are no seeds or Label is not able to number all of them)
+	  */
+	  static Slic3TP<Label> initialize(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, const vector<Vec3i> &seeds, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * initialize the algorithm with the built-in gradient (magnitude of the differences of the intensity in x, y and t, CV_8UC3 or CV_8UC1).
+	  * It is computed only around the centers, straight from the pinned images and in parallel, which is much faster than a GradFunc.
+	  * @param img the MoveCache
+	  * @param step how many pixel should belongs (approximately) to a clusters
+	  * @param stiffness the stiffness value
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of this and all following instances (see Trace.h, may be empty)
+	  * @return SharedPointer of the Slic3-Object. (Error -> nullptr, e.g. if Label is not able to number all clusters)
+	  */
+	  static Slic3TP<Label> initialize(const MovieCacheP &img, int step, int stiffness, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * initialize the algorithm with the given centers and the built-in gradient (see above)
+	  * @param img the MoveCache
+	  * @param step how many pixel should belongs (approximately) to a clusters
+	  * @param stiffness the stiffness value
+	  * @param seeds the centers (x, y, t), moved inside if they are less than 2 voxel away from the border (img needs at least 5 voxel in every direction)
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of this and all following instances (see Trace.h, may be empty)
+	  * @return SharedPointer of the Slic3-Object. (Error -> nullptr, e.g. if there are no seeds or Label is not able to number all of them)
+	  */
+	  static Slic3TP<Label> initialize(const MovieCacheP &img, int step, int stiffness, const vector<Vec3i> &seeds, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
 
 
 	  /**
@@ -159,7 +390,7 @@ namespace RSlic {
 	  * @return a new instance of Slic3 with the results of the iteration.
 	  */
 	  template<typename F>
-	  Slic3P iterate(F f) const;
+	  Slic3TP<Label> iterate(F f) const;
 
 	  /**
 	  * Iterating the algorithm with another stiffness.
@@ -169,10 +400,12 @@ namespace RSlic {
 	  * @see iterate
 	  */
 	  template<typename F>
-	  Slic3P iterate(int stiffness, F f) const; 
+	  Slic3TP<Label> iterate(int stiffness, F f) const;
 
 	  ThreadPoolP threadpool() const;
 
+	  TracerP tracer() const;
+
 	  /**
 	  * Iterating the algorithm
 	  * using the zero parameter version of the SLIC algorithm (SLICO)
@@ -180,7 +413,35 @@ namespace RSlic {
 	  * @return a new instance of Slic3 with the results of the iteration.
 	  */
 	  template<typename F>
-	  Slic3P iterateZero(F f) const;
+	  Slic3TP<Label> iterateZero(F f) const;
+
+	  /**
+	  * Iterating the algorithm only where the clusters changed.
+	  * A cluster is active if its center moved by more than tolerance since the iteration that created this instance.
+	  * Only the voxels near active clusters are assigned again (by all clusters that reach them),
+	  * everywhere else the labels and distances of this instance are kept.
+	  * With tolerance 0 the result is the same as the one of iterate. Otherwise an inactive cluster
+	  * keeps the center it was assigned with until it moved further than tolerance.
+	  * Has to use the same metric (functor type) as the iteration before, else (or without one) every voxel is assigned again.
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how far a cluster may move without being assigned again (in voxel)
+	  * @return a new instance of Slic3 with the results of the iteration.
+	  * @see iterate
+	  */
+	  template<typename F>
+	  Slic3TP<Label> iterateActive(F f, double tolerance = 0) const;
+
+	  /**
+	  * Same as iterateActive, but using the zero parameter version (SLICO).
+	  * A change of the color maximum of a cluster makes it active, too.
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again
+	  * @return a new instance of Slic3 with the results of the iteration.
+	  * @see iterateZero
+	  * @see iterateActive
+	  */
+	  template<typename F>
+	  Slic3TP<Label> iterateZeroActive(F f, double tolerance = 0) const;
 
 	  /**
 	  * Enforce connectivity.
@@ -191,7 +452,7 @@ namespace RSlic {
 	  * @return a new instance of Slic3 with the results of the iteration.
 	  */
 	  template<typename F>
-	  Slic3P finalize(F f) const;
+	  Slic3TP<Label> finalize(F f) const;
 
 	  /**
 	  * Returns the step value
@@ -215,22 +476,35 @@ namespace RSlic {
 	  * Returns the computed clusters.
 	  * @return computed clusters
 	  */
-	  const ClusterSet3 &getClusters() const;
+	  const ClusterSet3T<Label> &getClusters() const;
 
-	  virtual ~Slic3();
+	  /**
+	  * Returns how much the iteration that created this instance changed the clusters.
+	  * (Default values if not created by iterate or iterateZero)
+	  * @return the residual
+	  * @see iterateUntil
+	  */
+	  const Residual &getResidual() const;
+
+	  virtual ~Slic3T();
 
 
   private:
-	  ClusterSet3 clusters;
+	  ClusterSet3T<Label> clusters;
 	  Settings *setting;
 	  Mat distance; //3-dim
-	  double error;
+	  Residual residual;
+	  shared_ptr<const AssignmentInputs> assignment; // What the iteration that created this instance assigned with (nullptr if none)
 
 	  vector<double> max_dist_color; 
   protected:
-	  Slic3(Settings *s, ClusterSet3 &&set = ClusterSet3(), const Mat &distance = Mat());
+	  Slic3T(Settings *s, ClusterSet3T<Label> &&set = ClusterSet3T<Label>(), const Mat &distance = Mat());
+
+	  //Sets up the clusters at the grid (seeds == nullptr) or at seeds
+	  void init(const vector<Vec3i> *seeds = nullptr);
 
-	  void init();
+	  //grad may be empty (built-in gradient)
+	  static Slic3TP<Label> create(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, const vector<Vec3i> *seeds, ThreadPoolP pool, TracerP tracer);
   };
  }
 }
@@ -0,0 +1,99 @@
+#include "RSlic3Engine.h"
+#include "RSlic3_impl.h"
+
+using namespace RSlic::Voxel;
+
+template<typename Label>
+unique_ptr<Slic3EngineT<Label>> RSlic::Voxel::Slic3EngineT<Label>::initialize(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	auto slic = Slic3T<Label>::initialize(img, grad, step, stiffness, pool, tracer);
+	if (slic.get() == nullptr) return unique_ptr<Slic3EngineT>();
+	unique_ptr<Slic3EngineT> res(new Slic3EngineT(*slic));
+	res->shared = false; // slic is gone
+	return res;
+}
+
+template<typename Label>
+unique_ptr<Slic3EngineT<Label>> RSlic::Voxel::Slic3EngineT<Label>::initialize(const MovieCacheP &img, int step, int stiffness, ThreadPoolP pool, TracerP tracer) {
+	auto slic = Slic3T<Label>::initialize(img, step, stiffness, pool, tracer);
+	if (slic.get() == nullptr) return unique_ptr<Slic3EngineT>();
+	unique_ptr<Slic3EngineT> res(new Slic3EngineT(*slic));
+	res->shared = false; // slic is gone
+	return res;
+}
+
+template<typename Label>
+RSlic::Voxel::Slic3EngineT<Label>::Slic3EngineT(const Slic3T<Label> &slic) :
+		setting(slic.setting), clusters(slic.clusters), distance(slic.distance), shared(true),
+		max_dist_color(slic.max_dist_color), residual(slic.residual), assignment(slic.assignment) {
+	setting->__refcount++;
+}
+
+template<typename Label>
+RSlic::Voxel::Slic3EngineT<Label>::~Slic3EngineT() {
+	int count = --setting->__refcount;
+	if (count == 0) {
+		delete setting;
+	}
+}
+
+template<typename Label>
+void RSlic::Voxel::Slic3EngineT<Label>::swap(ClusterSet3T<Label> &&newClusters, const Mat &newDistance) {
+	if (shared) {
+		spareLabel = Mat_<Label>();
+		spareDistance = Mat();
+	} else {
+		spareLabel = clusters.getClusterLabel();
+		spareDistance = distance;
+	}
+	clusters = std::move(newClusters);
+	distance = newDistance;
+	shared = false;
+}
+
+template<typename Label>
+Slic3TP<Label> RSlic::Voxel::Slic3EngineT<Label>::snapshot() {
+	Slic3T<Label> *res = new Slic3T<Label>(setting, ClusterSet3T<Label>(clusters), distance);
+	res->max_dist_color = max_dist_color;
+	res->residual = residual;
+	res->assignment = assignment;
+	shared = true;
+	return Slic3TP<Label>(res);
+}
+
+template<typename Label>
+const ClusterSet3T<Label> &RSlic::Voxel::Slic3EngineT<Label>::getClusters() const {
+	return clusters;
+}
+
+template<typename Label>
+const Residual &RSlic::Voxel::Slic3EngineT<Label>::getResidual() const {
+	return residual;
+}
+
+template<typename Label>
+int RSlic::Voxel::Slic3EngineT<Label>::getStep() const {
+	return setting->step;
+}
+
+template<typename Label>
+int RSlic::Voxel::Slic3EngineT<Label>::getStiffness() const {
+	return setting->stiffness;
+}
+
+template<typename Label>
+MovieCacheP RSlic::Voxel::Slic3EngineT<Label>::getImg() const {
+	return setting->img;
+}
+
+template<typename Label>
+ThreadPoolP RSlic::Voxel::Slic3EngineT<Label>::threadpool() const {
+	return setting->pool;
+}
+
+template<typename Label>
+RSlic::TracerP RSlic::Voxel::Slic3EngineT<Label>::tracer() const {
+	return setting->tracer;
+}
+
+template class RSlic::Voxel::Slic3EngineT<int16_t>;
+template class RSlic::Voxel::Slic3EngineT<int32_t>;
@@ -0,0 +1,176 @@
+#ifndef RSlic3ENGINE_H
+#define RSlic3ENGINE_H
+
+#include "RSlic3.h"
+
+namespace RSlic {
+ namespace Voxel {
+
+  template<typename Label>
+  class Slic3EngineT;
+
+  using Slic3Engine = Slic3EngineT<ClusterInt>;
+
+  using Slic3Engine16 = Slic3EngineT<int16_t>;
+
+  /**
+  * The Slic algorithm for movies, iterating in place.
+  * Slic3T creates a new instance (with new label and distance Mats) for every iteration, which is nice
+  * if you want to look back, but costs a lot of memory for long movies.
+  * The engine has two buffers for labels and distances: every iteration writes into the spare one and swaps them.
+  * So after the first iterations nothing of movie size is allocated anymore.
+  * Slic3T itself iterates with an engine and keeps its result.
+  * @tparam Label the type of the cluster label (int16_t or int32_t).
+  * @see Slic3T
+  */
+  template<typename Label>
+  class Slic3EngineT {
+  public:
+	  /**
+	  * initialize the algorithm (see Slic3T::initialize)
+	  * @param img the movie
+	  * @param grad function for computing the gradient
+	  * @param step how many voxel should belongs (approximately) to a clusters (in every direction)
+	  * @param stiffness the stiffness value
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of the engine (see Trace.h, may be empty)
+	  * @return the engine (Error -> nullptr, e.g. if Label is not able to number all clusters)
+	  */
+	  static unique_ptr<Slic3EngineT> initialize(const MovieCacheP &img, const GradFunc &grad, int step, int stiffness, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * initialize the algorithm with the built-in gradient (see Slic3T::initialize)
+	  * @param img the movie
+	  * @param step how many voxel should belongs (approximately) to a clusters (in every direction)
+	  * @param stiffness the stiffness value
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool()).
+	  * @param tracer gets the phases of the engine (see Trace.h, may be empty)
+	  * @return the engine (Error -> nullptr, e.g. if Label is not able to number all clusters)
+	  */
+	  static unique_ptr<Slic3EngineT> initialize(const MovieCacheP &img, int step, int stiffness, ThreadPoolP pool = ThreadPoolP(), TracerP tracer = TracerP());
+
+	  /**
+	  * Continues iterating from slic. Its Mats are shared, not copied (and never written).
+	  * @param slic the state to start with
+	  */
+	  explicit Slic3EngineT(const Slic3T<Label> &slic);
+
+	  Slic3EngineT(const Slic3EngineT &other) = delete;
+
+	  Slic3EngineT &operator=(const Slic3EngineT &other) = delete;
+
+	  /**
+	  * Iterating the algorithm (see Slic3T::iterate).
+	  * @param f the functor with the metrics for the iteration.
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterate(F f);
+
+	  /**
+	  * Iterating the algorithm with another stiffness (see Slic3T::iterate).
+	  * @param stiffness the stiffness factor.
+	  * @param f the functor with the metrics for the iteration.
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterate(int stiffness, F f);
+
+	  /**
+	  * Iterating the algorithm using SLICO (see Slic3T::iterateZero).
+	  * @param f the functor with the metrics for the iteration
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterateZero(F f);
+
+	  /**
+	  * Iterating the algorithm only where the clusters changed (see Slic3T::iterateActive).
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterateActive(F f, double tolerance = 0);
+
+	  /**
+	  * Same as iterateActive, but using SLICO (see Slic3T::iterateZeroActive).
+	  * @param f the functor with the metrics for the iteration
+	  * @param tolerance how much a cluster may change without being assigned again
+	  * @return how much the iteration changed the clusters
+	  */
+	  template<typename F>
+	  const Residual &iterateZeroActive(F f, double tolerance = 0);
+
+	  /**
+	  * Returns the current state as Slic3 instance (e.g. for finalize or exporting).
+	  * Nothing is copied: the engine won't write into these buffers anymore and allocates new ones if needed.
+	  * @return the Slic3 instance
+	  */
+	  Slic3TP<Label> snapshot();
+
+	  /**
+	  * Returns the current clusters.
+	  * The label Mat will be overwritten by the iteration after the next one, use snapshot to keep it.
+	  * @return current clusters
+	  */
+	  const ClusterSet3T<Label> &getClusters() const;
+
+	  /**
+	  * Returns how much the last iteration changed the clusters.
+	  * @return the residual
+	  */
+	  const Residual &getResidual() const;
+
+	  /**
+	  * Returns the step value
+	  * @return step value
+	  */
+	  int getStep() const;
+
+	  /**
+	  * Returns the stiffness value
+	  * @return stiffness value
+	  */
+	  int getStiffness() const;
+
+	  /**
+	  * Returns the MovieCache
+	  * @return the MovieCache
+	  */
+	  MovieCacheP getImg() const;
+
+	  ThreadPoolP threadpool() const;
+
+	  TracerP tracer() const;
+
+	  ~Slic3EngineT();
+
+  private:
+	  using Settings = typename Slic3T<Label>::Settings;
+
+	  Settings *setting;
+	  ClusterSet3T<Label> clusters;
+	  Mat distance; //3-dim
+	  Mat_<Label> spareLabel; // written by the next iteration (empty if it has to be allocated)
+	  Mat spareDistance;
+	  bool shared; // whether clusters and distance are used by a Slic3 instance, too
+
+	  vector<double> max_dist_color;
+	  Residual residual;
+	  shared_ptr<const AssignmentInputs> assignment;
+
+	  //iterate and iterateActive (tolerance < 0: assign every voxel)
+	  template<typename F>
+	  const Residual &iterateNormal(int stiffness, F f, double tolerance);
+
+	  //iterateZero and iterateZeroActive (tolerance < 0: assign every voxel)
+	  template<typename F>
+	  const Residual &iterateSlico(F f, double tolerance);
+
+	  //Makes the result of an iteration the current state, the old one becomes the spare buffer (if not shared)
+	  void swap(ClusterSet3T<Label> &&newClusters, const Mat &newDistance);
+  };
+ }
+}
+#endif // RSlic3ENGINE_H
@@ -0,0 +1,205 @@
+#include "RSlic3Stream.h"
+#include "RSlic3Utils.h"
+#include "RSlic3_impl.h"
+#include <ThreadPool.h>
+#include <map>
+#include <set>
+#include <tuple>
+
+using namespace RSlic::Voxel;
+
+namespace {
+ template<typename F>
+ void iterateWindow(Slic3EngineT<int32_t> &engine, int iterations, bool slico) {
+	 F f;
+	 RSlic::Voxel::iterateUntil(engine, f, 0, iterations, slico);
+ }
+}
+
+RSlic::Voxel::Slic3Stream::Slic3Stream(int step, int stiffness, int window, int iterations, bool slico, ThreadPoolP pool) :
+		step(std::max(1, step)), stiffness(stiffness), iterations(iterations), slico(slico), pool(pool) {
+	this->window = std::max(window <= 0 ? 4 * this->step : window, std::max(3 * this->step, 10));
+	if (this->pool.get() == nullptr) this->pool = ThreadPool::defaultPool();
+}
+
+vector<Mat_<int32_t>> RSlic::Voxel::Slic3Stream::push(const Mat &img) {
+	if (img.type() != CV_8UC3 && img.type() != CV_8UC1) return vector<Mat_<int32_t>>();
+	frames.push_back(img);
+	if (static_cast<int>(frames.size()) < window) return vector<Mat_<int32_t>>();
+	return process(false);
+}
+
+vector<Mat_<int32_t>> RSlic::Voxel::Slic3Stream::flush() {
+	vector<Mat_<int32_t>> res;
+	if (newFrom < static_cast<int>(frames.size())) {
+		res = process(true);
+	} else {
+		// nothing new since the last window, its labels are final
+		for (int t = emitted; t < static_cast<int>(frames.size()); t++) res.push_back(emit(lastLabel, lastOffset + t));
+	}
+	frames.clear();
+	first = 0;
+	newFrom = 0;
+	emitted = 0;
+	carriedCenters.clear();
+	carriedLabels.clear();
+	contextLabels.clear();
+	lastLabel = Mat_<int32_t>();
+	return res;
+}
+
+int32_t RSlic::Voxel::Slic3Stream::labelCount() const {
+	return nextLabel;
+}
+
+int RSlic::Voxel::Slic3Stream::getWindow() const {
+	return window;
+}
+
+vector<Mat_<int32_t>> RSlic::Voxel::Slic3Stream::process(bool last) {
+	const int d = frames.size();
+	const int w = frames[0].cols;
+	const int h = frames[0].rows;
+	const int type = frames[0].type();
+
+	// carried clusters and new ones on the grid of the new images (the grid goes on through the stream)
+	vector<Vec3i> seeds = carriedCenters;
+	for (int t = newFrom; t < d; t++) {
+		if ((first + t) % step != step / 2) continue;
+		for (int x = step; x < w - step / 2; x += step) {
+			for (int y = step; y < h - step / 2; y += step) {
+				// a cluster on the same place would lose all of its voxels
+				bool taken = false;
+				for (const Vec3i &c: carriedCenters) {
+					if (std::abs(c[0] - x) <= step / 2 && std::abs(c[1] - y) <= step / 2 && std::abs(c[2] - t) <= step / 2) {
+						taken = true;
+						break;
+					}
+				}
+				if (taken) continue;
+				seeds.emplace_back(x, y, t);
+			}
+		}
+	}
+
+	// emit the first half of the images that were not emitted yet, keep step emitted ones as context for the next window
+	const int emitEnd = last ? d : d - (d - emitted) / 2;
+	const int drop = std::max(0, emitEnd - step);
+	vector<Mat_<int32_t>> res;
+	Slic3TP<int32_t> slic;
+	if (d >= 5 && w >= 5 && h >= 5 && !seeds.empty()) {
+		MovieCacheP img = std::make_shared<SimpleMovieCache>(vector<Mat>(frames.begin(), frames.end()));
+		slic = Slic3T<int32_t>::initialize(img, step, stiffness, seeds, pool);
+	}
+	if (slic.get() == nullptr) {
+		// too small, nothing to cluster
+		lastLabel = Mat_<int32_t>();
+		windowLabels.clear();
+		for (int t = emitted; t < emitEnd; t++) res.push_back(Mat_<int32_t>(h, w, -1));
+		carriedCenters.clear();
+		carriedLabels.clear();
+	} else {
+		Slic3EngineT<int32_t> engine(*slic);
+		slic.reset();
+		if (type == CV_8UC3) iterateWindow<distanceColor>(engine, iterations, slico);
+		else iterateWindow<distanceGray>(engine, iterations, slico);
+
+		lastLabel = engine.getClusters().getClusterLabel();
+		assignLabels(engine.getClusters().clusterCount());
+		for (int t = emitted; t < emitEnd; t++) res.push_back(emit(lastLabel, t));
+
+		// the clusters go on with their part in the kept images (if it is not too small, like in finalize)
+		carriedCenters.clear();
+		carriedLabels.clear();
+		const int count = engine.getClusters().clusterCount();
+		vector<long> voxels(count, 0), sumX(count, 0), sumY(count, 0), sumT(count, 0);
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				const int32_t *row = lastLabel.ptr<int32_t>(y, x);
+				for (int t = drop; t < d; t++) {
+					const int32_t k = row[t];
+					if (k < 0) continue;
+					voxels[k]++;
+					sumX[k] += x;
+					sumY[k] += y;
+					sumT[k] += t - drop;
+				}
+			}
+		}
+		const long lims = static_cast<long>(step) * step * step;
+		for (int k = 0; k < count; k++) {
+			if (voxels[k] == 0 || voxels[k] <= lims >> 2) continue;
+			carriedCenters.emplace_back(sumX[k] / voxels[k], sumY[k] / voxels[k], sumT[k] / voxels[k]);
+			carriedLabels.push_back(windowLabels[k]);
+		}
+	}
+
+	contextLabels.insert(contextLabels.end(), res.begin(), res.end());
+	contextLabels.erase(contextLabels.begin(), contextLabels.begin() + drop);
+	frames.erase(frames.begin(), frames.begin() + drop);
+	first += drop;
+	newFrom = frames.size();
+	emitted = emitEnd - drop;
+	lastOffset = drop;
+	return res;
+}
+
+void RSlic::Voxel::Slic3Stream::assignLabels(int count) {
+	// the clusters move while iterating, so the carried ones are not always the same supervoxels as before:
+	// a cluster goes on with the label it overlaps most in the already emitted images (if that is most of it there)
+	const int h = frames[0].rows;
+	const int w = frames[0].cols;
+	vector<long> contextVoxels(count, 0);
+	std::map<std::pair<int32_t, int32_t>, long> overlap; // (cluster, emitted label) -> voxels
+	for (int t = 0; t < static_cast<int>(contextLabels.size()); t++) {
+		const Mat_<int32_t> &old = contextLabels[t];
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				const int32_t k = lastLabel.ptr<int32_t>(y, x)[t];
+				if (k < 0) continue;
+				contextVoxels[k]++;
+				if (old(y, x) >= 0) overlap[std::make_pair(k, old(y, x))]++;
+			}
+		}
+	}
+	vector<std::tuple<long, int32_t, int32_t>> matches; // (voxels, cluster, label)
+	for (const auto &o: overlap) {
+		if (2 * o.second > contextVoxels[o.first.first]) matches.emplace_back(o.second, o.first.first, o.first.second);
+	}
+	std::sort(matches.begin(), matches.end(), std::greater<std::tuple<long, int32_t, int32_t>>());
+
+	windowLabels.assign(count, -1);
+	std::set<int32_t> used;
+	for (const auto &m: matches) {
+		const int32_t k = std::get<1>(m);
+		const int32_t label = std::get<2>(m);
+		if (windowLabels[k] >= 0 || used.count(label) > 0) continue;
+		windowLabels[k] = label;
+		used.insert(label);
+	}
+	// the others keep their label if it is free, new clusters get a new one
+	for (int k = 0; k < count; k++) {
+		if (windowLabels[k] >= 0) continue;
+		if (k < static_cast<int>(carriedLabels.size()) && used.count(carriedLabels[k]) == 0) {
+			windowLabels[k] = carriedLabels[k];
+			used.insert(carriedLabels[k]);
+		} else {
+			windowLabels[k] = nextLabel++;
+		}
+	}
+}
+
+Mat_<int32_t> RSlic::Voxel::Slic3Stream::emit(const Mat_<int32_t> &label, int t) const {
+	const int h = frames[0].rows;
+	const int w = frames[0].cols;
+	Mat_<int32_t> res(h, w, -1);
+	if (label.empty()) return res;
+	for (int y = 0; y < h; y++) {
+		int32_t *row = res.ptr<int32_t>(y);
+		for (int x = 0; x < w; x++) {
+			const int32_t k = label.ptr<int32_t>(y, x)[t];
+			if (k >= 0) row[x] = windowLabels[k];
+		}
+	}
+	return res;
+}
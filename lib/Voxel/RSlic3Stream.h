@@ -0,0 +1,92 @@
+#ifndef RSlic3STREAM_H
+#define RSlic3STREAM_H
+
+#include <deque>
+#include "RSlic3.h"
+
+namespace RSlic {
+ namespace Voxel {
+
+  /**
+  * Supervoxels for movies of any length (e.g. live video) with bounded memory.
+  * The images are collected in a window. If it is full, the algorithm iterates on the window,
+  * the first half of the images that were not emitted yet is emitted as label images (their labels won't change anymore)
+  * and the clusters are carried over to the next window with their part in the rest (if it is not too small).
+  * The last step emitted images stay in the window, so the next one starts with some context.
+  * A cluster keeps the label it overlaps most in these images (or the one it was carried with),
+  * new clusters (seeded on the grid of the new images) get a new one, so a label means the same supervoxel in the whole stream.
+  * Only the window (images, labels and distances) is kept in memory.
+  * The connectivity is not enforced (like finalize does), that would need the whole movie.
+  */
+  class Slic3Stream {
+  public:
+	  /**
+	  * Creates an empty stream.
+	  * @param step how many voxel should belongs (approximately) to a clusters (in every direction)
+	  * @param stiffness the stiffness value
+	  * @param window how many images are processed at once (at least 3 * step and 10, 0 = 4 * step)
+	  * @param iterations how many iterations are done per window (at most, see iterateUntil)
+	  * @param slico use Slico
+	  * @param pool ThreadPool for computing parallel (empty = ThreadPool::defaultPool())
+	  */
+	  Slic3Stream(int step, int stiffness, int window = 0, int iterations = 10, bool slico = false, ThreadPoolP pool = ThreadPoolP());
+
+	  /**
+	  * Adds the next image (CV_8UC3 in Lab or CV_8UC1, all of the same size and type, at least 5x5).
+	  * @param img the image
+	  * @return the label images that left the window (in order, may be empty). Unassigned voxels have the label -1.
+	  */
+	  vector<Mat_<int32_t>> push(const Mat &img);
+
+	  /**
+	  * The stream ends: processes the images that are left.
+	  * Afterwards the stream is empty and may be used again (with new labels).
+	  * @return the remaining label images
+	  */
+	  vector<Mat_<int32_t>> flush();
+
+	  /**
+	  * Returns how many labels have been used so far (the labels are 0 to labelCount() - 1)
+	  * @return amount of labels
+	  */
+	  int32_t labelCount() const;
+
+	  /**
+	  * Returns the size of the window
+	  * @return amount of images
+	  */
+	  int getWindow() const;
+
+  private:
+	  //Iterates on the window and emits the first half of the images not emitted yet (last: all of them)
+	  vector<Mat_<int32_t>> process(bool last);
+
+	  //Chooses the label in the stream of every cluster of the window
+	  void assignLabels(int count);
+
+	  //Converts the labels of image t of the window to the labels of the stream
+	  Mat_<int32_t> emit(const Mat_<int32_t> &label, int t) const;
+
+	  int step;
+	  int stiffness;
+	  int window;
+	  int iterations;
+	  bool slico;
+	  ThreadPoolP pool;
+
+	  std::deque<Mat> frames; // the window
+	  long first = 0; // position of frames[0] in the stream
+	  int newFrom = 0; // frames before are carried over from the last window
+	  int emitted = 0; // frames before are emitted already (context)
+
+	  vector<Vec3i> carriedCenters; // t relative to frames[0]
+	  vector<int32_t> carriedLabels;
+	  vector<int32_t> windowLabels; // label in the stream of every cluster of the last window
+	  std::deque<Mat_<int32_t>> contextLabels; // emitted labels of frames[0] to frames[emitted - 1]
+	  Mat_<int32_t> lastLabel; // labels of the last window, frames[0] is its image lastOffset
+	  int lastOffset = 0;
+	  int32_t nextLabel = 0;
+  };
+ }
+}
+#endif // RSlic3STREAM_H
@@ -2,6 +2,8 @@
 #include <opencv2/highgui/highgui.hpp>
 #include "RSlic3Utils.h"
 #include "RSlic3_impl.h"
+#include <priv/Stats_p.h>
+#include <algorithm>
 
 cv::Mat RSlic::Voxel::SimpleMovieCache::matAt(int t) const {
   if (t >= pictures.size()) return Mat();
@@ -21,15 +23,143 @@ RSlic::Voxel::SimpleMovieCache::SimpleMovieCache(std::vector<Mat> &&_pictures) :
 
 }
 
-RSlic::Voxel::SimpleMovieCache::SimpleMovieCache(const std::vector<std::string> &filenames) {
-  for (const string &f: filenames) {
+namespace {
+  Mat readFrame(const string &f) {
     Mat mat = cv::imread(f, cv::IMREAD_COLOR); //TODO: Don't ignore cases where images have not the same size or type 
     switch (mat.type()) {
       case CV_8UC3:
         cv::cvtColor(mat, mat, cv::COLOR_BGR2Lab);
         break;
     }
-    pictures.push_back(mat);
+    return mat;
+  }
+}
+
+RSlic::Voxel::SimpleMovieCache::SimpleMovieCache(const std::vector<std::string> &filenames) {
+  for (const string &f: filenames) {
+    pictures.push_back(readFrame(f));
+  }
+}
+
+RSlic::Voxel::DiskMovieCache::DiskMovieCache(const std::vector<std::string> &filenames, size_t byteBudget, int readAhead) :
+    filenames(filenames), byteBudget(byteBudget), readAhead(std::max(0, readAhead)), frameList(filenames.size()) {
+  worker = std::thread(&DiskMovieCache::readAheadLoop, this);
+}
+
+RSlic::Voxel::DiskMovieCache::~DiskMovieCache() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  requested.notify_all();
+  worker.join();
+}
+
+cv::Mat RSlic::Voxel::DiskMovieCache::matAt(int t) const {
+  if (t < 0 || t >= duration()) return Mat();
+  std::unique_lock<std::mutex> lock(mutex);
+  Mat res = load(t, lock);
+  // read ahead in time
+  bool added = false;
+  for (int next = t + 1; next <= t + readAhead && next < duration(); next++) {
+    const Frame &frame = frameList[next];
+    if (frame.loading || !frame.mat.empty() || std::find(queue.begin(), queue.end(), next) != queue.end()) continue;
+    queue.push_back(next);
+    added = true;
+  }
+  if (added) requested.notify_one();
+  return res;
+}
+
+int RSlic::Voxel::DiskMovieCache::duration() const {
+  return filenames.size();
+}
+
+int RSlic::Voxel::DiskMovieCache::windowSize() const {
+  size_t size;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    size = frameBytes;
+  }
+  if (size == 0) {
+    Mat first = matAt(0);
+    size = std::max<size_t>(1, first.total() * first.elemSize());
+  }
+  return static_cast<int>(std::max<size_t>(1, std::min<size_t>(duration(), byteBudget / size)));
+}
+
+void RSlic::Voxel::DiskMovieCache::prefetch(int t0, int t1) const {
+  t0 = std::max(0, t0);
+  t1 = std::min(duration(), t1);
+  if (t0 >= t1) return;
+  t1 = std::min(t1, t0 + windowSize()); // more would drop the first ones again
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int t = t0; t < t1; t++) {
+      const Frame &frame = frameList[t];
+      if (frame.loading || !frame.mat.empty() || std::find(queue.begin(), queue.end(), t) != queue.end()) continue;
+      queue.push_back(t);
+    }
+  }
+  requested.notify_one();
+}
+
+size_t RSlic::Voxel::DiskMovieCache::bytesInMemory() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return bytes;
+}
+
+long RSlic::Voxel::DiskMovieCache::loadCount() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return loads;
+}
+
+cv::Mat RSlic::Voxel::DiskMovieCache::load(int t, std::unique_lock<std::mutex> &lock) const {
+  Frame &frame = frameList[t];
+  while (frame.loading) loaded.wait(lock); // the read ahead is just at it
+  if (!frame.mat.empty()) {
+    lru.splice(lru.begin(), lru, frame.lruPos);
+    return frame.mat;
+  }
+  frame.loading = true;
+  lock.unlock();
+  Mat mat = readFrame(filenames[t]);
+  lock.lock();
+  frame.loading = false;
+  loads++;
+  if (!mat.empty()) {
+    const size_t size = mat.total() * mat.elemSize();
+    if (frameBytes == 0) frameBytes = size;
+    frame.mat = mat;
+    lru.push_front(t);
+    frame.lruPos = lru.begin();
+    bytes += size;
+    evict();
+  }
+  loaded.notify_all();
+  return mat;
+}
+
+void RSlic::Voxel::DiskMovieCache::evict() const {
+  // never the most recent one
+  while (bytes > byteBudget && lru.size() > 1) {
+    Frame &frame = frameList[lru.back()];
+    lru.pop_back();
+    bytes -= frame.mat.total() * frame.mat.elemSize();
+    frame.mat = Mat();
+  }
+}
+
+void RSlic::Voxel::DiskMovieCache::readAheadLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    requested.wait(lock, [this] { return stop || !queue.empty(); });
+    if (stop) return;
+    int t = queue.front();
+    queue.pop_front();
+    const Frame &frame = frameList[t];
+    if (frame.loading || !frame.mat.empty()) continue;
+    load(t, lock);
   }
 }
 
@@ -54,14 +184,17 @@ namespace {
       int y = vec[1];
       int x = vec[0];
       int t = vec[2];
+      // one matAt per frame instead of one per voxel
+      const RSlic::Voxel::MovieFrames frames = img->frames(t - 1, t + 2);
+      const T *row = frames.row<T>(y, t);
 
-      double dx = decolor(img->at<T>(y, x - 1, t) + img->at<T>(y, x + 1, t));
+      double dx = decolor(row[x - 1] + row[x + 1]);
       dx = dx / 2;
 
-      double dy = decolor(img->at<T>(y - 1, x, t) + img->at<T>(y + 1, x, t));
+      double dy = decolor(frames.at<T>(y - 1, x, t) + frames.at<T>(y + 1, x, t));
       dy = dy / 2;
 
-      double dt = decolor(img->at<T>(y, x, t - 1) + img->at<T>(y, x, t + 1));
+      double dt = decolor(frames.at<T>(y, x, t - 1) + frames.at<T>(y, x, t + 1));
       dt = dt / 2;
 
       return sqrt(dx * dx + dy * dy + dt * dt);
@@ -77,31 +210,114 @@ double ::RSlic::Voxel::buildGradColor(RSlic::Voxel::MovieCacheP const &img, cons
   return ::buildGradIntern<Vec3b>(img, vec);
 }
 
-template <typename F>
-static RSlic::Voxel::Slic3P shutUpAndTakeMyMoneyType(const RSlic::Voxel::MovieCacheP &m, int step, int stiffness, bool slico, int iterations,  function<double(const RSlic::Voxel::MovieCacheP &, const Vec3i &)> grad) {
+template <typename F, typename Label>
+static RSlic::Voxel::Slic3TP<Label> shutUpAndTakeMyMoneyType(const RSlic::Voxel::MovieCacheP &m, int step, int stiffness, bool slico, int iterations) {
   F f;
-  auto res = RSlic::Voxel::Slic3::initialize(m,grad,step, stiffness);
-  if (res.get() == nullptr) return res; //error
-  for (int i=0; i< iterations; i++){
-    if (slico) res = res->iterateZero<F>(f);
-    else res = res->iterate<F>(f);
-  }
-  res = res->finalize<F>(f);
-  return res;
+  auto engine = RSlic::Voxel::Slic3EngineT<Label>::initialize(m, step, stiffness);
+  if (engine.get() == nullptr) return nullptr; //error
+  RSlic::Voxel::iterateUntil(*engine, f, 0, iterations, slico);
+  return engine->snapshot()->template finalize<F>(f);
 }
 
 
 RSlic::Voxel::Slic3P  RSlic::Voxel::shutUpAndTakeMyMoney(const RSlic::Voxel::MovieCacheP &m, int count, int stiffness, bool slico, int iterations) {
+  return shutUpAndTakeMyMoney<ClusterInt>(m, count, stiffness, slico, iterations);
+}
+
+template<typename Label>
+RSlic::Voxel::Slic3TP<Label>  RSlic::Voxel::shutUpAndTakeMyMoney(const RSlic::Voxel::MovieCacheP &m, int count, int stiffness, bool slico, int iterations) {
   int w = m->width();
   int h = m->height();
   int t = m->duration();
   int step = pow(w * h * t * 1.0 / count, 1.0/3);
 
   if (m->type() == CV_8UC3) {
-    return shutUpAndTakeMyMoneyType<distanceColor>(m,step, stiffness,slico,iterations, buildGradColor);
+    return shutUpAndTakeMyMoneyType<distanceColor, Label>(m,step, stiffness,slico,iterations);
   }
   else if (m->type() == CV_8UC1){
-    return shutUpAndTakeMyMoneyType<distanceGray>(m,step, stiffness, slico,iterations, buildGradGray);
+    return shutUpAndTakeMyMoneyType<distanceGray, Label>(m,step, stiffness, slico,iterations);
   }
   return nullptr;
 }
+
+template RSlic::Voxel::Slic3TP<int16_t> RSlic::Voxel::shutUpAndTakeMyMoney<int16_t>(const RSlic::Voxel::MovieCacheP &m, int count, int stiffness, bool slico, int iterations);
+template RSlic::Voxel::Slic3TP<int32_t> RSlic::Voxel::shutUpAndTakeMyMoney<int32_t>(const RSlic::Voxel::MovieCacheP &m, int count, int stiffness, bool slico, int iterations);
+
+namespace {
+  template<typename T, typename Label>
+    inline void accumulateStats3Type(const RSlic::Voxel::MovieFrames &frames, const Mat_<Label> &label, int t0, int t1, int yBeg, int yEnd, RSlic::priv::StatsSums &sums) {
+      const int w = label.size[1];
+      double px[4];
+      int pos[3];
+      for (int y = yBeg; y < yEnd; y++) {
+        pos[1] = y;
+        for (int t = t0; t < t1; t++) {
+          const T *imgRow = frames.row<T>(y, t);
+          pos[2] = t;
+          for (int x = 0; x < w; x++) {
+            const Label k = label.template ptr<Label>(y, x)[t];
+            if (k < 0) continue;
+            pos[0] = x;
+            RSlic::priv::pixelChannels(imgRow[x], px);
+            sums.add(k, pos, px);
+          }
+        }
+      }
+    }
+
+  declareCVF_T(accumulateStats3Type, accumulateStats3Helper, return)
+
+  //Only the geometry (no movie)
+  template<typename Label>
+    inline void accumulateGeometry3(const Mat_<Label> &label, int yBeg, int yEnd, RSlic::priv::StatsSums &sums) {
+      const int w = label.size[1];
+      const int d = label.size[2];
+      int pos[3];
+      for (int y = yBeg; y < yEnd; y++) {
+        pos[1] = y;
+        for (int x = 0; x < w; x++) {
+          const Label *row = label.template ptr<Label>(y, x);
+          pos[0] = x;
+          for (int t = 0; t < d; t++) {
+            if (row[t] < 0) continue;
+            pos[2] = t;
+            sums.add(row[t], pos, static_cast<const double *>(nullptr));
+          }
+        }
+      }
+    }
+}
+
+template<typename Label>
+RSlic::ClusterStats RSlic::Voxel::computeStats(const MovieCacheP &img, const ClusterSet3T<Label> &clusters, ThreadPoolP pool, bool withCovariance) {
+  const Mat_<Label> label = clusters.getClusterLabel();
+  const int h = label.size[0];
+  const int w = label.size[1];
+  const int d = label.size[2];
+  if (img.get() != nullptr && (img->height() != h || img->width() != w || img->duration() != d || CV_MAT_CN(img->type()) > 4)) return ClusterStats();
+  const int channels = img.get() == nullptr ? 0 : CV_MAT_CN(img->type());
+  const bool exact = img.get() == nullptr || RSlic::priv::exactDepth(CV_MAT_DEPTH(img->type()));
+  vector<RSlic::priv::StatsSums> bands(RSlic::priv::sumBandCount(pool.get(), h, exact), RSlic::priv::StatsSums(clusters.clusterCount(), 3, channels, withCovariance));
+  const int bandNum = static_cast<int>(bands.size());
+  if (img.get() == nullptr) {
+    RSlic::priv::forEachBand(pool.get(), h, bandNum, [&](int band, int yBeg, int yEnd) {
+      accumulateGeometry3(label, yBeg, yEnd, bands[band]);
+    });
+  } else {
+    // the bands are the same for every slab, so band b always adds to bands[b]
+    const int window = std::max(1, img->windowSize());
+    for (int t0 = 0; t0 < d; t0 += window) {
+      const int t1 = std::min(d, t0 + window);
+      img->prefetch(t1, t1 + window);
+      const MovieFrames frames = img->frames(t0, t1);
+      RSlic::priv::forEachBand(pool.get(), h, bandNum, [&](int band, int yBeg, int yEnd) {
+        ::accumulateStats3Helper(img->type(), frames, label, t0, t1, yBeg, yEnd, bands[band]);
+      });
+    }
+  }
+  for (size_t b = 1; b < bands.size(); b++) bands[0] += bands[b];
+  return bands[0].result();
+}
+
+template RSlic::ClusterStats RSlic::Voxel::computeStats<int16_t>(const MovieCacheP &img, const ClusterSet3T<int16_t> &clusters, ThreadPoolP pool, bool withCovariance);
+template RSlic::ClusterStats RSlic::Voxel::computeStats<int32_t>(const MovieCacheP &img, const ClusterSet3T<int32_t> &clusters, ThreadPoolP pool, bool withCovariance);
@@ -2,6 +2,11 @@
 #define RSlic3UTILS_H
 
 #include "RSlic3.h"
+#include "RSlic3Engine.h"
+#include <ClusterStats.h>
+#include <list>
+#include <deque>
+#include <condition_variable>
 
 namespace RSlic {
  namespace Voxel {
@@ -44,6 +49,84 @@ namespace RSlic {
 	  std::vector<Mat> pictures;
   };
 
+  /**
+  * MovieCache that loads the images from disk when they are needed and keeps at most byteBudget bytes of them in memory.
+  * If the budget is exceeded the least recently used images are dropped (pinned MovieFrames keep theirs).
+  * A background thread reads ahead: the images after the last requested one and the ones of prefetch.
+  * The images will be converted from BGR to LAB if needed (like SimpleMovieCache).
+  * The Voxel iteration needs about 4 * step + 3 images at once (see windowSize), a smaller budget works, but is exceeded.
+  */
+  class DiskMovieCache : public MovieCache {
+  public:
+	  /**
+	  * Initialize with filenames of all images. Nothing is loaded yet.
+	  * @param filenames list of files
+	  * @param byteBudget how many bytes of images may be kept in memory
+	  * @param readAhead how many images after the last requested one are loaded in the background (0 = none)
+	  */
+	  DiskMovieCache(const std::vector<std::string> &filenames, size_t byteBudget, int readAhead = 4);
+
+	  virtual ~DiskMovieCache();
+
+	  DiskMovieCache(const DiskMovieCache &) = delete;
+
+	  DiskMovieCache &operator=(const DiskMovieCache &) = delete;
+
+	  virtual Mat matAt(int t) const override;
+
+	  virtual int duration() const override;
+
+	  /**
+	  * Returns how many images fit into the budget (at least 1)
+	  */
+	  virtual int windowSize() const override;
+
+	  virtual void prefetch(int t0, int t1) const override;
+
+	  /**
+	  * Returns how many bytes of images are kept at the moment
+	  * @return amount of bytes
+	  */
+	  size_t bytesInMemory() const;
+
+	  /**
+	  * Returns how many images were read from disk so far (reloads included)
+	  * @return amount of loads
+	  */
+	  long loadCount() const;
+
+  private:
+	  struct Frame {
+		  Mat mat; // empty if not in memory
+		  bool loading = false;
+		  std::list<int>::iterator lruPos;
+	  };
+
+	  //Loads image t and keeps it (lock has to be held, it is released while reading)
+	  Mat load(int t, std::unique_lock<std::mutex> &lock) const;
+
+	  //Drops the least recently used images until the budget fits (lock has to be held)
+	  void evict() const;
+
+	  void readAheadLoop();
+
+	  std::vector<std::string> filenames;
+	  size_t byteBudget;
+	  int readAhead;
+
+	  mutable std::mutex mutex;
+	  mutable std::condition_variable loaded; // an image has been loaded
+	  mutable std::condition_variable requested; // the read ahead queue got new images
+	  mutable std::vector<Frame> frameList;
+	  mutable std::list<int> lru; // positions of the images in memory, most recently used first
+	  mutable std::deque<int> queue; // positions to read ahead
+	  mutable size_t bytes = 0;
+	  mutable size_t frameBytes = 0; // size of one image (0 = unknown yet)
+	  mutable long loads = 0;
+	  bool stop = false;
+	  std::thread worker;
+  };
+
   /**
   * Function for computing the gradient of a gray image.
   * @param img MovieCacheP
@@ -60,14 +143,25 @@ namespace RSlic {
 
   /**
   * Function that is  described in the paper for computing the metrics (of LAB images) for the algorithm.
+  * The iterations call it with the pinned frames (MovieFrames), so reading a voxel is just a pointer offset.
   */
   struct distanceColor{
+    inline double operator()(const cv::Vec3i &point, const cv::Vec3i &clusterCenter, const MovieFrames &frames, int stiffness, int step){
+        if (clusterCenter[1] < 0 || clusterCenter[0] < 0 || clusterCenter[2] < 0) {
+            return DINF;
+        }
+        return metric(frames.at<cv::Vec3b>(point), frames.at<cv::Vec3b>(clusterCenter), point, clusterCenter, stiffness, step);
+    }
+
     inline double operator()(const cv::Vec3i &point, const cv::Vec3i &clusterCenter, const MovieCacheP &mat, int stiffness, int step){
         if (clusterCenter[1] < 0 || clusterCenter[0] < 0 || clusterCenter[2] < 0) {
             return DINF;
         }
-        cv::Vec3b pixel = mat->at<cv::Vec3b>(point);
-        cv::Vec3b clust_pixel = mat->at<cv::Vec3b>(clusterCenter);
+        return metric(mat->at<cv::Vec3b>(point), mat->at<cv::Vec3b>(clusterCenter), point, clusterCenter, stiffness, step);
+    }
+
+  private:
+    static inline double metric(const cv::Vec3b &pixel, const cv::Vec3b &clust_pixel, const cv::Vec3i &point, const cv::Vec3i &clusterCenter, int stiffness, int step){
         int pl = pixel[0], pa = pixel[1], pb = pixel[2]; 
         int cl = clust_pixel[0], ca = clust_pixel[1], cb = clust_pixel[2];
         double dc = sqrt(pow(pl - cl, 2) + pow(pb - cb, 2) + pow(pa - ca, 2));
@@ -81,18 +175,27 @@ namespace RSlic {
   * Function which is described in the paper for computing the metrics (of gray images) for the algorithm.
   */
   struct distanceGray{
+      inline double operator()(const cv::Vec3i &point, const cv::Vec3i &clusterCenter, const MovieFrames &frames, int stiffness, int step){
+          if (clusterCenter[1] < 0 || clusterCenter[0] < 0 || clusterCenter[2] < 0) {
+              return DINF;
+          }
+          return metric(frames.at<uint8_t>(point), frames.at<uint8_t>(clusterCenter), point, clusterCenter, stiffness, step);
+      }
+
       inline double operator()(const cv::Vec3i &point, const cv::Vec3i &clusterCenter, const MovieCacheP &mat, int stiffness, int step){
           if (clusterCenter[1] < 0 || clusterCenter[0] < 0 || clusterCenter[2] < 0) {
               return DINF;
           }
-          int8_t pixel = mat->at<uint8_t>(point);
-          int8_t clust_pixel = mat->at<uint8_t>(clusterCenter);
+          return metric(mat->at<uint8_t>(point), mat->at<uint8_t>(clusterCenter), point, clusterCenter, stiffness, step);
+      }
+
+  private:
+      static inline double metric(int pixel, int clust_pixel, const cv::Vec3i &point, const cv::Vec3i &clusterCenter, int stiffness, int step){
           double dc = abs(pixel - clust_pixel);
           double ds = sqrt(pow(point[0] - clusterCenter[0], 2)
                   + pow(point[1] - clusterCenter[1], 2)
                   + pow(point[2] - clusterCenter[2], 2));
           return /*sqrt(*/pow(dc, 2) / stiffness + pow(ds / step, 2)/*)*/;
-
       }
   };
 
@@ -109,22 +212,88 @@ namespace RSlic {
   * @return the result of slic->iterate or slic->iterateZero with the right metrics.
   * (May nullptr if type is not supported or any other error occurs)
   */
-  inline Slic3P iterateHelper(Slic3P p, int type, bool slico){
+  template<typename Label>
+  inline Slic3TP<Label> iterateHelper(Slic3TP<Label> p, int type, bool slico){
       if (slico){
           return slicFunHelper(type,p->iterateZero);
       }
       return slicFunHelper(type,p->iterate);
   }
 
+  /**
+  * Iterates until the clusters (nearly) don't change anymore.
+  * @param slic the Slic3-Object to iterate
+  * @param f the functor with the metrics for the iteration
+  * @param threshold stop as soon as at most this fraction of the voxels got another label (Residual::changed).
+  * With 0 it only stops if nothing changes anymore, so the result is the same as after maxIter iterations.
+  * Only the clusters that still change are assigned again (iterateActive with tolerance 0), the result is the same as with iterate.
+  * @param maxIter maximal amount of iterations
+  * @param slico use iterateZero instead of iterate
+  * @param iterations if not nullptr, the amount of done iterations will be stored there
+  * @return the last instance (slic itself if maxIter <= 0)
+  */
+  template<typename Label, typename F>
+  inline Slic3TP<Label> iterateUntil(Slic3TP<Label> slic, F f, double threshold, int maxIter, bool slico = false, int *iterations = nullptr) {
+      int i = 0;
+      while (i < maxIter) {
+          slic = slico ? slic->template iterateZeroActive<F>(f) : slic->template iterateActive<F>(f);
+          i++;
+          if (slic->getResidual().changed <= threshold) break;
+      }
+      if (iterations != nullptr) *iterations = i;
+      return slic;
+  }
+
+  /**
+  * Same as iterateUntil, but iterates the engine in place (no new buffers for every iteration).
+  * @param engine the engine to iterate
+  * @param f the functor with the metrics for the iteration
+  * @param threshold stop as soon as at most this fraction of the voxels got another label (Residual::changed).
+  * @param maxIter maximal amount of iterations
+  * @param slico use iterateZeroActive instead of iterateActive
+  * @return the amount of done iterations
+  */
+  template<typename Label, typename F>
+  inline int iterateUntil(Slic3EngineT<Label> &engine, F f, double threshold, int maxIter, bool slico = false) {
+      int i = 0;
+      while (i < maxIter) {
+          const Residual &residual = slico ? engine.template iterateZeroActive<F>(f) : engine.template iterateActive<F>(f);
+          i++;
+          if (residual.changed <= threshold) break;
+      }
+      return i;
+  }
+
   /**
   * Returns Slic3P without any "complicated" parameter.
   * @param m the moviecache
   * @param the amount of Superpixel (approximately)
   * @param slico use the slico version?
-  * @param iterations how many iterations
+  * @param iterations how many iterations (at most, it stops if nothing changes anymore)
   * @return instance of Slic3 (shared_ptr) where no iterating or something similar is needed. (error -> nullptr)
   */
    Slic3P shutUpAndTakeMyMoney(const RSlic::Voxel::MovieCacheP &m, int count = 4000, int stiffness = 40, bool slico = false, int iterations = 10);
+
+  /**
+  * Same as shutUpAndTakeMyMoney above, but with the label type Label (int16_t or int32_t).
+  * Use it with withClusterInt to select the label type based on count.
+  * @see shutUpAndTakeMyMoney
+  */
+   template<typename Label>
+   Slic3TP<Label> shutUpAndTakeMyMoney(const RSlic::Voxel::MovieCacheP &m, int count = 4000, int stiffness = 40, bool slico = false, int iterations = 10);
+
+  /**
+  * Computes the statistics of all clusters (area, bounding box, centroid, mean and variance of every channel,
+  * optionally the covariance of the channels) in one pass over the movie.
+  * The images are pinned in slabs of img->windowSize(), inside a slab every band of rows has its own sums.
+  * @param img the movie (any depth, at most 4 channels) or nullptr for the geometry only
+  * @param clusters the clusters
+  * @param pool threadpool for parallel computing (may be empty)
+  * @param withCovariance compute the covariance of every pair of channels, too
+  * @return the statistics (axes x, y, t; empty if img doesn't fit to the clusters or has more than 4 channels)
+  */
+   template<typename Label>
+   ClusterStats computeStats(const MovieCacheP &img, const ClusterSet3T<Label> &clusters, ThreadPoolP pool = ThreadPoolP(), bool withCovariance = false);
  }
 }
 
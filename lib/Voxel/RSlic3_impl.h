@@ -2,9 +2,15 @@
 #define RSlic3_IMPL_H
 
 #include "RSlic3.h"
+#include "RSlic3Engine.h"
 #include <priv/ZeroSlico_p.h>
 #include <priv/Useful.h>
-#include <3rd/ThreadPool.h>
+#include <priv/Parallel_p.h>
+#include <priv/ActiveSet_p.h>
+#include <priv/Connectivity_p.h>
+#include <priv/Trace_p.h>
+#include <ThreadPool.h>
+#include <typeindex>
 
 #ifndef u_long
 #define u_long unsigned long
@@ -17,19 +23,22 @@ using RSlic::priv::aSize;
 using namespace RSlic::Voxel;
 
 
-struct RSlic::Voxel::Slic3::Settings {
+template<typename Label>
+struct RSlic::Voxel::Slic3T<Label>::Settings {
 	Settings() : __refcount(0), step(0), stiffness(0) {
 	}
 
 	Settings(const Settings *other) :
 			__refcount(0), step(other->step), distFunc(other->distFunc), pool(other->pool),
-			img(other->img), stiffness(other->stiffness), gradFunc(other->gradFunc) {
+			img(other->img), stiffness(other->stiffness), gradFunc(other->gradFunc), tracer(other->tracer) {
 	}
 
+	// threadcount <= 0: the default pool (shared by everyone, so not every initialize starts threads)
 	void initThread(int threadcount = -1) {
 		if (threadcount <= 0)
-			threadcount = std::thread::hardware_concurrency();
-		pool = std::make_shared<ThreadPool>(threadcount);
+			pool = ThreadPool::defaultPool();
+		else
+			pool = std::make_shared<ThreadPool>(threadcount);
 	}
 
 	~Settings() {
@@ -41,27 +50,145 @@ struct RSlic::Voxel::Slic3::Settings {
 	shared_ptr<ThreadPool> pool;
 	DistanceFunc distFunc;
 	GradFunc gradFunc;
+	TracerP tracer; // may be empty
 
 	std::atomic<int> __refcount;
 };
 
+template<typename Label>
 template<typename F>
-Slic3P RSlic::Voxel::Slic3::iterate(F f) const {
+Slic3TP<Label> RSlic::Voxel::Slic3T<Label>::iterate(F f) const {
 	return iterate(setting->stiffness, f);
 }
 
+//See RSlic2_impl.h
+template<typename Label>
+template<typename F>
+Slic3TP<Label> RSlic::Voxel::Slic3T<Label>::iterate(int stiffness, F f) const {
+	Slic3EngineT<Label> engine(*this);
+	engine.template iterate<F>(stiffness, f);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+Slic3TP<Label> RSlic::Voxel::Slic3T<Label>::iterateActive(F f, double tolerance) const {
+	Slic3EngineT<Label> engine(*this);
+	engine.template iterateActive<F>(f, tolerance);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+Slic3TP<Label> RSlic::Voxel::Slic3T<Label>::iterateZero(F f) const {
+	Slic3EngineT<Label> engine(*this);
+	engine.template iterateZero<F>(f);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+Slic3TP<Label> RSlic::Voxel::Slic3T<Label>::iterateZeroActive(F f, double tolerance) const {
+	Slic3EngineT<Label> engine(*this);
+	engine.template iterateZeroActive<F>(f, tolerance);
+	return engine.snapshot();
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterate(F f) {
+	return iterateNormal<F>(setting->stiffness, f, -1);
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterate(int stiffness, F f) {
+	return iterateNormal<F>(stiffness, f, -1);
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterateActive(F f, double tolerance) {
+	return iterateNormal<F>(setting->stiffness, f, std::max(0.0, tolerance));
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterateZero(F f) {
+	return iterateSlico<F>(f, -1);
+}
+
+template<typename Label>
+template<typename F>
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterateZeroActive(F f, double tolerance) {
+	return iterateSlico<F>(f, std::max(0.0, tolerance));
+}
+
 namespace RSlic {
  namespace Voxel {
   namespace priv {
+   /**
+   * Whether the metric F reads the voxels from the pinned frames instead of the MovieCache:
+   * double operator()(const Vec3i &point, const Vec3i &center, const MovieFrames &frames, int stiffness, int step)
+   * Otherwise it gets the MovieCache (one virtual matAt call for every voxel it reads).
+   */
+   template<typename F>
+   struct usesFrames {
+	   template<typename G>
+	   static auto test(int) -> decltype(std::declval<G &>()(Vec3i(), Vec3i(), std::declval<const MovieFrames &>(), 0, 0), std::true_type());
+
+	   template<typename G>
+	   static std::false_type test(...);
+
+	   static const bool value = decltype(test<F>(0))::value;
+   };
+
+   //Calls the metric with the frames or the MovieCache (see usesFrames)
+   template<typename F, bool = usesFrames<F>::value>
+   struct Metric {
+	   static inline double call(F &f, const Vec3i &point, const Vec3i &center, const MovieCacheP &img, const MovieFrames &, int stiffness, int step) {
+		   return f(point, center, img, stiffness, step);
+	   }
+   };
+
+   template<typename F>
+   struct Metric<F, true> {
+	   static inline double call(F &f, const Vec3i &point, const Vec3i &center, const MovieCacheP &, const MovieFrames &frames, int stiffness, int step) {
+		   return f(point, center, frames, stiffness, step);
+	   }
+   };
+
+   /**
+   * Splits the movie into slabs of images [t0, t1) that fit into the cache (see MovieCache::windowSize)
+   * and calls f(t0, t1, frames) for every slab with the images [t0 - margin, t1 + margin) pinned.
+   * Meanwhile the images of the next slab are prefetched.
+   * @param img the movie
+   * @param margin how many images before and after the slab are needed, too
+   * @param f the function
+   */
+   template<typename F>
+   inline void forEachSlab(const MovieCache &img, int margin, F f) {
+	   const int d = img.duration();
+	   const int window = img.windowSize();
+	   const int len = window >= d ? d : std::max(1, window - 2 * margin);
+	   for (int t0 = 0; t0 < d; t0 += len) {
+		   const int t1 = std::min(d, t0 + len);
+		   const MovieFrames frames = img.frames(t0 - margin, t1 + margin);
+		   if (t1 < d) img.prefetch(t1 + margin, std::min(d, t1 + len + margin));
+		   f(t0, t1, frames);
+	   }
+   }
+
 /* See RSlic2_impl.h for more information
  */
    template<typename F>
    struct DistNormal {
 	   inline double operator()(const Vec3i &point, const Vec3i &center, int clusterIdx) {
-		   return f(point, center, img, stiffness * stiffness, step);
+		   return Metric<F>::call(f, point, center, img, *frames, stiffness * stiffness, step);
 	   }
 
 	   const RSlic::Voxel::MovieCacheP img;
+	   const MovieFrames *frames; // the pinned frames of the current slab
 	   F f;
 	   int stiffness;
 	   int step;
@@ -69,207 +196,261 @@ namespace RSlic {
   }
  }
 }
-namespace {
- /*
- 	See RSlic2_impl.h for more information
-  */
- struct BRect {
-	 static constexpr uint imax = std::numeric_limits<unsigned int>::max();
-	 struct point {
-		 uint x;
-		 uint y;
-		 uint z;
-	 };
-	 point topFrontLeft, bottomBackRight;
-
-	 BRect(uint tx, uint ty, uint tz, uint bx, uint by, uint bz)
-			 : topFrontLeft{tx, ty, tz}, bottomBackRight{bx, by, bz} {
-	 }
-
-	 BRect() : topFrontLeft{imax, imax, imax}, bottomBackRight{0, 0, 0} {
-	 }
-
-	 void combineWith(const BRect &other) {
-		 topFrontLeft.x = std::min(topFrontLeft.x, other.topFrontLeft.x);
-		 topFrontLeft.y = std::min(topFrontLeft.y, other.topFrontLeft.y);
-		 topFrontLeft.z = std::min(topFrontLeft.z, other.topFrontLeft.z);
-		 bottomBackRight.x = std::max(bottomBackRight.x, other.bottomBackRight.x);
-		 bottomBackRight.y = std::max(bottomBackRight.y, other.bottomBackRight.y);
-		 bottomBackRight.z = std::max(bottomBackRight.z, other.bottomBackRight.z);
-	 }
- };
-}
 namespace RSlic {
  namespace Voxel {
+  //See RSlic2_impl.h (without the features)
+  struct AssignmentInputs {
+	  AssignmentInputs(std::type_index metric, bool zero, int stiffness, const vector<Vec3i> &centers, const vector<double> *maxDistance) :
+			  metric(metric), zero(zero), stiffness(stiffness), centers(centers) {
+		  if (maxDistance != nullptr) this->maxDistance = *maxDistance;
+	  }
+
+	  std::type_index metric; // typeid of the metric functor
+	  bool zero; // Slico
+	  int stiffness;
+	  vector<Vec3i> centers;
+	  vector<double> maxDistance; // Slico
+  };
+
   namespace priv {
+   //See RSlic2_impl.h (a "row" is the time line of the point y,x here)
+   template<typename Label>
    struct iterateCommonRes {
-	   Mat_<ClusterInt> label;
-	   Mat_<double> dist;
+	   using Dist = RSlic::priv::DistanceType;
 
-	   iterateCommonRes(const cv::MatSize &size) : label(3, size, -1), dist(3, size, DINF) {
-	   }
+	   Mat_<Label> label;
+	   Mat_<Dist> dist;
+	   double changed = 0; // fraction of the voxels with another label than before
 
-	   inline double &distAt(int y, int x, int t) {
-		   return dist.at<double>(y, x, t);
+	   iterateCommonRes(Mat_<Label> &spareLabel, Mat &spareDist, const cv::MatSize &size) {
+		   spareLabel.create(3, size);
+		   spareDist.create(3, size, DataType<Dist>::type);
+		   label = spareLabel;
+		   dist = spareDist;
 	   }
 
-	   inline ClusterInt &labelAt(int y, int x, int t) {
-		   return label.at<ClusterInt>(y, x, t);
+	   inline Dist *distRow(int y, int x) {
+		   return dist.template ptr<Dist>(y, x);
 	   }
 
-#ifdef PARALLEL
-         BRect calcRect;
-#endif
+	   inline Label *labelRow(int y, int x) {
+		   return label.template ptr<Label>(y, x);
+	   }
    };
 
-   using iterateCommonResP = unique_ptr<iterateCommonRes>;
+   template<typename Label>
+   using iterateCommonResP = unique_ptr<iterateCommonRes<Label>>;
+
+   //See RSlic2_impl.h
+   inline unique_ptr<RSlic::priv::DirtyCells> planActive(const AssignmentInputs *last, AssignmentInputs &next, double tolerance, int s, const cv::MatSize &size) {
+	   if (tolerance < 0 || last == nullptr || last->metric != next.metric || last->zero != next.zero || last->stiffness != next.stiffness
+			   || last->centers.size() != next.centers.size())
+		   return unique_ptr<RSlic::priv::DirtyCells>();
+	   unique_ptr<RSlic::priv::DirtyCells> dirty(new RSlic::priv::DirtyCells(s, size[0], size[1], size[2]));
+	   for (size_t k = 0; k < next.centers.size(); k++) {
+		   const Vec3i &before = last->centers[k];
+		   const Vec3i &now = next.centers[k];
+		   const double dx = now[0] - before[0], dy = now[1] - before[1], dt = now[2] - before[2];
+		   bool active = dx * dx + dy * dy + dt * dt > tolerance * tolerance;
+		   if (next.zero && !active) active = std::abs(next.maxDistance[k] - last->maxDistance[k]) > tolerance;
+		   if (active) {
+			   dirty->markWindow(before[0], before[1], before[2], s);
+			   dirty->markWindow(now[0], now[1], now[2], s);
+		   } else {
+			   next.centers[k] = before;
+			   if (next.zero) next.maxDistance[k] = last->maxDistance[k];
+		   }
+	   }
+	   return dirty;
+   }
   }
  }
 }
 namespace {
- template<typename F>
- inline RSlic::Voxel::priv::iterateCommonResP iterateCommonIteration(F f, int beg, int end, const cv::MatSize &size, const vector<Vec3i> &centers, int s, ThreadPoolP pool) {
-	 RSlic::Voxel::priv::iterateCommonResP result(new RSlic::Voxel::priv::iterateCommonRes(size));
+ //See RSlic2_impl.h (the bands are made of y-slices here, only the voxels of the slab [tBeg, tEnd) are assigned)
+ template<typename F, typename Label>
+ inline long iterateCommonIteration(F &f, int yBeg, int yEnd, int tBeg, int tEnd, const cv::MatSize &size, const vector<Vec3i> &centers, int s, RSlic::Voxel::priv::iterateCommonRes<Label> &result, const RSlic::priv::DirtyCells *dirty = nullptr) {
+	 using Dist = RSlic::priv::DistanceType;
 	 const int w = size[1];
-	 const int h = size[0];
-	 const int duration = size[2];
-	 for (int k = beg; k < end; k++) {
+	 const int N = centers.size();
+	 long distanceCount = 0;
+	 for (int k = 0; k < N; k++) {
 		 auto center = centers[k];
 		 int px = center[0];
 		 int py = center[1];
 		 int pt = center[2];
-#ifdef PARALLEL
-                 BRect currentRect(std::max(0, px - s), std::max(0, py - s), std::max(0, pt - s),
-                                 std::min(w, px + s + 1), std::min(h, py + s + 1), std::min(duration, pt + s + 1));
-                 result->calcRect.combineWith(currentRect);
-#endif
-		 for (int x = std::max(0, px - s); x < std::min(w, px + s + 1); x++) {
-			 for (int y = std::max(0, py - s); y < std::min(h, py + s + 1); y++) {
-				 for (int t = std::max(0, pt - s); t < std::min(duration, pt + s + 1); t++) {
-					 Vec3i point(x, y, t);
-					 double &d = result->distAt(y, x, t);
-					 double D = f(point, center, k);
-					 if (D < d) {
-						 d = D;
-						 result->labelAt(y, x, t) = k;
+		 int y0 = std::max(yBeg, py - s);
+		 int y1 = std::min(yEnd, py + s + 1);
+		 if (y0 >= y1) continue;
+		 const int x0 = std::max(0, px - s);
+		 const int x1 = std::min(w, px + s + 1);
+		 const int t0 = std::max(tBeg, pt - s);
+		 const int t1 = std::min(tEnd, pt + s + 1);
+		 if (t0 >= t1) continue;
+		 if (dirty != nullptr && !dirty->any(y0, y1, x0, x1, t0, t1)) continue;
+		 for (int y = y0; y < y1; y++) {
+			 for (int x = x0; x < x1; x++) {
+				 Dist *distRow = result.distRow(y, x);
+				 Label *labelRow = result.labelRow(y, x);
+				 auto assignRun = [&](int tBeg, int tEnd) {
+					 distanceCount += tEnd - tBeg;
+					 for (int t = tBeg; t < tEnd; t++) {
+						 const Dist D = static_cast<Dist>(f(Vec3i(x, y, t), center, k));
+						 if (D < distRow[t]) {
+							 distRow[t] = D;
+							 labelRow[t] = k;
+						 }
 					 }
-				 }
+				 };
+				 if (dirty == nullptr) assignRun(t0, t1);
+				 else dirty->forEachRunInTimeline(y, x, t0, t1, assignRun);
 			 }
 		 }
 	 }
-	 return result;
- }
-
-#ifndef PARALLEL
-
-//See RSlic2_impl.cpp
- template<typename F>
- RSlic::Voxel::priv::iterateCommonResP iterateCommon(F f, const ClusterSet3 &clusters, int s, ThreadPoolP pool) {
-	 auto &&size = clusters.getClusterLabel().size;
-	 auto centers = clusters.getCenters();
-	 int N = centers.size();
-	 return iterateCommonIteration(f, 0, N, size, centers, s, pool);
+	 return distanceCount;
  }
 
-#else
-
- //See RSlic2_impl.cpp
- template<typename F>
- RSlic::Voxel::priv::iterateCommonResP iterateCommon(F f, const ClusterSet3 &clusters, int s, ThreadPoolP pool) {
-         auto &&size = clusters.getClusterLabel().size;
-         auto centers = clusters.getCenters();
-         RSlic::Voxel::priv::iterateCommonResP result(new RSlic::Voxel::priv::iterateCommonRes(size));
-         int N = centers.size();
-         int thread_step = N / pool->threadcount();
-         std::vector<std::future<RSlic::Voxel::priv::iterateCommonResP>> futures;
-         futures.reserve(pool->threadcount());
-         //Map
-         for (int thread_start = 0; thread_start < N; thread_start += thread_step) {
-                 futures.push_back(pool->enqueue([&](int start) {
-                         return iterateCommonIteration(f, start, std::min(start + thread_step, N), size, centers, s, pool);
-                 }, thread_start));
-         }
-         //Reduce
-         for (auto &&fut: futures) {
-                 auto &&thread_result = fut.get();
-                 for (int x = thread_result->calcRect.topFrontLeft.x; x < thread_result->calcRect.bottomBackRight.x; x++) {
-                         for (int y = thread_result->calcRect.topFrontLeft.y; y < thread_result->calcRect.bottomBackRight.y; y++) {
-                                 for (int t = thread_result->calcRect.topFrontLeft.z; t < thread_result->calcRect.bottomBackRight.z; t++) {
-                                         double dist_thread = thread_result->distAt(y, x, t);
-                                         double &dist_result = result->distAt(y, x, t);
-                                         if (dist_thread < dist_result) {
-                                                 dist_result = dist_thread;
-                                                 result->labelAt(y, x, t) = thread_result->labelAt(y, x, t);
-                                         }
-                                 }
-                         }
-                 }
-         }
-         return result;
+ //See RSlic2_impl.h (only the assignment is restricted to the dirty cells, the new centers are computed from all voxels)
+ //The movie is assigned slab by slab (see forEachSlab), every voxel still sees the clusters in the same order.
+ template<typename F, typename Label>
+ RSlic::Voxel::priv::iterateCommonResP<Label> iterateCommon(F f, const MovieCache &img, const ClusterSet3T<Label> &clusters, const Mat &distance,
+		 const vector<Vec3i> &centers, const RSlic::priv::DirtyCells *dirty, int s, ThreadPoolP pool, Mat_<Label> &spareLabel, Mat &spareDist, RSlic::Tracer *tracer) {
+	 using Dist = RSlic::priv::DistanceType;
+	 const Mat_<Label> oldLabel = clusters.getClusterLabel();
+	 const Mat_<Dist> oldDist = distance;
+	 auto &&size = oldLabel.size;
+	 RSlic::priv::TraceScope traceAssign(tracer, "assign", -1, RSlic::priv::bandThreads(pool.get(), size[0]));
+	 const void *spareData[] = {spareLabel.data, spareDist.data};
+	 RSlic::Voxel::priv::iterateCommonResP<Label> result(new RSlic::Voxel::priv::iterateCommonRes<Label>(spareLabel, spareDist, size));
+	 if (spareLabel.data != spareData[0]) traceAssign.allocated(RSlic::priv::matBytes(spareLabel));
+	 if (spareDist.data != spareData[1]) traceAssign.allocated(RSlic::priv::matBytes(spareDist));
+	 if (dirty != nullptr && dirty->mostlyDirty()) dirty = nullptr; // same result, but cheaper
+	 RSlic::priv::forEachBand(pool.get(), size[0], [&](int, int yBeg, int yEnd) {
+		 // Start with nothing assigned or (active) with the old labels except for the dirty voxels
+		 for (int y = yBeg; y < yEnd; y++) {
+			 for (int x = 0; x < size[1]; x++) {
+				 Dist *distRow = result->distRow(y, x);
+				 Label *labelRow = result->labelRow(y, x);
+				 if (dirty == nullptr) {
+					 std::fill(distRow, distRow + size[2], std::numeric_limits<Dist>::infinity());
+					 std::fill(labelRow, labelRow + size[2], static_cast<Label>(-1));
+					 continue;
+				 }
+				 const Dist *oldDistRow = oldDist.template ptr<Dist>(y, x);
+				 const Label *oldLabelRow = oldLabel.template ptr<Label>(y, x);
+				 std::copy(oldDistRow, oldDistRow + size[2], distRow);
+				 std::copy(oldLabelRow, oldLabelRow + size[2], labelRow);
+				 dirty->forEachRunInTimeline(y, x, 0, size[2], [&](int tBeg, int tEnd) {
+					 std::fill(distRow + tBeg, distRow + tEnd, std::numeric_limits<Dist>::infinity());
+					 std::fill(labelRow + tBeg, labelRow + tEnd, static_cast<Label>(-1));
+				 });
+			 }
+		 }
+	 });
+	 RSlic::Voxel::priv::forEachSlab(img, s, [&](int tBeg, int tEnd, const MovieFrames &frames) {
+		 f.frames = &frames;
+		 RSlic::priv::forEachBand(pool.get(), size[0], [&](int band, int yBeg, int yEnd) {
+			 RSlic::priv::TraceScope traceBand(tracer, "assign", band);
+			 traceBand.count(iterateCommonIteration(f, yBeg, yEnd, tBeg, tEnd, size, centers, s, *result, dirty),
+					 static_cast<long>(yEnd - yBeg) * size[1] * (tEnd - tBeg));
+		 });
+	 });
+	 traceAssign.end();
+	 //Compare with the old labels (residual)
+	 RSlic::priv::TraceScope traceReduce(tracer, "reduce");
+	 const long changed = RSlic::priv::reduceBands(pool.get(), size[0], 0l, [&](int yBeg, int yEnd) {
+		 long changed = 0;
+		 for (int y = yBeg; y < yEnd; y++) {
+			 for (int x = 0; x < size[1]; x++) {
+				 const Label *oldRow = oldLabel.template ptr<Label>(y, x);
+				 const Label *newRow = result->labelRow(y, x);
+				 auto compareRun = [&](int tBeg, int tEnd) {
+					 for (int t = tBeg; t < tEnd; t++) {
+						 if (oldRow[t] != newRow[t]) changed++;
+					 }
+				 };
+				 if (dirty == nullptr) compareRun(0, size[2]);
+				 else dirty->forEachRunInTimeline(y, x, 0, size[2], compareRun);
+			 }
+		 }
+		 return changed;
+	 }, std::plus<long>());
+	 result->changed = static_cast<double>(changed) / (static_cast<double>(size[0]) * size[1] * size[2]);
+	 return result;
  }
-
-#endif
 }
 
+template<typename Label>
 template<typename F>
-Slic3P RSlic::Voxel::Slic3::iterate(int stiffness, F f) const {
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterateNormal(int stiffness, F f, double tolerance) {
 	const int s = setting->step;
 
+	//Which clusters have to be assigned again (all of them without tolerance)
+	auto next = std::make_shared<AssignmentInputs>(typeid(F), false, stiffness, clusters.getCenters(), nullptr);
+	auto dirty = Voxel::priv::planActive(assignment.get(), *next, tolerance, s, clusters.getClusterLabel().size);
+
 	//Set up the normal Slic version
-	RSlic::Voxel::priv::DistNormal<F> distF{setting->img, f, setting->stiffness, s};
-	auto res = ::iterateCommon<RSlic::Voxel::priv::DistNormal<F>>(distF, clusters, s, setting->pool);
+	RSlic::Voxel::priv::DistNormal<F> distF{setting->img, nullptr, f, stiffness, s};
+	auto res = ::iterateCommon<RSlic::Voxel::priv::DistNormal<F>, Label>(distF, *setting->img, clusters, distance, next->centers, dirty.get(), s, setting->pool, spareLabel, spareDistance, setting->tracer.get());
 
-	//create a new instance
-	Settings *newSetting = setting;
+	//the new state
 	if (setting->stiffness != stiffness) {
-		newSetting = new Settings(setting);
+		Settings *newSetting = new Settings(setting);
 		newSetting->stiffness = stiffness;
+		newSetting->__refcount++;
+		if (--setting->__refcount == 0) delete setting;
+		setting = newSetting;
 	}
-	Slic3 *result = new Slic3(newSetting, ClusterSet3(res->label, clusters.getCenters().size()), res->dist);
-	return shared_ptr<Slic3>(result);
+	RSlic::priv::TraceScope traceCenters(setting->tracer.get(), "centers");
+	ClusterSet3T<Label> newClusters(res->label, clusters.getCenters().size());
+	residual.displacement = RSlic::priv::centerDisplacement(clusters.getCenters(), newClusters.getCenters());
+	traceCenters.end();
+	residual.changed = res->changed;
+	swap(std::move(newClusters), res->dist);
+	assignment = std::move(next);
+	return residual;
 }
 
 namespace {
- template<typename T>
+ template<typename T, typename Label>
  inline void iterateZeroUpdate3(
-		 const MovieCacheP &img, const Mat &label,
-		 const vector<Vec3i> &centers, vector<double> &max_dist_color, std::shared_ptr<ThreadPool> pool) {
-	 int w = img->width();
-	 int h = img->height();
-	 int d = img->duration();
-	 //Update Slico distance maxima
-#ifdef PARALLEL
-         std::vector<std::future<void>> results;
-         results.reserve(pool->threadcount());
-         int step = w / pool->threadcount();
-         for (int x = 0; x < w; x += step) {
-                 results.push_back(pool->enqueue([&](int xx) {
-                         for (int x = xx; x < std::min(xx + step, w); x++) {
-#else
-	 for (int x = 0; x < w; x++) {
-#endif
-		 for (int y = 0; y < h; y++) {
-			 for (int t = 0; t < d; t++) {
-				 RSlic::Voxel::ClusterInt nearest_segment = label.at<RSlic::Voxel::ClusterInt>(y, x, t);
-				 if (nearest_segment == -1) continue;
-				 auto point = centers[nearest_segment];
-				 int py = point[1];
-				 int px = point[0];
-				 int pt = point[2];
-				 auto distColor = RSlic::priv::zero::zeroMetrik(img->at<T>(y, x, t), img->at<T>(py, px, pt));
-				 if (max_dist_color.at(nearest_segment) < distColor) {
-					 max_dist_color.at(nearest_segment) = distColor;
+		 const MovieCache &img, const Mat_<Label> &label,
+		 const vector<Vec3i> &centers, vector<double> &max_dist_color, std::shared_ptr<ThreadPool> pool, int s, RSlic::Tracer *tracer) {
+	 int w = label.size[1];
+	 int h = label.size[0];
+	 RSlic::priv::TraceScope trace(tracer, "slico", -1, RSlic::priv::bandThreads(pool.get(), h));
+	 //Update Slico distance maxima (every band for its own, merging afterwards)
+	 vector<vector<double>> bandMax(RSlic::priv::bandCount(pool.get(), h), max_dist_color);
+	 //The new center of a voxel's cluster is at most 2 * s images away (it was in the window of the old one)
+	 RSlic::Voxel::priv::forEachSlab(img, 2 * s + 1, [&](int tBeg, int tEnd, const MovieFrames &frames) {
+		 RSlic::priv::forEachBand(pool.get(), h, [&](int band, int yBeg, int yEnd) {
+			 RSlic::priv::TraceScope traceBand(tracer, "slico", band);
+			 traceBand.count(0, static_cast<long>(yEnd - yBeg) * w * (tEnd - tBeg));
+			 vector<double> &localMax = bandMax[band];
+			 for (int y = yBeg; y < yEnd; y++) {
+				 for (int x = 0; x < w; x++) {
+					 const Label *labelRow = label.template ptr<Label>(y, x);
+					 for (int t = tBeg; t < tEnd; t++) {
+						 Label nearest_segment = labelRow[t];
+						 if (nearest_segment == -1) continue;
+						 auto point = centers[nearest_segment];
+						 int py = point[1];
+						 int px = point[0];
+						 int pt = point[2];
+						 auto distColor = RSlic::priv::zero::zeroMetrik(frames.at<T>(y, x, t), frames.at<T>(py, px, pt));
+						 if (localMax[nearest_segment] < distColor) {
+							 localMax[nearest_segment] = distColor;
+						 }
+					 }
 				 }
 			 }
+		 });
+	 });
+	 for (const auto &localMax: bandMax) {
+		 for (size_t i = 0; i < max_dist_color.size(); i++) {
+			 max_dist_color[i] = std::max(max_dist_color[i], localMax[i]);
 		 }
-#ifdef PARALLEL
-                         }
-                 }, x));
-#endif
 	 }
-#ifdef PARALLEL
-         for (auto &res: results) {res.get();}
-#endif
  }
 
  declareCVF_T(iterateZeroUpdate3, iterateZeroUpdate3Helper, return)
@@ -281,10 +462,11 @@ namespace RSlic {
    template<typename F>
    struct DistZero {
 	   inline double operator()(const Vec3i &point, const Vec3i &center, int clusterIdx) {
-		   return f(point, center, img, max_distance[clusterIdx], step);
+		   return Metric<F>::call(f, point, center, img, *frames, max_distance[clusterIdx], step);
 	   }
 
 	   const RSlic::Voxel::MovieCacheP img;
+	   const MovieFrames *frames; // the pinned frames of the current slab
 	   F f;
 	   const vector<double> &max_distance;
 	   int step;
@@ -293,95 +475,148 @@ namespace RSlic {
  }
 }
 
+template<typename Label>
 template<typename F>
-Slic3P RSlic::Voxel::Slic3::iterateZero(F f) const {
+const RSlic::Voxel::Residual &RSlic::Voxel::Slic3EngineT<Label>::iterateSlico(F f, double tolerance) {
 	const int s = setting->step;
+	//Which clusters have to be assigned again (all of them without tolerance)
+	auto next = std::make_shared<AssignmentInputs>(typeid(F), true, setting->stiffness, clusters.getCenters(), &max_dist_color);
+	auto dirty = Voxel::priv::planActive(assignment.get(), *next, tolerance, s, clusters.getClusterLabel().size);
+
 	//Set up Slico
-	Voxel::priv::DistZero<F> distF{setting->img, f, max_dist_color, s};
-	auto res = ::iterateCommon<Voxel::priv::DistZero<F>>(distF, clusters, s, setting->pool);
+	Voxel::priv::DistZero<F> distF{setting->img, nullptr, f, next->maxDistance, s};
+	auto res = ::iterateCommon<Voxel::priv::DistZero<F>, Label>(distF, *setting->img, clusters, distance, next->centers, dirty.get(), s, setting->pool, spareLabel, spareDistance, setting->tracer.get());
 
+	RSlic::priv::TraceScope traceCenters(setting->tracer.get(), "centers");
+	ClusterSet3T<Label> newClusters(res->label, clusters.getCenters().size());
+	residual.displacement = RSlic::priv::centerDisplacement(clusters.getCenters(), newClusters.getCenters());
+	traceCenters.end();
 	//update max_dist_color
-	ClusterSet3 newClusters(res->label, clusters.getCenters().size());
-	vector<double> new_max_dist_color(max_dist_color);
-	::iterateZeroUpdate3Helper(setting->img->type(), setting->img, res->label, newClusters.getCenters(), new_max_dist_color, setting->pool);
-	//creating a new instance
-	Slic3 *result = new Slic3(setting, std::move(newClusters), res->dist);
-	result->max_dist_color = std::move(new_max_dist_color);
-	return shared_ptr<Slic3>(result);
+	::iterateZeroUpdate3Helper(setting->img->type(), *setting->img, res->label, newClusters.getCenters(), max_dist_color, setting->pool, s, setting->tracer.get());
+	residual.changed = res->changed;
+	//the new state
+	swap(std::move(newClusters), res->dist);
+	assignment = std::move(next);
+	return residual;
 }
 
+template<typename Label>
 template<typename F>
-Slic3P RSlic::Voxel::Slic3::finalize(F f) const {
+Slic3TP<Label> RSlic::Voxel::Slic3T<Label>::finalize(F f) const {
 	int w = setting->img->width();
 	int h = setting->img->height();
 	int d = setting->img->duration();
+	RSlic::priv::TraceScope trace(setting->tracer.get(), "finalize");
 	int *size = setting->img->sizeArray();
-	Mat_<ClusterInt> finalClusters(3, size, -1);
+	Mat_<Label> finalClusters(3, size, -1);
 	delete size;
 	int currentLabel = 0;
 	const int lims = setting->step * setting->step * setting->step;// (h * w * d) / (clusters.clusterCount());
 	static const int neighboursX[] = {-1, 0, 1, 0, -1, 1, 1, -1, 0, 0};//{1, 0, 0, -1, 0, 0};
 	static const int neighboursY[aSize(neighboursX)] = {0, -1, 0, 1, -1, -1, 1, 1, 0, 0};//{0, 1, 0, 0, -1, 0};
 	static const int neighboursZ[aSize(neighboursX)] = {0, 0, 0, 0, 0, 0, 0, 0, -1, 1};//{0, 0, 1, 0, 0, -1};
+	const int neighbourCount = aSize(neighboursX);
+	const Mat_<Label> labels = clusters.getClusterLabel();
+	const int rowSize = w * d; // a row (y) is stored as x, t
+
+	//The connected voxel of the same cluster (neighbours like above), numbered in the order of their first voxel
+	const RSlic::priv::ComponentsT<int64_t> components = RSlic::priv::connectedComponents<int64_t>(setting->pool.get(), h, rowSize, [&labels, d, rowSize](int y, int k, int64_t *out) {
+		const Label *row = labels.template ptr<Label>(y);
+		const Label own = row[k];
+		const int64_t i = static_cast<int64_t>(y) * rowSize + k;
+		int count = 0;
+		if (k % d != 0 && row[k - 1] == own) out[count++] = i - 1; // t - 1
+		if (k >= d && row[k - d] == own) out[count++] = i - d; // x - 1
+		if (y > 0) {
+			const Label *above = labels.template ptr<Label>(y - 1);
+			if (above[k] == own) out[count++] = i - rowSize;
+			if (k >= d && above[k - d] == own) out[count++] = i - rowSize - d;
+			if (k + d < rowSize && above[k + d] == own) out[count++] = i - rowSize + d;
+		}
+		return count;
+	});
+	auto firstVoxel = [&components, d, rowSize](int64_t c) {
+		const int64_t i = components.first[c];
+		return Vec3i(static_cast<int>(i % rowSize / d), static_cast<int>(i / rowSize), static_cast<int>(i % d));
+	};
+	auto componentAt = [&components, d, rowSize](int x, int y, int t) {
+		return components.id[static_cast<int64_t>(y) * rowSize + static_cast<int64_t>(x) * d + t];
+	};
+
+	long distanceCount = 0;
+	//Distances from the first voxel of component c to its neighbours of the components before
+	//(DINF for the other ones), needs the images t - 1 to t + 1 in frames
+	auto neighbourDistances = [&](int64_t c, const MovieFrames &frames, double *out) {
+		const Vec3i point = firstVoxel(c);
+		for (int neighbour = 0; neighbour < neighbourCount; neighbour++) {
+			out[neighbour] = DINF;
+			int px = point[0] + neighboursX[neighbour];
+			int py = point[1] + neighboursY[neighbour];
+			int pt = point[2] + neighboursZ[neighbour];
+			if (px < 0 || px >= w || py < 0 || py >= h || pt < 0 || pt >= d) continue;
+			if (componentAt(px, py, pt) >= c) continue; // not labeled yet
+			out[neighbour] = Voxel::priv::Metric<F>::call(f, point, Vec3i(px, py, pt), setting->img, frames, 1, setting->step);
+			distanceCount++;
+		}
+	};
+
+	//The small components are joined with a neighbour. Their distances do not depend on the labels,
+	//so they are computed slab by slab (grouped by the time of the first voxel) and a cache that
+	//keeps only some images does not load the neighbouring ones for every component again.
+	const int64_t count = components.first.size();
+	vector<int64_t> smallOffset(count, -1);
+	vector<vector<int64_t>> smallAt(d);
+	int64_t smallCount = 0;
+	for (int64_t c = 0; c < count; c++) {
+		if (components.size[c] > lims >> 2) continue;
+		smallOffset[c] = smallCount++ * neighbourCount;
+		smallAt[components.first[c] % d].push_back(c);
+	}
+	vector<double> smallDistances(smallCount * neighbourCount);
+	if (smallCount > 0) {
+		Voxel::priv::forEachSlab(*setting->img, 1, [&](int t0, int t1, const MovieFrames &frames) {
+			for (int t = t0; t < t1; t++) {
+				for (int64_t c: smallAt[t]) neighbourDistances(c, frames, smallDistances.data() + smallOffset[c]);
+			}
+		});
+	}
 
-	for (int x = 0; x < w; x++) {
-		for (int y = 0; y < h; y++) {
-			for (int t = 0; t < d; t++) {
-				//Some unassigned pixel?
-				if (finalClusters.at<ClusterInt>(y, x, t) == -1) {
-					vector<Vec3i> current_points;
-					current_points.emplace_back(x, y, t);
-					finalClusters.at<ClusterInt>(y, x, t) = currentLabel;
-
-					//Look transitive for all unassigned neighbors
-					//set them in current_points and finalCluster
-					for (int i = 0; i < current_points.size(); i++) {
-						Vec3i point = current_points[i];
-						for (int neighbour = 0; neighbour < aSize(neighboursX); neighbour++) {
-							int px = point[0] + neighboursX[neighbour];
-							int py = point[1] + neighboursY[neighbour];
-							int pt = point[2] + neighboursZ[neighbour];
-							if (px < 0 || px >= w || py < 0 || py >= h || pt < 0 || pt >= d) continue;
-							if (finalClusters.at<ClusterInt>(py, px, pt) == -1
-									&& clusters.at(y, x, t) == clusters.at(py, px, pt)) {
-								current_points.emplace_back(px, py, pt);
-								finalClusters.at<ClusterInt>(py, px, pt) = currentLabel;
-							}
-						}
-					}
-
-					//If there are not enough pixel in the cluster
-					//look for the best in the environment and conjoin both
-					if (current_points.size() <= lims >> 2) {
-						int adjlabel = currentLabel;
-						double topdist = DINF;
-						
-						for (int neighbour = 0; neighbour < aSize(neighboursX); neighbour++) {
-							int px = x + neighboursX[neighbour];
-							int py = y + neighboursY[neighbour];
-							int pt = t + neighboursZ[neighbour];
-							if (px < 0 || px >= w || py < 0 || py >= h || pt < 0 || pt >= d) continue;
-							ClusterInt label = finalClusters.at<ClusterInt>(py, px, pt);
-							if (label >= 0 && label != currentLabel) {
-								double dist = f(Vec3i(x, y, t), Vec3i(px, py, pt), setting->img, 1, setting->step);
-								if (dist < topdist) { 
-									adjlabel = label;
-									topdist = dist;
-								}
-							}
-						}
-						//Set pixel to this neighbor
-						for (const Vec3i point: current_points) { 
-							finalClusters.at<ClusterInt>(point[1], point[0], point[2]) = adjlabel;
-						}
-					} else currentLabel++; 
+	//Every component becomes a new cluster. If there are not enough voxel in it (or no label is left)
+	//look for the best in the environment (of its first voxel, among the ones before) and conjoin both
+	vector<int> componentLabel(count);
+	double distances[aSize(neighboursX)];
+	for (int64_t c = 0; c < count; c++) {
+		if (smallOffset[c] >= 0 || currentLabel == std::numeric_limits<Label>::max()) {
+			const Vec3i point = firstVoxel(c);
+			const double *dist = distances;
+			if (smallOffset[c] >= 0) dist = smallDistances.data() + smallOffset[c];
+			else neighbourDistances(c, setting->img->frames(point[2] - 1, point[2] + 2), distances);
+			int adjlabel = currentLabel;
+			double topdist = DINF;
+			for (int neighbour = 0; neighbour < neighbourCount; neighbour++) {
+				if (dist[neighbour] == DINF) continue;
+				int label = componentLabel[componentAt(point[0] + neighboursX[neighbour], point[1] + neighboursY[neighbour], point[2] + neighboursZ[neighbour])];
+				if (label != currentLabel && dist[neighbour] < topdist) {
+					adjlabel = label;
+					topdist = dist[neighbour];
 				}
 			}
-		}
+			componentLabel[c] = adjlabel;
+		} else componentLabel[c] = currentLabel++;
 	}
 
-	Slic3 *result = new Slic3(setting, ClusterSet3(finalClusters, currentLabel), distance);
-	return std::shared_ptr<Slic3>(result);
+	RSlic::priv::forEachBand(setting->pool.get(), h, [&](int, int begin, int end) {
+		for (int y = begin; y < end; y++) {
+			Label *finalRow = finalClusters.template ptr<Label>(y);
+			const int64_t *ids = components.id.data() + static_cast<int64_t>(y) * rowSize;
+			for (int k = 0; k < rowSize; k++) finalRow[k] = componentLabel[ids[k]];
+		}
+	});
+	trace.count(distanceCount, static_cast<long>(h) * rowSize);
+	trace.allocated(RSlic::priv::matBytes(finalClusters) + 2 * sizeof(int64_t) * h * rowSize); // and the ids and trees of the components
+
+	Slic3T *result = new Slic3T(setting, ClusterSet3T<Label>(finalClusters, currentLabel), distance);
+	return std::shared_ptr<Slic3T>(result);
 }
 
 #endif // RSlic3_IMPL_H
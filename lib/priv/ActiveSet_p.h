@@ -0,0 +1,134 @@
+#ifndef ACTIVESET_P_H
+#define ACTIVESET_P_H
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+namespace RSlic {
+ namespace priv {
+
+  /**
+  * Coarse grid of cells (cellSize pixel in every direction) that marks where an active iteration
+  * has to recompute the labels. Everywhere else the labels and distances of the last iteration are kept.
+  * The cells are indexed like the pictures: (y, x) for Pixel, (y, x, t) for Voxel.
+  */
+  class DirtyCells {
+  public:
+	  /**
+	  * Creates a grid without any dirty cell.
+	  * @param cellSize edge length of a cell (the step)
+	  * @param h height of the picture
+	  * @param w width of the picture
+	  * @param d duration of the movie (1 for pictures)
+	  */
+	  DirtyCells(int cellSize, int h, int w, int d = 1) :
+			  size(std::max(1, cellSize)),
+			  ch((h + size - 1) / size), cw((w + size - 1) / size), cd((d + size - 1) / size),
+			  h(h), w(w), d(d), cells(static_cast<size_t>(ch) * cw * cd, 0), marked(0) {
+	  }
+
+	  /**
+	  * Marks every cell that intersects the window of radius s around (x, y, t).
+	  * (The window is the one the assignment searches, see iterateCommonIteration)
+	  */
+	  inline void markWindow(int x, int y, int t, int s) {
+		  const int y0 = std::max(0, y - s) / size, y1 = std::min(h - 1, y + s) / size;
+		  const int x0 = std::max(0, x - s) / size, x1 = std::min(w - 1, x + s) / size;
+		  const int t0 = std::max(0, t - s) / size, t1 = std::min(d - 1, t + s) / size;
+		  for (int cy = y0; cy <= y1; cy++) {
+			  for (int cx = x0; cx <= x1; cx++) {
+				  for (int ct = t0; ct <= t1; ct++) {
+					  uint8_t &cell = cells[index(cy, cx, ct)];
+					  if (!cell) marked++;
+					  cell = 1;
+				  }
+			  }
+		  }
+	  }
+
+	  /**
+	  * Returns the amount of dirty cells
+	  */
+	  inline long count() const {
+		  return marked;
+	  }
+
+	  /**
+	  * Returns whether so many cells are dirty that assigning everything is cheaper
+	  * (copying the old labels and working in runs costs, too).
+	  */
+	  inline bool mostlyDirty() const {
+		  return marked * 2 > static_cast<long>(cells.size());
+	  }
+
+	  /**
+	  * Returns whether any cell in the pixel ranges [y0, y1) x [x0, x1) x [t0, t1) is dirty.
+	  */
+	  inline bool any(int y0, int y1, int x0, int x1, int t0 = 0, int t1 = 1) const {
+		  if (marked == 0 || y0 >= y1 || x0 >= x1 || t0 >= t1) return false;
+		  for (int cy = y0 / size; cy <= (y1 - 1) / size; cy++) {
+			  for (int cx = x0 / size; cx <= (x1 - 1) / size; cx++) {
+				  for (int ct = t0 / size; ct <= (t1 - 1) / size; ct++) {
+					  if (cells[index(cy, cx, ct)]) return true;
+				  }
+			  }
+		  }
+		  return false;
+	  }
+
+	  /**
+	  * Splits the pixels [x0, x1) of row y into runs of dirty pixels and calls f(begin, end) for every run.
+	  */
+	  template<typename F>
+	  inline void forEachRunInRow(int y, int x0, int x1, F f) const {
+		  const uint8_t *row = &cells[index(y / size, 0, 0)];
+		  const int stride = cd;
+		  int x = x0;
+		  while (x < x1) {
+			  int cellEnd = std::min(x1, (x / size + 1) * size);
+			  if (!row[(x / size) * stride]) {
+				  x = cellEnd;
+				  continue;
+			  }
+			  const int begin = x;
+			  while (cellEnd < x1 && row[(cellEnd / size) * stride]) cellEnd = std::min(x1, cellEnd + size);
+			  f(begin, cellEnd);
+			  x = cellEnd;
+		  }
+	  }
+
+	  /**
+	  * Splits the voxels [t0, t1) of the time line of (y, x) into runs of dirty voxels and calls f(begin, end) for every run.
+	  */
+	  template<typename F>
+	  inline void forEachRunInTimeline(int y, int x, int t0, int t1, F f) const {
+		  const uint8_t *line = &cells[index(y / size, x / size, 0)];
+		  int t = t0;
+		  while (t < t1) {
+			  int cellEnd = std::min(t1, (t / size + 1) * size);
+			  if (!line[t / size]) {
+				  t = cellEnd;
+				  continue;
+			  }
+			  const int begin = t;
+			  while (cellEnd < t1 && line[cellEnd / size]) cellEnd = std::min(t1, cellEnd + size);
+			  f(begin, cellEnd);
+			  t = cellEnd;
+		  }
+	  }
+
+  private:
+	  inline size_t index(int cy, int cx, int ct) const {
+		  return (static_cast<size_t>(cy) * cw + cx) * cd + ct;
+	  }
+
+	  int size;
+	  int ch, cw, cd;
+	  int h, w, d;
+	  std::vector<uint8_t> cells;
+	  long marked;
+  };
+ }
+}
+#endif // ACTIVESET_P_H
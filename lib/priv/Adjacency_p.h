@@ -0,0 +1,98 @@
+#ifndef ADJACENCY_P_H
+#define ADJACENCY_P_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <AdjacencyGraph.h>
+#include "Parallel_p.h"
+
+namespace RSlic {
+ namespace priv {
+
+  //Sorts edges (key, length) and combines the ones with the same key
+  inline void mergeEdges(std::vector<std::pair<uint64_t, long>> &edges) {
+	  std::sort(edges.begin(), edges.end(), [](const std::pair<uint64_t, long> &a, const std::pair<uint64_t, long> &b) {
+		  return a.first < b.first;
+	  });
+	  size_t n = 0;
+	  for (size_t i = 0; i < edges.size(); i++) {
+		  if (n > 0 && edges[n - 1].first == edges[i].first) edges[n - 1].second += edges[i].second;
+		  else edges[n++] = edges[i];
+	  }
+	  edges.resize(n);
+  }
+
+  /**
+  * Collects the edges of a band (see adjacencyGraph)
+  */
+  class EdgeCollector {
+  public:
+	  EdgeCollector(std::vector<std::pair<uint64_t, long>> &edges, int clusterCount) : edges(edges), clusterCount(clusterCount) {
+	  }
+
+	  //Elements with the labels a and b are neighbours (length 1 along an axis, 0 diagonal)
+	  inline void operator()(int a, int b, int length) {
+		  if (a == b || a < 0 || b < 0 || a >= clusterCount || b >= clusterCount) return;
+		  if (a > b) std::swap(a, b);
+		  const uint64_t key = (static_cast<uint64_t>(a) << 32) | static_cast<uint32_t>(b);
+		  if (!edges.empty() && edges.back().first == key) edges.back().second += length;
+		  else edges.emplace_back(key, length);
+	  }
+
+  private:
+	  std::vector<std::pair<uint64_t, long>> &edges;
+	  int clusterCount;
+  };
+
+  /**
+  * Builds the region adjacency graph in one pass over the labels: every band of rows collects its edges
+  * (neighbouring pixels with the same pair of labels one after another are counted as one entry), then the edges of all bands
+  * are combined. Only the edges are kept, not a matrix of all pairs. The result does not depend on the threads.
+  * @param pool the threadpool (may be nullptr)
+  * @param rows number of rows (y)
+  * @param clusterCount amount of clusters (labels out of [0, clusterCount) are ignored)
+  * @param scan functor like void(int begin, int end, EdgeCollector &add): calls add(a, b, length) for all neighbouring elements
+  * of the rows [begin, end) with the labels a and b (length 1 for neighbours along an axis, 0 for diagonal ones)
+  * @return the graph
+  */
+  template<typename S>
+  AdjacencyGraph adjacencyGraph(ThreadPool *pool, int rows, int clusterCount, S scan) {
+	  std::vector<std::vector<std::pair<uint64_t, long>>> bands(bandCount(pool, rows));
+	  forEachBand(pool, rows, [&](int band, int begin, int end) {
+		  EdgeCollector add(bands[band], clusterCount);
+		  scan(begin, end, add);
+		  mergeEdges(bands[band]);
+	  });
+	  std::vector<std::pair<uint64_t, long>> edges = std::move(bands[0]);
+	  for (size_t b = 1; b < bands.size(); b++) {
+		  edges.insert(edges.end(), bands[b].begin(), bands[b].end());
+		  std::vector<std::pair<uint64_t, long>>().swap(bands[b]);
+	  }
+	  if (bands.size() > 1) mergeEdges(edges);
+
+	  // edges are sorted by (a, b) with a < b, so every neighbour list is filled in ascending order
+	  AdjacencyGraph res;
+	  res.offsets.assign(clusterCount + 1, 0);
+	  for (const auto &e: edges) {
+		  res.offsets[(e.first >> 32) + 1]++;
+		  res.offsets[(e.first & 0xffffffffu) + 1]++;
+	  }
+	  for (int k = 0; k < clusterCount; k++) res.offsets[k + 1] += res.offsets[k];
+	  res.neighbours.resize(2 * edges.size());
+	  res.boundary.resize(2 * edges.size());
+	  std::vector<int> pos(res.offsets.begin(), res.offsets.end() - 1);
+	  for (const auto &e: edges) {
+		  const int a = static_cast<int>(e.first >> 32);
+		  const int b = static_cast<int>(e.first & 0xffffffffu);
+		  res.neighbours[pos[a]] = b;
+		  res.boundary[pos[a]++] = e.second;
+		  res.neighbours[pos[b]] = a;
+		  res.boundary[pos[b]++] = e.second;
+	  }
+	  return res;
+  }
+ }
+}
+#endif // ADJACENCY_P_H
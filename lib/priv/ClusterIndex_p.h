@@ -0,0 +1,73 @@
+#ifndef CLUSTERINDEX_P_H
+#define CLUSTERINDEX_P_H
+
+#include <vector>
+#include <ClusterIndex.h>
+#include "Parallel_p.h"
+
+namespace RSlic {
+ namespace priv {
+
+  /**
+  * Visits the elements of a band for clusterIndex: counts them (elements == nullptr) or writes them to their position.
+  */
+  template<typename Index>
+  class IndexVisitor {
+  public:
+	  IndexVisitor(std::vector<long> &pos, Index *elements, int clusterCount) : pos(pos), elements(elements), clusterCount(clusterCount) {
+	  }
+
+	  //Element e has the label k
+	  inline void operator()(int k, Index e) {
+		  if (k < 0 || k >= clusterCount) return;
+		  if (elements == nullptr) pos[k]++;
+		  else elements[pos[k]++] = e;
+	  }
+
+  private:
+	  std::vector<long> &pos;
+	  Index *elements;
+	  int clusterCount;
+  };
+
+  /**
+  * Builds the index of the elements of every cluster with a parallel counting sort: every band of rows counts its elements
+  * per cluster, the counts give every band its own range inside every cluster, then the bands write their elements.
+  * Because the ranges of the bands are in band order, the elements of a cluster stay in storage order (for every thread count).
+  * @param pool the threadpool (may be nullptr)
+  * @param rows number of rows (y)
+  * @param clusterCount amount of clusters (labels out of [0, clusterCount) are ignored)
+  * @param scan functor like void(int begin, int end, IndexVisitor<Index> &visit): calls visit(k, e) for every element e
+  * of the rows [begin, end) in storage order, k is its label. It is called twice for every band.
+  * @return the index
+  */
+  template<typename Index, typename S>
+  ClusterIndexT<Index> clusterIndex(ThreadPool *pool, int rows, int clusterCount, S scan) {
+	  const int bands = bandCount(pool, rows);
+	  std::vector<std::vector<long>> pos(bands, std::vector<long>(clusterCount, 0));
+	  forEachBand(pool, rows, [&](int band, int begin, int end) {
+		  IndexVisitor<Index> count(pos[band], nullptr, clusterCount);
+		  scan(begin, end, count);
+	  });
+	  ClusterIndexT<Index> res;
+	  res.offsets.resize(clusterCount + 1);
+	  long total = 0;
+	  for (int k = 0; k < clusterCount; k++) {
+		  res.offsets[k] = total;
+		  for (int b = 0; b < bands; b++) {
+			  const long count = pos[b][k];
+			  pos[b][k] = total;
+			  total += count;
+		  }
+	  }
+	  res.offsets[clusterCount] = total;
+	  res.elements.resize(total);
+	  forEachBand(pool, rows, [&](int band, int begin, int end) {
+		  IndexVisitor<Index> write(pos[band], res.elements.data(), clusterCount);
+		  scan(begin, end, write);
+	  });
+	  return res;
+  }
+ }
+}
+#endif // CLUSTERINDEX_P_H
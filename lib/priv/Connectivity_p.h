@@ -0,0 +1,128 @@
+#ifndef CONNECTIVITY_P_H
+#define CONNECTIVITY_P_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Parallel_p.h"
+
+namespace RSlic {
+ namespace priv {
+
+  /**
+  * The connected components of a label image (volume), see connectedComponents.
+  * @tparam Index type of an element and of a component (int for pixels, int64_t for voxels: a movie may have more than 2^31)
+  */
+  template<typename Index>
+  struct ComponentsT {
+	  std::vector<Index> id; // component of every element
+	  std::vector<Index> first; // first element (in storage order) of every component
+	  std::vector<Index> size; // how many elements every component has
+  };
+
+  /**
+  * Finds the connected components in parallel: union-find in bands of rows, then the borders of the bands are merged.
+  * The components are numbered by their first element in storage order, just like a serial
+  * flood fill that scans the elements in storage order finds them. So the result does not depend on the threads.
+  * @param pool the threadpool (may be nullptr)
+  * @param rows number of rows (y)
+  * @param rowSize elements per row
+  * @param earlier functor like int(int row, int k, Index *out): writes the indices of the neighbours of element row * rowSize + k
+  * that come before it (in storage order, at most one row above) and belong to the same component into out, returns how many
+  * @return the components
+  */
+  template<typename Index, typename E>
+  ComponentsT<Index> connectedComponents(ThreadPool *pool, int rows, int rowSize, E earlier) {
+	  const Index n = static_cast<Index>(rows) * rowSize;
+	  std::vector<Index> parent(n);
+	  std::vector<std::pair<int, int>> bands(bandCount(pool, rows));
+
+	  // every root is the smallest element of its tree
+	  auto find = [&parent](Index i) {
+		  while (parent[i] != i) {
+			  parent[i] = parent[parent[i]];
+			  i = parent[i];
+		  }
+		  return i;
+	  };
+	  auto unite = [&find, &parent](Index a, Index b) {
+		  a = find(a);
+		  b = find(b);
+		  if (a < b) parent[b] = a;
+		  else if (b < a) parent[a] = b;
+	  };
+
+	  // every band on its own (the trees stay inside the band)
+	  forEachBand(pool, rows, [&](int band, int begin, int end) {
+		  bands[band] = std::make_pair(begin, end);
+		  const Index bandBegin = static_cast<Index>(begin) * rowSize;
+		  Index neighbours[16];
+		  for (int y = begin; y < end; y++) {
+			  for (int k = 0; k < rowSize; k++) {
+				  const Index i = static_cast<Index>(y) * rowSize + k;
+				  parent[i] = i;
+				  const int count = earlier(y, k, neighbours);
+				  for (int j = 0; j < count; j++) {
+					  if (neighbours[j] >= bandBegin) unite(i, neighbours[j]);
+				  }
+			  }
+		  }
+	  });
+
+	  // the borders of the bands
+	  Index neighbours[16];
+	  for (size_t b = 1; b < bands.size(); b++) {
+		  const int y = bands[b].first;
+		  const Index bandBegin = static_cast<Index>(y) * rowSize;
+		  for (int k = 0; k < rowSize; k++) {
+			  const int count = earlier(y, k, neighbours);
+			  for (int j = 0; j < count; j++) {
+				  if (neighbours[j] < bandBegin) unite(bandBegin + k, neighbours[j]);
+			  }
+		  }
+	  }
+
+	  // the root of every element (parent is only read, the trees may reach into other bands now)
+	  ComponentsT<Index> res;
+	  res.id.resize(n);
+	  std::vector<Index> roots(bands.size(), 0);
+	  forEachBand(pool, rows, [&](int band, int begin, int end) {
+		  for (Index i = static_cast<Index>(begin) * rowSize; i < static_cast<Index>(end) * rowSize; i++) {
+			  Index root = i;
+			  while (parent[root] != root) root = parent[root];
+			  res.id[i] = root;
+			  if (root == i) roots[band]++;
+		  }
+	  });
+
+	  // number the roots in storage order (the number is kept in parent of the root)
+	  std::vector<Index> offsets(bands.size(), 0);
+	  for (size_t b = 1; b < bands.size(); b++) offsets[b] = offsets[b - 1] + roots[b - 1];
+	  const Index count = offsets.back() + roots.back();
+	  res.first.resize(count);
+	  forEachBand(pool, rows, [&](int band, int begin, int end) {
+		  Index next = offsets[band];
+		  for (Index i = static_cast<Index>(begin) * rowSize; i < static_cast<Index>(end) * rowSize; i++) {
+			  if (res.id[i] != i) continue;
+			  res.first[next] = i;
+			  parent[i] = next++;
+		  }
+	  });
+
+	  std::unique_ptr<std::atomic<Index>[]> sizes(new std::atomic<Index>[count]);
+	  for (Index c = 0; c < count; c++) sizes[c].store(0, std::memory_order_relaxed);
+	  forEachBand(pool, rows, [&](int, int begin, int end) {
+		  for (Index i = static_cast<Index>(begin) * rowSize; i < static_cast<Index>(end) * rowSize; i++) {
+			  const Index c = parent[res.id[i]];
+			  res.id[i] = c;
+			  sizes[c].fetch_add(1, std::memory_order_relaxed);
+		  }
+	  });
+	  res.size.resize(count);
+	  for (Index c = 0; c < count; c++) res.size[c] = sizes[c].load(std::memory_order_relaxed);
+	  return res;
+  }
+ }
+}
+#endif // CONNECTIVITY_P_H
@@ -0,0 +1,121 @@
+#ifndef PARALLEL_P_H
+#define PARALLEL_P_H
+
+#include <algorithm>
+#include <vector>
+#include <ThreadPool.h>
+
+namespace RSlic {
+ namespace priv {
+
+  /**
+  * Returns in how many bands forEachBand splits n rows.
+  * Use it to allocate per-band accumulators before calling forEachBand.
+  * @param pool the threadpool (may be nullptr)
+  * @param n number of rows
+  * @return number of bands (at least 1)
+  */
+  inline int bandCount(ThreadPool *pool, int n) {
+#ifdef PARALLEL
+	  if (pool == nullptr || n <= 1) return 1;
+	  // Some more bands than threads, so a slow band doesn't stall the others
+	  int bands = static_cast<int>(pool->threadcount()) * 4;
+	  return std::max(1, std::min(n, bands));
+#else
+	  return 1;
+#endif
+  }
+
+  /**
+  * Returns in how many bands to split n rows for sums that are not exact (doubles of a float picture).
+  * Unlike bandCount the number does not depend on the threads, so sums that are added up in band order
+  * are the same for every thread count (and without PARALLEL).
+  * @param n number of rows
+  * @return number of bands (at least 1, at most 32, at least 16 rows each)
+  */
+  inline int fixedBandCount(int n) {
+	  return std::max(1, std::min(32, n / 16));
+  }
+
+  /**
+  * Returns in how many bands to split n rows for sums: bandCount if the sums are exact, else fixedBandCount.
+  * @param pool the threadpool (may be nullptr)
+  * @param n number of rows
+  * @param exact whether the sums are exact (e.g. of an integer picture), see exactDepth
+  */
+  inline int sumBandCount(ThreadPool *pool, int n, bool exact) {
+	  return exact ? bandCount(pool, n) : fixedBandCount(n);
+  }
+
+  //First row of band b (of bands)
+  inline int bandBegin(int n, int bands, int b) {
+	  return static_cast<int>(static_cast<long>(n) * b / bands);
+  }
+
+  /**
+  * Same as forEachBand(pool, n, f) below, but with the given number of bands (e.g. fixedBandCount).
+  * Without PARALLEL (or without a pool) the calling thread processes them in band order.
+  * @param pool the threadpool (may be nullptr)
+  * @param n number of rows
+  * @param bands number of bands (at least 1)
+  * @param f functor like void(int band, int begin, int end)
+  * @return bands
+  */
+  template<typename F>
+  inline int forEachBand(ThreadPool *pool, int n, int bands, F f) {
+	  if (bands == 1) {
+		  f(0, 0, n);
+		  return 1;
+	  }
+#ifdef PARALLEL
+	  if (pool != nullptr) {
+		  pool->parallel_for(0, bands, 1, [&](int b0, int b1) {
+			  for (int b = b0; b < b1; b++) {
+				  f(b, bandBegin(n, bands, b), bandBegin(n, bands, b + 1));
+			  }
+		  });
+		  return bands;
+	  }
+#endif
+	  for (int b = 0; b < bands; b++) f(b, bandBegin(n, bands, b), bandBegin(n, bands, b + 1));
+	  return bands;
+  }
+
+  /**
+  * Splits the rows [0, n) into contiguous bands and calls f(band, begin, end) for every one of them.
+  * Every row belongs to exactly one band, so f may write into "its" rows of a shared buffer
+  * without locking (owner computes). With PARALLEL the bands are processed by the pool
+  * and the call blocks until all of them are done.
+  * @param pool the threadpool (may be nullptr, then the calling thread does everything)
+  * @param n number of rows
+  * @param f functor like void(int band, int begin, int end)
+  * @return number of bands (equal to bandCount(pool, n))
+  */
+  template<typename F>
+  inline int forEachBand(ThreadPool *pool, int n, F f) {
+	  return forEachBand(pool, n, bandCount(pool, n), f);
+  }
+
+  /**
+  * Computes f(begin, end) for every band (like forEachBand) and sums the results up in the order of the bands,
+  * so the result does not depend on the threads.
+  * @param pool the threadpool (may be nullptr)
+  * @param n number of rows
+  * @param identity the start value
+  * @param f functor like T(int begin, int end)
+  * @param reduce functor like T(const T &, const T &)
+  * @return the combined result
+  */
+  template<typename T, typename F, typename R>
+  inline T reduceBands(ThreadPool *pool, int n, T identity, F f, R reduce) {
+	  const int bands = bandCount(pool, n);
+	  if (bands == 1) return reduce(identity, f(0, n));
+	  return pool->parallel_reduce(0, bands, 1, identity, [&](int b0, int b1) {
+		  T res = identity;
+		  for (int b = b0; b < b1; b++) res = reduce(res, f(bandBegin(n, bands, b), bandBegin(n, bands, b + 1)));
+		  return res;
+	  }, reduce);
+  }
+ }
+}
+#endif // PARALLEL_P_H
@@ -0,0 +1,39 @@
+#ifndef SIMD_P_H
+#define SIMD_P_H
+
+#include <stdint.h>
+
+namespace RSlic {
+ namespace priv {
+  namespace simd {
+
+   /**
+   * Computes the metric of Pixel::distanceColor for the pixels [x0, x0+n) of one row.
+   * out[i] = |pixel - mean color|^2 / stiffness + ((x0+i-cx)^2 + dy^2) / step^2
+   * Uses AVX2 or SSE4.1 if the CPU supports it (chosen once at runtime).
+   * Everything is computed in the same order and precision as the scalar version (no fused multiply-add), so the results are the same bits.
+   * @param row pointer to the row (CV_8UC3)
+   * @param x0 first column
+   * @param n number of pixels
+   * @param mean mean color of the cluster
+   * @param cx x-coordinate of the cluster center
+   * @param dy y-distance to the cluster center
+   * @param stiffness the stiffness as given to the functor
+   * @param step the step
+   * @param out n distances
+   */
+   void colorRow(const uint8_t *row, int x0, int n, const double mean[3], int cx, int dy, int stiffness, int step, double *out);
+
+   /**
+   * Same as colorRow, but for Pixel::distanceGray (CV_8UC1).
+   */
+   void grayRow(const uint8_t *row, int x0, int n, double mean, int cx, int dy, int stiffness, int step, double *out);
+
+   /**
+   * Returns the name of the instruction set that is used ("avx2", "sse4.1" or "scalar")
+   */
+   const char *instructionSet();
+  }
+ }
+}
+#endif // SIMD_P_H
@@ -0,0 +1,141 @@
+#ifndef STATS_P_H
+#define STATS_P_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <ClusterStats.h>
+
+namespace RSlic {
+ namespace priv {
+
+  //Copies the channels of a pixel (voxel) into px
+  template<typename T>
+  inline void pixelChannels(const T &pixel, double *px) {
+	  px[0] = pixel;
+  }
+
+  template<typename T, int n>
+  inline void pixelChannels(const cv::Vec<T, n> &pixel, double *px) {
+	  for (int c = 0; c < n; c++) px[c] = pixel[c];
+  }
+
+  /**
+  * Sums of one band for ClusterStats. All values of a cluster are next to each other
+  * (count, position sums, minima, maxima, channel sums, square sums, cross products), so adding a pixel touches only a few cache lines.
+  * The sums are doubles, which are exact for integer images (and positions), so the result does not depend on the bands there.
+  * Float images are summed up in fixedBandCount bands, so their result does not depend on the threads either.
+  */
+  class StatsSums {
+  public:
+	  StatsSums(int clusters, int dims, int channels, bool withCovariance) :
+			  dims(dims), channels(channels), pairs(withCovariance ? channels * (channels - 1) / 2 : 0),
+			  stride(1 + 3 * dims + 2 * channels + pairs), data(static_cast<size_t>(clusters) * stride, 0) {
+		  for (int k = 0; k < clusters; k++) {
+			  double *s = &data[static_cast<size_t>(k) * stride];
+			  std::fill(s + 1 + dims, s + 1 + 2 * dims, std::numeric_limits<double>::infinity());
+			  std::fill(s + 1 + 2 * dims, s + 1 + 3 * dims, -std::numeric_limits<double>::infinity());
+		  }
+	  }
+
+	  /**
+	  * Adds a pixel (voxel) to cluster k
+	  * @param k the cluster
+	  * @param pos the position (dims values)
+	  * @param px the channels of the pixel (channels values)
+	  */
+	  template<typename T>
+	  inline void add(int k, const int *pos, const T *px) {
+		  double *s = &data[static_cast<size_t>(k) * stride];
+		  s[0] += 1;
+		  double *sum = s + 1;
+		  double *lo = sum + dims;
+		  double *hi = lo + dims;
+		  for (int a = 0; a < dims; a++) {
+			  sum[a] += pos[a];
+			  lo[a] = std::min(lo[a], static_cast<double>(pos[a]));
+			  hi[a] = std::max(hi[a], static_cast<double>(pos[a]));
+		  }
+		  double *csum = hi + dims;
+		  double *sqsum = csum + channels;
+		  double *cross = sqsum + channels;
+		  for (int c = 0; c < channels; c++) {
+			  const double v = px[c];
+			  csum[c] += v;
+			  sqsum[c] += v * v;
+		  }
+		  if (pairs == 0) return;
+		  for (int a = 0; a < channels; a++) {
+			  for (int b = a + 1; b < channels; b++) *cross++ += static_cast<double>(px[a]) * px[b];
+		  }
+	  }
+
+	  /**
+	  * Adds the sums of other (same clusters and layout)
+	  */
+	  StatsSums &operator+=(const StatsSums &other) {
+		  const size_t clusters = data.size() / stride;
+		  for (size_t k = 0; k < clusters; k++) {
+			  double *s = &data[k * stride];
+			  const double *o = &other.data[k * stride];
+			  for (int i = 0; i < stride; i++) {
+				  if (i < 1 + dims || i >= 1 + 3 * dims) s[i] += o[i];
+				  else if (i < 1 + 2 * dims) s[i] = std::min(s[i], o[i]);
+				  else s[i] = std::max(s[i], o[i]);
+			  }
+		  }
+		  return *this;
+	  }
+
+	  /**
+	  * Computes the statistics from the sums
+	  */
+	  ClusterStats result() const {
+		  const int n = static_cast<int>(data.size() / stride);
+		  ClusterStats res;
+		  res.dims = dims;
+		  res.channels = channels;
+		  res.area.assign(n, 0);
+		  res.minPos.assign(dims, std::vector<int>(n, 0));
+		  res.maxPos.assign(dims, std::vector<int>(n, -1));
+		  res.centroid.assign(dims, std::vector<double>(n, 0));
+		  res.mean.assign(channels, std::vector<double>(n, 0));
+		  res.variance.assign(channels, std::vector<double>(n, 0));
+		  res.covariance.assign(pairs, std::vector<double>(n, 0));
+		  for (int k = 0; k < n; k++) {
+			  const double *s = &data[static_cast<size_t>(k) * stride];
+			  const double count = s[0];
+			  if (count == 0) continue;
+			  res.area[k] = static_cast<long>(count);
+			  const double *sum = s + 1;
+			  const double *lo = sum + dims;
+			  const double *hi = lo + dims;
+			  for (int a = 0; a < dims; a++) {
+				  res.centroid[a][k] = sum[a] / count;
+				  res.minPos[a][k] = static_cast<int>(lo[a]);
+				  res.maxPos[a][k] = static_cast<int>(hi[a]);
+			  }
+			  const double *csum = hi + dims;
+			  const double *sqsum = csum + channels;
+			  const double *cross = sqsum + channels;
+			  for (int c = 0; c < channels; c++) {
+				  const double m = csum[c] / count;
+				  res.mean[c][k] = m;
+				  res.variance[c][k] = std::max(0.0, sqsum[c] / count - m * m);
+			  }
+			  for (int a = 0, p = 0; a < channels && pairs > 0; a++) {
+				  for (int b = a + 1; b < channels; b++, p++) {
+					  res.covariance[p][k] = cross[p] / count - res.mean[a][k] * res.mean[b][k];
+				  }
+			  }
+		  }
+		  return res;
+	  }
+
+  private:
+	  int dims, channels, pairs, stride;
+	  std::vector<double> data;
+  };
+ }
+}
+#endif // STATS_P_H
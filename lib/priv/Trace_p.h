@@ -0,0 +1,90 @@
+#ifndef TRACE_P_H
+#define TRACE_P_H
+
+#include <algorithm>
+#include <chrono>
+#include <opencv2/core/core.hpp>
+#include <Trace.h>
+#include "Parallel_p.h"
+
+namespace RSlic {
+ namespace priv {
+
+  /**
+  * How many threads forEachBand uses for n rows (for the utilisation of a phase)
+  */
+  inline int bandThreads(ThreadPool *pool, int n) {
+	  const int bands = bandCount(pool, n);
+	  return bands == 1 ? 1 : std::min(bands, static_cast<int>(pool->threadcount()) + 1); // the caller helps
+  }
+
+  /**
+  * Measures a phase (or a band of it) from its construction to its destruction and reports it to the tracer.
+  * Without TRACING it is empty, so the hooks (and the counting that only feeds them) are compiled out.
+  */
+  class TraceScope {
+  public:
+#ifdef TRACING
+	  TraceScope(Tracer *tracer, const char *phase, int band = -1, int threads = 1) : tracer(tracer) {
+		  if (tracer == nullptr) return;
+		  event.phase = phase;
+		  event.band = band;
+		  event.threads = threads;
+		  event.thread = std::this_thread::get_id();
+		  event.begin = now();
+	  }
+
+	  ~TraceScope() {
+		  end();
+	  }
+
+	  //Reports the phase now instead of at the destruction
+	  inline void end() {
+		  if (tracer == nullptr) return;
+		  event.duration = now() - event.begin;
+		  tracer->record(event);
+		  tracer = nullptr;
+	  }
+
+	  inline void count(long distances, long pixels) {
+		  event.distances += distances;
+		  event.pixels += pixels;
+	  }
+
+	  inline void allocated(size_t bytes) {
+		  event.bytes += bytes;
+	  }
+
+  private:
+	  static int64_t now() {
+		  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	  }
+
+	  Tracer *tracer;
+	  TraceEvent event;
+#else
+	  TraceScope(Tracer *, const char *, int = -1, int = 1) {
+	  }
+
+	  inline void end() {
+	  }
+
+	  inline void count(long, long) {
+	  }
+
+	  inline void allocated(size_t) {
+	  }
+#endif
+
+	  TraceScope(const TraceScope &) = delete;
+
+	  TraceScope &operator=(const TraceScope &) = delete;
+  };
+
+  //Bytes of a Mat
+  inline size_t matBytes(const cv::Mat &m) {
+	  return m.total() * m.elemSize();
+  }
+ }
+}
+#endif // TRACE_P_H
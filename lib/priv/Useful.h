@@ -1,5 +1,9 @@
 #ifndef USEFUL_H
 #define USEFUL_H
+#include <limits>
+#include <utility>
+#include <vector>
+#include <cmath>
 #include <opencv2/core/core.hpp>
 namespace RSlic{
 namespace priv{
@@ -10,6 +14,82 @@ namespace priv{
  template<typename T, std::size_t N>
  constexpr std::size_t aSize(T(&)[N]) noexcept { return N;}
 
+ /**
+  * Returns whether the label type Label is able to number clusterCount clusters.
+  * Leaves some space, because the grid and finalize may produce more clusters than requested.
+  */
+ template<typename Label>
+ constexpr bool labelFits(long clusterCount) noexcept {
+     return clusterCount * 2 <= static_cast<long>(std::numeric_limits<Label>::max());
+ }
+
+ /**
+  * Calls F<Label>()(params...) with the smallest label type (int16_t or int32_t)
+  * that is able to number clusterCount clusters.
+  * F<int16_t> and F<int32_t> have to return the same type.
+  * @param clusterCount the requested amount of clusters
+  * @param params parameter for F<Label>::operator()
+  * @return the result of F<Label>()(params...)
+  */
+ template<template<typename> class F, typename... T>
+ inline auto withClusterInt(long clusterCount, T&&... params) -> decltype(F<int16_t>()(std::forward<T>(params)...)) {
+     if (labelFits<int16_t>(clusterCount))
+         return F<int16_t>()(std::forward<T>(params)...);
+     return F<int32_t>()(std::forward<T>(params)...);
+ }
+
+
+ /**
+  * Returns the sum of the (euclidean) distances the centers moved from before to after.
+  * Both have to contain the same amount of centers.
+  */
+ template<int n>
+ inline double centerDisplacement(const std::vector<cv::Vec<int, n>> &before, const std::vector<cv::Vec<int, n>> &after) {
+     double res = 0;
+     for (size_t k = 0; k < before.size() && k < after.size(); k++) {
+         double sq = 0;
+         for (int i = 0; i < n; i++) {
+             double d = after[k][i] - before[k][i];
+             sq += d * d;
+         }
+         res += std::sqrt(sq);
+     }
+     return res;
+ }
+
+ /**
+  * Returns whether double sums of pixels of this depth are exact (the integer depths CV_8U to CV_32S).
+  * Then the order of the additions (the bands) does not change them and they can be updated by subtracting.
+  */
+ inline bool exactDepth(int depth) {
+     return depth <= CV_32S;
+ }
+
+ /**
+  * Type of the distance buffers of the assignment step.
+  * float halves their memory traffic, double is more precise (cmake option FLOAT_DISTANCE).
+  */
+#ifdef FLOAT_DISTANCE
+ using DistanceType = float;
+#else
+ using DistanceType = double;
+#endif
+
+ /**
+  * The type of one channel of a pixel of type T and the amount of channels.
+  * channels is 0 for a scalar T: such a pixel has as many channels as the picture (e.g. 16 bands of uint16_t).
+  */
+ template<typename T>
+ struct PixelType {
+     using channel = T;
+     static const int channels = 0;
+ };
+
+ template<typename T, int n>
+ struct PixelType<cv::Vec<T, n>> {
+     using channel = T;
+     static const int channels = n;
+ };
 
  template <int n>
  struct cvtp{using type= int;}; //Default
@@ -74,9 +154,10 @@ namespace priv{
 
 // Creates function which calls f with the right template argument based on the type 
 // f -> template Function, ff -> name of new function, def -> comes after default in switch(type){....; default: def}
+// Further template arguments of f (e.g. the label type) will be deduced from params.
 #define declareCVF_T(f,ff,def)\
     template <typename... T>\
-    inline auto ff(int type, T&&... params) -> typename std::result_of<decltype(f<uint8_t>)&(T...)>::type{\
+    inline auto ff(int type, T&&... params) -> decltype(f<uint8_t>(std::forward<T>(params)...)){\
     using namespace RSlic::priv;\
     static_assert(sizeof(float) * CHAR_BIT == 32,"Float Size != 32 Bit");\
     static_assert(sizeof(double) * CHAR_BIT == 64,"Double Size != 64 Bit");\
@@ -115,7 +196,7 @@ namespace priv{
 // Same as declareCVF_T, but does not use the depth.
 #define declareCVF_D(f,ff,d)\
     template <typename... T>\
-    inline auto ff(int type, T&&... params) -> typename std::result_of<decltype(f<uint8_t>)&(T...)>::type{\
+    inline auto ff(int type, T&&... params) -> decltype(f<uint8_t>(std::forward<T>(params)...)){\
     using namespace RSlic::priv;\
     static_assert(sizeof(float) * CHAR_BIT == 32,"Float Size != 32 Bit");\
     static_assert(sizeof(double) * CHAR_BIT == 64,"Double Size != 64 Bit");\
@@ -6,18 +6,19 @@ namespace RSlic{
 namespace priv {
  namespace zero {
 
+  //Squared color distance (double, so 16 bit and float pictures are neither cut off nor overflow)
   template<typename T>
-  inline uint64_t zeroMetrik(T first, T second) {
+  inline double zeroMetrik(T first, T second) {
       static_assert(std::is_arithmetic<T>::value==true,"Need arithmetic type in zeroMetrik");
-      return pow(first - second, 2);
+      return pow(static_cast<double>(first) - second, 2);
   }
 
   template<typename T, int n>
-  inline uint64_t zeroMetrik(const Vec<T, n> &first, const Vec<T, n> &second) {
+  inline double zeroMetrik(const Vec<T, n> &first, const Vec<T, n> &second) {
     static_assert(std::is_arithmetic<T>::value==true,"Need arithmetic type in zeroMetrik");
-    uint64_t res = 0;
+    double res = 0;
 	  for (int i = 0; i < n; i++) {
-		  res += pow(first[i] - second[i], 2);
+		  res += pow(static_cast<double>(first[i]) - second[i], 2);
 	  }
 	  return res;
   }